@@ -0,0 +1,307 @@
+/**
+ * algoslicer.hpp
+ * Defines the service that works parent orders as timed child orders.
+ *
+ * A parent order is worked by one of three schedules: TWAP sends equal slices
+ * at equal intervals, VWAP sends the share of a volume profile due in each
+ * bucket, and an iceberg shows one peak at a time and sends the next peak once
+ * the previous one has filled. Every parent has at most one timer on a
+ * TimingWheel, so starting, cancelling and slicing a parent are O(1) however
+ * many parents are working. Child orders carry the parent's id and go to the
+ * service's listeners exactly as BondAlgoExecutionService's orders do.
+ */
+#ifndef ALGO_SLICER_HPP
+#define ALGO_SLICER_HPP
+
+#include <string>
+#include <vector>
+#include <optional>
+#include <unordered_map>
+#include <cstdint>
+#include <cmath>
+#include "soa.hpp"
+#include "products.hpp"
+#include "productregistry.hpp"
+#include "executionservice.hpp"
+#include "matchingengine.hpp"
+#include "timingwheel.hpp"
+
+using namespace std;
+
+// Schedule a parent order is worked by
+enum SliceAlgo { TWAP, VWAP, ICEBERG };
+
+// Identifies a working parent order until it completes or is cancelled
+using ParentId = uint32_t;
+
+class BondAlgoSlicingService: public Service<string, ExecutionOrder<Bond> > {
+private:
+    struct ParentOrder {
+        string orderId;
+        const Bond* product;
+        ProductHandle handle;
+        PricingSide side;
+        OrderType orderType;
+        TickPrice price;
+        SliceAlgo algo;
+        long quantity; // parent size
+        long sent; // quantity sent as children so far
+        long peak; // iceberg show size
+        long working; // iceberg quantity shown and not yet filled or cancelled
+        uint64_t start;
+        uint64_t interval; // ticks between slices
+        int slices; // number of TWAP slices or VWAP buckets
+        int sliceNum; // slices sent so far
+        int profile; // VWAP profile
+        int childNum;
+        bool active;
+        bool timed; // has a timer on the wheel
+        TimerId timer;
+    };
+
+    const ProductRegistry& registry;
+    vector<ParentOrder> parents;
+    vector<ParentId> freeParents;
+    size_t activeCount;
+    TimingWheel<ParentId> wheel;
+    vector<vector<double> > profiles; // cumulative weights, ending at 1
+    unordered_map<string, ParentId> workingPeaks; // iceberg child order id to its parent
+    uint64_t refillDelay;
+    vector<optional<ExecutionOrder<Bond> > > lastChildren; // last child, indexed by product handle
+    vector< ServiceListener<ExecutionOrder<Bond> >* > childListeners;
+
+    ParentId Open(const string& orderId, const Bond& product, PricingSide side, OrderType orderType, TickPrice price, SliceAlgo algo, long quantity) {
+        ParentId parent;
+        if (!freeParents.empty()) {
+            parent = freeParents.back();
+            freeParents.pop_back();
+        } else {
+            parent = ParentId(parents.size());
+            parents.emplace_back();
+        }
+        ParentOrder& p = parents[parent];
+        p.orderId = orderId;
+        p.product = &product;
+        p.handle = registry.HandleOf(product);
+        p.side = side;
+        p.orderType = orderType;
+        p.price = price;
+        p.algo = algo;
+        p.quantity = quantity;
+        p.sent = 0;
+        p.peak = 0;
+        p.working = 0;
+        p.start = 0;
+        p.interval = 0;
+        p.slices = 0;
+        p.sliceNum = 0;
+        p.profile = 0;
+        p.childNum = 0;
+        p.active = true;
+        p.timed = false;
+        ++activeCount;
+        return parent;
+    }
+
+    void Close(ParentId parent) {
+        ParentOrder& p = parents[parent];
+        if (p.timed)
+            wheel.Cancel(p.timer);
+        if (p.algo == ICEBERG && p.working > 0)
+            workingPeaks.erase(p.orderId + "-" + to_string(p.childNum));
+        p.active = false;
+        p.timed = false;
+        freeParents.push_back(parent);
+        --activeCount;
+    }
+
+    void Arm(ParentId parent, uint64_t when) {
+        ParentOrder& p = parents[parent];
+        p.timer = wheel.Schedule(when, parent);
+        p.timed = true;
+    }
+
+    void SendChild(ParentOrder& p, long quantity) {
+        p.sent += quantity;
+        ExecutionOrder<Bond> child(*p.product, p.side, p.orderId + "-" + to_string(++p.childNum), p.orderType, p.price, quantity, 0, p.orderId, true);
+        if (p.handle != ProductRegistry::NOT_FOUND)
+            lastChildren[p.handle].emplace(child);
+        for (auto & listener : childListeners)
+            listener->ProcessAdd(child);
+    }
+
+    // Send whatever the parent's schedule has due now and arm its next timer
+    void Slice(ParentId parent) {
+        ParentOrder& p = parents[parent];
+        p.timed = false;
+        long due = 0;
+        switch (p.algo) {
+        case TWAP:
+            due = (p.quantity - p.sent) / (p.slices - p.sliceNum);
+            break;
+        case VWAP:
+            due = llround(double(p.quantity) * profiles[p.profile][p.sliceNum]) - p.sent;
+            break;
+        case ICEBERG:
+            due = (p.quantity - p.sent < p.peak) ? p.quantity - p.sent : p.peak;
+            if (due <= 0) {
+                Close(parent);
+                return;
+            }
+            p.working = due;
+            workingPeaks[p.orderId + "-" + to_string(p.childNum + 1)] = parent;
+            SendChild(p, due); // reports for the peak may come back before this returns
+            return;
+        }
+        ++p.sliceNum;
+        if (p.sliceNum == p.slices)
+            due = p.quantity - p.sent;
+        if (due > 0)
+            SendChild(p, due);
+        if (p.sliceNum == p.slices)
+            Close(parent);
+        else
+            Arm(parent, p.start + p.interval * uint64_t(p.sliceNum));
+    }
+
+public:
+    // Returned for a parent order that was refused
+    static constexpr ParentId NO_PARENT = UINT32_MAX;
+
+    // ctor for a slicer whose clock starts at start; an iceberg shows its next peak refillDelay ticks after a fill
+    explicit BondAlgoSlicingService(const ProductRegistry& _registry, uint64_t start = 0, uint64_t _refillDelay = 1):
+        registry(_registry), activeCount(0), wheel(start), refillDelay(_refillDelay), lastChildren(_registry.Size()) {}
+
+    ExecutionOrder<Bond>& GetData(string key) override {
+        return lastChildren.at(registry.Find(key)).value();
+    }
+
+    void OnMessage(ExecutionOrder<Bond> &data) override {}
+
+    void AddListener(ServiceListener<ExecutionOrder<Bond> > *listener) override {childListeners.push_back(listener);}
+
+    const vector< ServiceListener<ExecutionOrder<Bond> >* >& GetListeners() const override {return childListeners;}
+
+    // Register a volume profile of bucket weights for VWAP; returns its id. No weights is one bucket.
+    int AddVolumeProfile(const vector<double>& weights) {
+        if (weights.empty())
+            return AddVolumeProfile(vector<double>(1, 1.));
+        double total = 0;
+        for (double w : weights)
+            total += w;
+        vector<double> cumulative;
+        cumulative.reserve(weights.size());
+        double sum = 0;
+        for (double w : weights) {
+            sum += w;
+            cumulative.push_back(total > 0 ? sum / total : double(cumulative.size() + 1) / double(weights.size()));
+        }
+        profiles.push_back(cumulative);
+        return int(profiles.size() - 1);
+    }
+
+    // Work quantity in equal slices over [start, end), the first at start
+    ParentId StartTwap(const string& orderId, const Bond& product, PricingSide side, OrderType orderType, TickPrice price, long quantity, uint64_t start, uint64_t end, int slices) {
+        ParentId parent = Open(orderId, product, side, orderType, price, TWAP, quantity);
+        ParentOrder& p = parents[parent];
+        p.slices = (slices > 0) ? slices : 1;
+        p.start = start;
+        p.interval = (end > start) ? (end - start) / uint64_t(p.slices) : 0;
+        Arm(parent, start);
+        return parent;
+    }
+
+    // Work quantity over [start, end) in the profile's buckets, each sending its share of the volume
+    ParentId StartVwap(const string& orderId, const Bond& product, PricingSide side, OrderType orderType, TickPrice price, long quantity, uint64_t start, uint64_t end, int profile) {
+        ParentId parent = Open(orderId, product, side, orderType, price, VWAP, quantity);
+        ParentOrder& p = parents[parent];
+        p.profile = profile;
+        p.slices = int(profiles[profile].size());
+        p.start = start;
+        p.interval = (end > start) ? (end - start) / uint64_t(p.slices) : 0;
+        Arm(parent, start);
+        return parent;
+    }
+
+    // Work quantity peak at a time, showing the next peak once the last one has filled.
+    // A quantity that is not positive is refused with NO_PARENT.
+    ParentId StartIceberg(const string& orderId, const Bond& product, PricingSide side, OrderType orderType, TickPrice price, long quantity, long peak) {
+        if (quantity <= 0)
+            return NO_PARENT;
+        ParentId parent = Open(orderId, product, side, orderType, price, ICEBERG, quantity);
+        parents[parent].peak = (peak > 0) ? peak : quantity;
+        Arm(parent, wheel.Now() + 1);
+        return parent;
+    }
+
+    // Stop working a parent; children already sent are left working
+    void Cancel(ParentId parent) {
+        if (parent < parents.size() && parents[parent].active)
+            Close(parent);
+    }
+
+    // Move the clock to now, sending every child that falls due on the way
+    void Advance(uint64_t now) {
+        wheel.Advance(now, [this](ParentId parent) {Slice(parent);});
+    }
+
+    // Count a report against the iceberg peak it belongs to, directly or through a
+    // child the router split it into. Once the peak has filled the next one is armed;
+    // a peak that was partly cancelled or rejected ends the parent, as nothing is left
+    // at its price to refill against. Reports for a parent that has been closed are ignored.
+    void OnChildReport(const ExecutionReport<Bond>& report) {
+        const string& orderId = report.GetOrderId();
+        auto it = workingPeaks.find(orderId);
+        if (it == workingPeaks.end()) {
+            size_t dash = orderId.rfind('-');
+            if (dash == string::npos || (it = workingPeaks.find(orderId.substr(0, dash))) == workingPeaks.end())
+                return;
+        }
+        ParentId parent = it->second;
+        ParentOrder& p = parents[parent];
+        if (!p.active) {
+            workingPeaks.erase(it);
+            return;
+        }
+        ExecutionStatus status = report.GetStatus();
+        if (status == ORDER_NEW)
+            return;
+        p.working -= report.GetQuantity();
+        if (status == ORDER_CANCELLED || status == ORDER_REJECTED)
+            p.sent = p.quantity;
+        if (p.working > 0)
+            return;
+        workingPeaks.erase(it);
+        if (p.sent == p.quantity)
+            Close(parent);
+        else if (!p.timed)
+            Arm(parent, wheel.Now() + refillDelay);
+    }
+
+    // Get the current tick
+    uint64_t Now() const {
+        return wheel.Now();
+    }
+
+    // Get the number of parents still working
+    size_t GetActiveCount() const {
+        return activeCount;
+    }
+};
+
+class BondAlgoSliceReportListener: public ServiceListener<ExecutionReport<Bond> > {
+private:
+    BondAlgoSlicingService& bondAlgoSlicingService;
+public:
+    explicit BondAlgoSliceReportListener(BondAlgoSlicingService& src): bondAlgoSlicingService(src) {}
+
+    virtual ~BondAlgoSliceReportListener() = default;
+
+    void ProcessAdd(ExecutionReport<Bond> &data) override {bondAlgoSlicingService.OnChildReport(data);}
+
+    void ProcessRemove(ExecutionReport<Bond> &data) override {}
+
+    void ProcessUpdate(ExecutionReport<Bond> &data) override {}
+};
+
+#endif
@@ -0,0 +1,220 @@
+/**
+ * algostrategies.hpp
+ * Defines the algo execution strategies and the set that picks one per product.
+ *
+ * A strategy looks at a product's top of book and decides whether to send an
+ * order. Strategies are plain classes checked against the AlgoStrategy
+ * concept rather than subclasses of a virtual base: an AlgoStrategySet holds
+ * one instance of each strategy it is given and a strategy index per product,
+ * and its Decide expands into a branch per strategy, so every strategy's code
+ * is inlined into the market data callback.
+ */
+#ifndef ALGO_STRATEGIES_HPP
+#define ALGO_STRATEGIES_HPP
+
+#include <vector>
+#include <tuple>
+#include <utility>
+#include <concepts>
+#include <cstdint>
+#include <cstddef>
+#include "products.hpp"
+#include "productregistry.hpp"
+#include "marketdataservice.hpp"
+#include "tickprice.hpp"
+
+using namespace std;
+
+// An order a strategy has decided to send: either it takes the whole contra level
+// it is priced at, or it is passive and rests at its price
+struct AlgoOrder
+{
+  PricingSide side;
+  TickPrice price;
+  long quantity;
+  bool passive;
+};
+
+// A strategy is built for a number of products and decides on one product's top of book at a time
+template<typename S>
+concept AlgoStrategy = requires(S strategy, const TopOfBook<Bond> &top, ProductHandle handle, AlgoOrder &order) {
+  S(size_t(0));
+  { strategy.Decide(top, handle, order) } -> same_as<bool>;
+};
+
+/**
+ * Crosses the whole touch level, buying first and then alternating per product.
+ */
+class AlternatingCross
+{
+
+public:
+
+  explicit AlternatingCross(size_t products) : buyNext(products, 1) {}
+
+  bool Decide(const TopOfBook<Bond> &top, ProductHandle handle, AlgoOrder &order)
+  {
+    const Order &level = buyNext[handle] ? top.GetOfferOrder() : top.GetBidOrder();
+    if (level.GetQuantity() <= 0)
+      return false;
+    buyNext[handle] = !buyNext[handle];
+    order = AlgoOrder{level.GetSide() == OFFER ? BID : OFFER, level.GetPrice(), level.GetQuantity(), false};
+    return true;
+  }
+
+private:
+  vector<char> buyNext; // indexed by product handle
+
+};
+
+/**
+ * Crosses like AlternatingCross, but only while the spread is no wider than a limit.
+ */
+class TightSpreadCross
+{
+
+public:
+
+  explicit TightSpreadCross(size_t products) : cross(products), maxSpread(TickPrice::FromTicks(2)) {}
+
+  // Set the widest spread that is crossed; 1/128 by default
+  void SetMaxSpread(TickPrice _maxSpread) { maxSpread = _maxSpread; }
+
+  bool Decide(const TopOfBook<Bond> &top, ProductHandle handle, AlgoOrder &order)
+  {
+    if (top.GetBidOrder().GetQuantity() <= 0 || top.GetOfferOrder().GetQuantity() <= 0)
+      return false;
+    if (top.GetOfferOrder().GetPrice() - top.GetBidOrder().GetPrice() > maxSpread)
+      return false;
+    return cross.Decide(top, handle, order);
+  }
+
+private:
+  AlternatingCross cross;
+  TickPrice maxSpread;
+
+};
+
+/**
+ * Joins the touch with a resting limit order of a fixed clip, bid first and then alternating per product.
+ */
+class PassiveJoin
+{
+
+public:
+
+  explicit PassiveJoin(size_t products) : bidNext(products, 1), clip(1000000) {}
+
+  // Set the quantity of each order
+  void SetClip(long _clip) { clip = _clip; }
+
+  bool Decide(const TopOfBook<Bond> &top, ProductHandle handle, AlgoOrder &order)
+  {
+    const Order &level = bidNext[handle] ? top.GetBidOrder() : top.GetOfferOrder();
+    if (level.GetQuantity() <= 0)
+      return false;
+    bidNext[handle] = !bidNext[handle];
+    order = AlgoOrder{level.GetSide(), level.GetPrice(), clip, true};
+    return true;
+  }
+
+private:
+  vector<char> bidNext; // indexed by product handle
+  long clip;
+
+};
+
+/**
+ * Takes the side the touch is leaning towards: buys the offer when the bid shows
+ * at least a threshold share of the quantity at the touch, sells the bid when the
+ * offer does.
+ */
+class ImbalanceTake
+{
+
+public:
+
+  explicit ImbalanceTake(size_t) : threshold(0.7) {}
+
+  // Set the share of the touch quantity one side needs to show; 0.7 by default
+  void SetThreshold(double _threshold) { threshold = _threshold; }
+
+  bool Decide(const TopOfBook<Bond> &top, ProductHandle, AlgoOrder &order)
+  {
+    long bid = top.GetBidOrder().GetQuantity();
+    long offer = top.GetOfferOrder().GetQuantity();
+    if (bid <= 0 || offer <= 0)
+      return false;
+    double share = double(bid) / double(bid + offer);
+    const Order* level;
+    if (share >= threshold)
+      level = &top.GetOfferOrder();
+    else if (1. - share >= threshold)
+      level = &top.GetBidOrder();
+    else
+      return false;
+    order = AlgoOrder{level->GetSide() == OFFER ? BID : OFFER, level->GetPrice(), level->GetQuantity(), false};
+    return true;
+  }
+
+private:
+  double threshold;
+
+};
+
+/**
+ * One instance of each strategy and the strategy each product is worked by.
+ * Every product starts on the first strategy.
+ */
+template<AlgoStrategy... Strategies>
+class AlgoStrategySet
+{
+
+public:
+
+  // ctor for a set over a number of products
+  explicit AlgoStrategySet(size_t products) : strategies(Strategies(products)...), choice(products, 0) {}
+
+  // Work a product with strategy S from now on
+  template<typename S>
+  void Select(ProductHandle handle) { choice[handle] = uint8_t(IndexOf<S>()); }
+
+  // Get the instance of strategy S, to configure it
+  template<typename S>
+  S& Get() { return get<IndexOf<S>()>(strategies); }
+
+  // Let the product's strategy decide on its top of book
+  bool Decide(const TopOfBook<Bond> &top, ProductHandle handle, AlgoOrder &order)
+  {
+    return Dispatch(top, handle, order, index_sequence_for<Strategies...>());
+  }
+
+private:
+  template<typename S, size_t I = 0>
+  static constexpr size_t IndexOf()
+  {
+    static_assert(I < sizeof...(Strategies), "strategy is not in the set");
+    if constexpr (same_as<S, tuple_element_t<I, tuple<Strategies...> > >)
+      return I;
+    else
+      return IndexOf<S, I + 1>();
+  }
+
+  template<size_t... I>
+  bool Dispatch(const TopOfBook<Bond> &top, ProductHandle handle, AlgoOrder &order, index_sequence<I...>)
+  {
+    uint8_t chosen = choice[handle];
+    bool sent = false;
+    ((chosen == I && (sent = get<I>(strategies).Decide(top, handle, order), true)) || ...);
+    return sent;
+  }
+
+  tuple<Strategies...> strategies;
+  vector<uint8_t> choice; // indexed by product handle
+
+};
+
+// The strategies BondAlgoExecutionService can put a product on
+using BondAlgoStrategies = AlgoStrategySet<AlternatingCross, TightSpreadCross, PassiveJoin, ImbalanceTake>;
+
+#endif
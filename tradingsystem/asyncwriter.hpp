@@ -0,0 +1,381 @@
+/**
+ * asyncwriter.hpp
+ * Defines an asynchronous, batching log writer shared by the output connectors.
+ *
+ * Producers format a record into a LogLine on their own stack and hand it to
+ * Append(), which copies it into a bounded lock-free ring and returns. A
+ * dedicated I/O thread drains the ring into large per-file buffers and writes
+ * them out in groups according to a FlushPolicy, keeping every file open for
+ * the lifetime of the writer. The trading path never waits on disk; it only
+ * spins if the ring is full. Short and interrupted writes are resumed; other
+ * write errors have no caller to go back to, so they are counted instead.
+ */
+#ifndef ASYNC_WRITER_HPP
+#define ASYNC_WRITER_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <charconv>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include "fractionalprice.hpp"
+
+using namespace std;
+
+/**
+ * When buffered records are written out and made durable.
+ * A group is committed once groupRecords records are buffered or the oldest
+ * buffered record is groupMicros old, whichever comes first.
+ */
+struct FlushPolicy
+{
+  long groupRecords = 512;
+  long groupMicros = 1000;
+  bool fsyncOnCommit = false;
+};
+
+/**
+ * A fixed-capacity line formatted on the stack without allocation.
+ */
+class LogLine
+{
+
+public:
+
+  static const size_t CAPACITY = 512;
+
+  LogLine() : length(0) {}
+
+  // Append raw text
+  LogLine& operator<<(string_view text)
+  {
+    size_t n = (text.size() < CAPACITY - length) ? text.size() : CAPACITY - length;
+    memcpy(buffer + length, text.data(), n);
+    length += n;
+    return *this;
+  }
+
+  // Append a single character
+  LogLine& operator<<(char c)
+  {
+    if (length < CAPACITY)
+      buffer[length++] = c;
+    return *this;
+  }
+
+  // Append an integer in decimal
+  LogLine& operator<<(long value)
+  {
+    char digits[24];
+    return *this << string_view(digits, size_t(to_chars(digits, digits + sizeof(digits), value).ptr - digits));
+  }
+
+  // Append a decimal number with six fixed decimals, as to_string(double) prints it
+  LogLine& AppendFixed(double value)
+  {
+    char digits[64];
+    return *this << string_view(digits, size_t(to_chars(digits, digits + sizeof(digits), value, chars_format::fixed, 6).ptr - digits));
+  }
+
+  // Append a price as NNN-XXY
+  LogLine& AppendPrice(TickPrice price)
+  {
+    char digits[FRACTIONAL_PRICE_MAX_LENGTH];
+    return *this << string_view(digits, size_t(FormatTickPrice(price, digits) - digits));
+  }
+
+  const char* Data() const { return buffer; }
+
+  size_t Size() const { return length; }
+
+private:
+  char buffer[CAPACITY];
+  size_t length;
+
+};
+
+class AsyncLogWriter
+{
+
+public:
+
+  // ctor for a writer; ringCapacity is rounded up to a power of two
+  explicit AsyncLogWriter(FlushPolicy _policy = FlushPolicy(), size_t ringCapacity = 1 << 14);
+
+  // Drain everything still queued, write it out and stop the I/O thread
+  ~AsyncLogWriter();
+
+  AsyncLogWriter(const AsyncLogWriter&) = delete;
+  AsyncLogWriter& operator=(const AsyncLogWriter&) = delete;
+
+  // Open a file for appending and get its id; opening the same path twice gives the same id
+  int Open(const string &path);
+
+  // Queue a record for the file; thread-safe and lock-free
+  void Append(int fileId, const char* data, size_t length);
+
+  // Queue a formatted line for the file
+  void Append(int fileId, const LogLine &line);
+
+  // Block until every record queued before this call has been written out
+  void Flush();
+
+  // Get the number of write and fsync system calls issued so far
+  long GetWriteCount() const;
+  long GetSyncCount() const;
+
+  // Get the number of write and fsync calls that failed, and the errno of the last one;
+  // a failed write drops the rest of that file's buffer
+  long GetErrorCount() const;
+  int GetLastError() const;
+
+  // Get the process-wide writer used by the output connectors
+  static AsyncLogWriter& Default();
+
+private:
+  static const size_t SLOT_PAYLOAD = 116;
+  static const int MAX_FILES = 64;
+  static const size_t FILE_BUFFER = 1 << 20;
+
+  struct Slot
+  {
+    atomic<uint64_t> sequence;
+    uint16_t fileId;
+    uint16_t length;
+    char payload[SLOT_PAYLOAD];
+  };
+
+  struct OutputFile
+  {
+    string path;
+    int fd = -1;
+    vector<char> pending;
+  };
+
+  void Run();
+  bool Drain(size_t maxRecords);
+  void Commit();
+  void WriteOut(OutputFile &file);
+
+  FlushPolicy policy;
+  vector<Slot> ring;
+  size_t mask;
+  alignas(64) atomic<uint64_t> tail;
+  alignas(64) uint64_t head;
+  alignas(64) atomic<uint64_t> committed;
+  atomic<bool> flushRequested;
+  atomic<bool> stopping;
+  OutputFile files[MAX_FILES];
+  atomic<int> fileCount;
+  mutex openMutex;
+  atomic<long> writeCount;
+  atomic<long> syncCount;
+  atomic<long> errorCount;
+  atomic<int> lastError;
+  thread worker;
+
+};
+
+AsyncLogWriter::AsyncLogWriter(FlushPolicy _policy, size_t ringCapacity) :
+  policy(_policy), tail(0), head(0), committed(0), flushRequested(false), stopping(false), fileCount(0), writeCount(0), syncCount(0), errorCount(0), lastError(0)
+{
+  size_t capacity = 16;
+  while (capacity < ringCapacity)
+    capacity <<= 1;
+  ring = vector<Slot>(capacity);
+  mask = capacity - 1;
+  for (size_t i = 0; i < capacity; ++i)
+    ring[i].sequence.store(i, memory_order_relaxed);
+  worker = thread(&AsyncLogWriter::Run, this);
+}
+
+AsyncLogWriter::~AsyncLogWriter()
+{
+  stopping.store(true, memory_order_release);
+  worker.join();
+  for (int i = 0; i < fileCount.load(); ++i)
+    ::close(files[i].fd);
+}
+
+int AsyncLogWriter::Open(const string &path)
+{
+  lock_guard<mutex> lock(openMutex);
+  int count = fileCount.load(memory_order_relaxed);
+  for (int i = 0; i < count; ++i) {
+    if (files[i].path == path)
+      return i;
+  }
+  if (count == MAX_FILES)
+    return -1;
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (fd < 0)
+    return -1;
+  files[count].path = path;
+  files[count].fd = fd;
+  files[count].pending.reserve(FILE_BUFFER);
+  fileCount.store(count + 1, memory_order_release);
+  return count;
+}
+
+void AsyncLogWriter::Append(int fileId, const char* data, size_t length)
+{
+  if (fileId < 0)
+    return;
+  // a record longer than one slot takes consecutive tickets so it stays contiguous
+  size_t slots = (length + SLOT_PAYLOAD - 1) / SLOT_PAYLOAD;
+  if (slots == 0)
+    return;
+  uint64_t ticket = tail.fetch_add(slots, memory_order_relaxed);
+  for (size_t i = 0; i < slots; ++i) {
+    Slot &slot = ring[(ticket + i) & mask];
+    while (slot.sequence.load(memory_order_acquire) != ticket + i)
+      this_thread::yield();
+    size_t n = (length < SLOT_PAYLOAD) ? length : SLOT_PAYLOAD;
+    slot.fileId = uint16_t(fileId);
+    slot.length = uint16_t(n);
+    memcpy(slot.payload, data, n);
+    data += n;
+    length -= n;
+    slot.sequence.store(ticket + i + 1, memory_order_release);
+  }
+}
+
+void AsyncLogWriter::Append(int fileId, const LogLine &line)
+{
+  Append(fileId, line.Data(), line.Size());
+}
+
+void AsyncLogWriter::Flush()
+{
+  uint64_t target = tail.load(memory_order_acquire);
+  while (committed.load(memory_order_acquire) < target) {
+    flushRequested.store(true, memory_order_release);
+    this_thread::yield();
+  }
+}
+
+long AsyncLogWriter::GetWriteCount() const
+{
+  return writeCount.load();
+}
+
+long AsyncLogWriter::GetSyncCount() const
+{
+  return syncCount.load();
+}
+
+long AsyncLogWriter::GetErrorCount() const
+{
+  return errorCount.load();
+}
+
+int AsyncLogWriter::GetLastError() const
+{
+  return lastError.load();
+}
+
+AsyncLogWriter& AsyncLogWriter::Default()
+{
+  static AsyncLogWriter writer;
+  return writer;
+}
+
+bool AsyncLogWriter::Drain(size_t maxRecords)
+{
+  size_t drained = 0;
+  while (drained < maxRecords) {
+    Slot &slot = ring[head & mask];
+    if (slot.sequence.load(memory_order_acquire) != head + 1)
+      break;
+    OutputFile &file = files[slot.fileId];
+    if (file.pending.size() + slot.length > FILE_BUFFER) {
+      // keep per-file buffers bounded; write this one out early
+      WriteOut(file);
+    }
+    file.pending.insert(file.pending.end(), slot.payload, slot.payload + slot.length);
+    slot.sequence.store(head + ring.size(), memory_order_release);
+    ++head;
+    ++drained;
+  }
+  return drained > 0;
+}
+
+// Write a file's whole buffer, resuming after short writes and retrying on EINTR,
+// then empty it; any other error is counted and the rest of the buffer dropped
+void AsyncLogWriter::WriteOut(OutputFile &file)
+{
+  const char* data = file.pending.data();
+  size_t left = file.pending.size();
+  while (left > 0) {
+    ssize_t written = ::write(file.fd, data, left);
+    writeCount.fetch_add(1, memory_order_relaxed);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      lastError.store(errno, memory_order_relaxed);
+      errorCount.fetch_add(1, memory_order_relaxed);
+      break;
+    }
+    data += written;
+    left -= size_t(written);
+  }
+  file.pending.clear();
+}
+
+void AsyncLogWriter::Commit()
+{
+  int count = fileCount.load(memory_order_acquire);
+  for (int i = 0; i < count; ++i) {
+    OutputFile &file = files[i];
+    if (file.pending.empty())
+      continue;
+    WriteOut(file);
+    if (policy.fsyncOnCommit) {
+      if (::fsync(file.fd) < 0) {
+        lastError.store(errno, memory_order_relaxed);
+        errorCount.fetch_add(1, memory_order_relaxed);
+      }
+      syncCount.fetch_add(1, memory_order_relaxed);
+    }
+  }
+  committed.store(head, memory_order_release);
+}
+
+void AsyncLogWriter::Run()
+{
+  using Clock = chrono::steady_clock;
+  long buffered = 0;
+  Clock::time_point oldest = Clock::now();
+  auto groupWindow = chrono::microseconds(policy.groupMicros);
+  while (true) {
+    bool stop = stopping.load(memory_order_acquire);
+    uint64_t before = head;
+    bool progressed = Drain(size_t(policy.groupRecords));
+    if (progressed) {
+      if (buffered == 0)
+        oldest = Clock::now();
+      buffered += long(head - before);
+    }
+    bool flush = flushRequested.exchange(false, memory_order_acq_rel);
+    if (buffered > 0 && (flush || stop || buffered >= policy.groupRecords || Clock::now() - oldest >= groupWindow)) {
+      Commit();
+      buffered = 0;
+    } else if (flush) {
+      committed.store(head, memory_order_release);
+    }
+    if (stop && !progressed)
+      break;
+    if (!progressed)
+      this_thread::sleep_for(chrono::microseconds(50));
+  }
+  Commit();
+}
+
+#endif
@@ -0,0 +1,1388 @@
+/**
+ * benchmark.cpp
+ * Throughput benchmarks for the trading system building blocks.
+ *
+ * Usage: ./benchmark [section]
+ * With no argument every section is run; otherwise only the named one.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <cstdio>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
+#include "streamreader.hpp"
+#include "fractionalprice.hpp"
+#include "asyncwriter.hpp"
+#include "flatorderbook.hpp"
+#include "matchingengine.hpp"
+#include "algoslicer.hpp"
+#include "algostrategies.hpp"
+#include "orderstore.hpp"
+#include "pretraderisk.hpp"
+#include "ratelimiter.hpp"
+#include "servicebus.hpp"
+#include "historicaldataservice.hpp"
+#include "staticpipeline.hpp"
+
+using namespace std;
+
+using BenchClock = chrono::steady_clock;
+
+// Seconds elapsed since start
+double Elapsed(BenchClock::time_point start)
+{
+    return chrono::duration<double>(BenchClock::now() - start).count();
+}
+
+// Write a prices-style feed of n lines to path
+void WritePriceFeed(const string& path, long n)
+{
+    const char* cusips[] = {"91282CFX4", "91282CGA3", "91282CFZ9", "91282CFY2", "91282CFV8", "912810TM0", "912810TL2"};
+    ofstream oFile(path, ios_base::trunc);
+    for (long i = 0; i < n; ++i) {
+        int t = int(i % 256);
+        oFile << cusips[i % 7] << "," << 99 + (i & 1) << "-" << (t / 8 < 10 ? "0" : "") << t / 8 << t % 8 << ","
+              << 99 + (i & 1) << "-" << (t / 8 < 10 ? "0" : "") << t / 8 << t % 8 << ",4\n";
+    }
+}
+
+// The connectors' original access pattern: reopen the file and skip counter lines per record
+long LegacyReadRecord(const string& path, long counter)
+{
+    ifstream iFile;
+    iFile.open(path);
+    string line;
+    for (long i = 0; i < counter; ++i)
+        getline(iFile, line);
+    long bytes = 0;
+    if (getline(iFile, line))
+        bytes = long(line.size());
+    iFile.close();
+    return bytes;
+}
+
+// Reader benchmark: reopen-and-skip versus the persistent StreamReader cursor
+void BenchStreamReader()
+{
+    cout << "== streamreader: reopen-and-skip vs persistent cursor ==" << endl;
+    const string path = "./bench_feed.txt";
+    for (long n : {10000L, 100000L, 1000000L}) {
+        WritePriceFeed(path, n);
+
+        // The legacy cost is quadratic, so it is sampled around the average skip depth
+        // (n/2 lines) and scaled up to n records rather than run to completion.
+        long samples = 200;
+        long sink = 0;
+        auto start = BenchClock::now();
+        for (long i = 0; i < samples; ++i)
+            sink += LegacyReadRecord(path, n / 2 + i);
+        double legacy = Elapsed(start) * double(n) / double(samples);
+
+        start = BenchClock::now();
+        StreamReader reader(path);
+        string_view line;
+        while (reader.NextLine(line))
+            sink += long(line.size());
+        double cursor = Elapsed(start);
+
+        cout << "  lines=" << n
+             << "  reopen-and-skip(est)=" << legacy << "s"
+             << "  cursor=" << cursor << "s"
+             << "  cursor rate=" << double(n) / cursor / 1e6 << "M lines/s"
+             << "  speedup=" << legacy / cursor << "x"
+             << "  (checksum " << sink << ")" << endl;
+    }
+    remove(path.c_str());
+}
+
+// The connectors' original price parsing: substr/stod/stoi on every field
+double LegacyParsePrice(const string& field)
+{
+    int index = 0;
+    for (; index < int(field.size()); ++index) {
+        if (field[index] == '-')
+            break;
+    }
+    double price = stod(field.substr(0, index));
+    string frac = field.substr(index + 1);
+    price += (frac[2]=='+')?0.:(stoi(frac.substr(2)) / 256.);
+    price += stod(frac.substr(0, 2)) / 32.;
+    return price;
+}
+
+// Check that the batch parser accepts and rejects exactly the fields the scalar parser does
+bool MalformedAgree()
+{
+    vector<string_view> fields = {"99-329", "99-238", "99-2a4", "99-/1", "99-1:", "99-3+", "99-31+", "99-317", "99-32",
+                                  "99-40", "99-0", "99-", "99-000", "99-1234", "-05", "x99-01", "99+01", "100-00", "-1-16+",
+                                  "36028797018963967-31+", "36028797018963968-00", "-36028797018963968-00", "9223372036854775807-00",
+                                  "99999999999999999999-01"};
+    bool agree = true;
+    ParseFractionalBlocks(fields.data(), fields.size(), [&](size_t i, long long ticks, bool valid) {
+        long long expected = 0;
+        bool accepted = ParseFractionalTicks(fields[i], expected);
+        agree = agree && valid == accepted && (!valid || ticks == expected);
+    });
+    // the largest whole number of points still parses; one more would overflow the tick count
+    long long ticks = 0;
+    return agree && ParseFractionalTicks(fields[19], ticks) && !ParseFractionalTicks(fields[20], ticks);
+}
+
+// Parser benchmark: legacy string parsing versus the scalar and batch fractional parsers
+void BenchPriceParser()
+{
+    cout << "== fractionalprice: parse 1M price fields ==" << endl;
+    const long n = 1000000;
+    vector<string> text;
+    text.reserve(n);
+    for (long i = 0; i < n; ++i) {
+        int t = int(i % 256);
+        text.push_back(to_string(99 + (i & 1)) + "-" + (t / 8 < 10 ? "0" : "") + to_string(t / 8) + to_string(t % 8));
+    }
+    vector<string_view> fields(text.begin(), text.end());
+    vector<double> prices(n);
+
+    auto start = BenchClock::now();
+    for (long i = 0; i < n; ++i)
+        prices[i] = LegacyParsePrice(text[i]);
+    double legacy = Elapsed(start);
+    double legacySum = 0;
+    for (double p : prices) legacySum += p;
+
+    start = BenchClock::now();
+    for (long i = 0; i < n; ++i)
+        prices[i] = ParseFractionalPrice(fields[i]);
+    double scalar = Elapsed(start);
+    double scalarSum = 0;
+    for (double p : prices) scalarSum += p;
+
+    start = BenchClock::now();
+    ParseFractionalPrices(fields.data(), fields.size(), prices.data());
+    double batch = Elapsed(start);
+    double batchSum = 0;
+    for (double p : prices) batchSum += p;
+
+    vector<TickPrice> ticks(n);
+    start = BenchClock::now();
+    ParseTickPrices(fields.data(), fields.size(), ticks.data());
+    double tickBatch = Elapsed(start);
+    double tickSum = 0;
+    for (TickPrice p : ticks) tickSum += p.ToDouble();
+
+    cout << "  legacy=" << legacy * 1e9 / n << "ns/price"
+         << "  scalar=" << scalar * 1e9 / n << "ns/price"
+         << "  batch=" << batch * 1e9 / n << "ns/price"
+         << "  tick batch=" << tickBatch * 1e9 / n << "ns/price"
+         << "  agree=" << (legacySum == scalarSum && scalarSum == batchSum && batchSum == tickSum ? "yes" : "no")
+         << "  malformed agree=" << (MalformedAgree() ? "yes" : "no") << endl;
+}
+
+// The original PriceProcess: several to_string calls and concatenations per price
+string LegacyFormatPrice(double p)
+{
+    int part1 = int(p);
+    double p2 = p-double(part1);
+    int part2 = int(p2*32);
+    double p3 = p2-double(part2)/32;
+    int part3 = round(p3*256);
+    if(part2 >= 10)
+        return to_string(part1)+"-"+to_string(part2)+to_string(part3);
+    return to_string(part1)+"-"+"0"+to_string(part2)+to_string(part3);
+}
+
+// Formatter benchmark: legacy string building versus the tick table formatter
+void BenchPriceFormatter()
+{
+    cout << "== fractionalprice: format 1M prices ==" << endl;
+    const long n = 1000000;
+    vector<double> prices(n);
+    for (long i = 0; i < n; ++i)
+        prices[i] = 99. + double(i % 512) / 256.;
+
+    size_t sink = 0;
+    auto start = BenchClock::now();
+    for (long i = 0; i < n; ++i)
+        sink += LegacyFormatPrice(prices[i]).size();
+    double legacy = Elapsed(start);
+
+    char buf[FRACTIONAL_PRICE_MAX_LENGTH];
+    start = BenchClock::now();
+    for (long i = 0; i < n; ++i)
+        sink += size_t(FormatFractionalPrice(prices[i], buf) - buf);
+    double scalar = Elapsed(start);
+
+    vector<char> out(size_t(n) * (FRACTIONAL_PRICE_MAX_LENGTH + 1));
+    start = BenchClock::now();
+    char* end = FormatFractionalPrices(prices.data(), prices.size(), out.data(), '\n');
+    double batch = Elapsed(start);
+    sink += size_t(end - out.data());
+
+    vector<TickPrice> ticks(n);
+    for (long i = 0; i < n; ++i)
+        ticks[i] = TickPrice::FromTicks(99 * 256 + i % 512);
+    start = BenchClock::now();
+    for (long i = 0; i < n; ++i)
+        sink += size_t(FormatTickPrice(ticks[i], buf) - buf);
+    double tick = Elapsed(start);
+
+    cout << "  legacy=" << legacy * 1e9 / n << "ns/price"
+         << "  scalar=" << scalar * 1e9 / n << "ns/price"
+         << "  batch=" << batch * 1e9 / n << "ns/price"
+         << "  tick=" << tick * 1e9 / n << "ns/price"
+         << "  (checksum " << sink << ")" << endl;
+}
+
+// Writer benchmark: open-append-close per record versus the asynchronous batched writer
+void BenchAsyncWriter()
+{
+    cout << "== asyncwriter: write 200k records ==" << endl;
+    const long n = 200000;
+    const string path = "./bench_log.txt";
+    remove(path.c_str());
+
+    auto start = BenchClock::now();
+    for (long i = 0; i < n; ++i) {
+        ofstream oFile;
+        oFile.open(path, ios_base::app);
+        oFile << i << ",91282CFX4," << "100-190" << "," << to_string(i * 10) << "\n";
+        oFile.close();
+    }
+    double legacy = Elapsed(start);
+    remove(path.c_str());
+
+    for (bool fsyncOnCommit : {false, true}) {
+        FlushPolicy policy;
+        policy.fsyncOnCommit = fsyncOnCommit;
+        AsyncLogWriter writer(policy);
+        int fileId = writer.Open(path);
+        start = BenchClock::now();
+        for (long i = 0; i < n; ++i) {
+            LogLine line;
+            line << i << ",91282CFX4," << "100-190" << ',' << i * 10 << '\n';
+            writer.Append(fileId, line);
+        }
+        double enqueue = Elapsed(start);
+        writer.Flush();
+        double total = Elapsed(start);
+        cout << "  open-append-close=" << legacy * 1e9 / n << "ns/record"
+             << "  async(fsync=" << fsyncOnCommit << ") enqueue=" << enqueue * 1e9 / n << "ns/record"
+             << " to-disk=" << total * 1e9 / n << "ns/record"
+             << "  writes=" << writer.GetWriteCount() << " fsyncs=" << writer.GetSyncCount()
+             << " errors=" << writer.GetErrorCount() << endl;
+        remove(path.c_str());
+    }
+
+    // a device that is always full: every write fails and must be counted, not lost silently
+    AsyncLogWriter failing;
+    int full = failing.Open("/dev/full");
+    if (full >= 0) {
+        failing.Append(full, "91282CFX4,100-190\n", 18);
+        failing.Flush();
+        cout << "  /dev/full: " << (failing.GetErrorCount() > 0 && failing.GetLastError() == ENOSPC ? "write error reported" : "WRITE ERROR LOST") << endl;
+    }
+}
+
+// A price level as the original stacks carried it
+struct LegacyLevel
+{
+    double price;
+    long quantity;
+};
+
+// The original BondMarketDataService path: insert the snapshot into a multimap,
+// then copy every stack for the product into two maps, rebuild and reinsert
+void LegacyApplySnapshot(multimap<string, pair<vector<LegacyLevel>, vector<LegacyLevel> > >& books, const string& id,
+                         const vector<LegacyLevel>& bids, const vector<LegacyLevel>& offers)
+{
+    books.insert(make_pair(id, make_pair(bids, offers)));
+    auto range = books.equal_range(id);
+    map<double, long> bidResult;
+    map<double, long> offerResult;
+    for (auto it = range.first; it != range.second; ++it) {
+        for (const LegacyLevel& level : it->second.first)
+            bidResult[level.price] += level.quantity;
+        for (const LegacyLevel& level : it->second.second)
+            offerResult[level.price] += level.quantity;
+    }
+    vector<LegacyLevel> aggBids, aggOffers;
+    for (auto& level : bidResult)
+        aggBids.push_back({level.first, level.second});
+    for (auto& level : offerResult)
+        aggOffers.push_back({level.first, level.second});
+    books.erase(range.first, range.second);
+    books.insert(make_pair(id, make_pair(aggBids, aggOffers)));
+}
+
+// Order book benchmark: multimap and map rebuild versus the flat tick ladder
+void BenchOrderBook()
+{
+    cout << "== flatorderbook: apply 1M five-deep snapshots ==" << endl;
+    const long n = 1000000;
+    const int depth = 5;
+    const char* cusips[] = {"91282CFX4", "91282CGA3", "91282CFZ9", "91282CFY2", "91282CFV8", "912810TM0", "912810TL2"};
+
+    multimap<string, pair<vector<LegacyLevel>, vector<LegacyLevel> > > legacyBooks;
+    vector<LegacyLevel> bids(depth), offers(depth);
+    double sink = 0;
+    auto start = BenchClock::now();
+    for (long i = 0; i < n; ++i) {
+        double mid = 99. + double(i % 512) / 256.;
+        for (int d = 0; d < depth; ++d) {
+            bids[d] = {mid - double(d + 1) / 256., 10000000};
+            offers[d] = {mid + double(d + 1) / 256., 10000000};
+        }
+        LegacyApplySnapshot(legacyBooks, cusips[i % 7], bids, offers);
+        sink += legacyBooks.find(cusips[i % 7])->second.first.back().price;
+    }
+    double legacy = Elapsed(start);
+
+    vector<FlatOrderBook> books(7);
+    vector<pair<TickPrice, long> > view;
+    view.reserve(64);
+    start = BenchClock::now();
+    for (long i = 0; i < n; ++i) {
+        FlatOrderBook& book = books[i % 7];
+        TickPrice mid = TickPrice::FromTicks(99 * 256 + i % 512);
+        book.Clear();
+        for (int d = 0; d < depth; ++d) {
+            book.AddQuantity(BID, mid - TickPrice::FromTicks(d + 1), 10000000);
+            book.AddQuantity(OFFER, mid + TickPrice::FromTicks(d + 1), 10000000);
+        }
+        view.clear();
+        book.ForEachLevel(BID, SIZE_MAX, [&view](TickPrice price, long quantity) {view.emplace_back(price, quantity);});
+        sink += book.GetBest(BID).ToDouble() + view.back().first.ToDouble();
+    }
+    double flat = Elapsed(start);
+
+    // a single level moving at the touch: O(1) update and best bid/offer
+    FlatOrderBook& book = books[0];
+    start = BenchClock::now();
+    for (long i = 0; i < n; ++i) {
+        TickPrice price = book.GetBest(BID) + TickPrice::FromTicks(i & 1 ? -1 : 1);
+        book.SetLevel(BID, price, (i & 1) ? 0 : 5000000);
+        sink += book.GetBest(BID).ToDouble();
+    }
+    double touch = Elapsed(start);
+
+    cout << "  multimap+map=" << legacy * 1e9 / n << "ns/snapshot"
+         << "  flat=" << flat * 1e9 / n << "ns/snapshot"
+         << "  speedup=" << legacy / flat << "x"
+         << "  touch update=" << touch * 1e9 / n << "ns"
+         << "  (checksum " << sink << ")" << endl;
+}
+
+// Count the fills an engine reports
+class FillCounter: public ServiceListener<ExecutionReport<Bond> >
+{
+public:
+    long fills = 0;
+    void ProcessAdd(ExecutionReport<Bond>& data) override { fills += data.GetQuantity() > 0 && data.GetStatus() != ORDER_CANCELLED; }
+    void ProcessRemove(ExecutionReport<Bond>& data) override {}
+    void ProcessUpdate(ExecutionReport<Bond>& data) override {}
+};
+
+// Record the order id of every fill, in the order the fills are reported
+class FillRecorder: public ServiceListener<ExecutionReport<Bond> >
+{
+public:
+    vector<string> ids;
+    void ProcessAdd(ExecutionReport<Bond>& data) override { if (data.GetQuantity() > 0 && data.GetStatus() != ORDER_CANCELLED) ids.push_back(data.GetOrderId()); }
+    void ProcessRemove(ExecutionReport<Bond>& data) override {}
+    void ProcessUpdate(ExecutionReport<Bond>& data) override {}
+};
+
+// Stops reached together fire in the order they were entered
+bool StopsInTimePriority(const ProductRegistry& registry)
+{
+    const Bond& bond = registry.GetBond(0);
+    TickPrice mid = TickPrice::FromPoints(99);
+    BondMatchingEngine engine(BROKERTEC, registry);
+    FillRecorder recorder;
+    engine.AddListener(&recorder);
+    engine.SetQuote(bond, BID, mid, 10000000);
+    engine.SetQuote(bond, OFFER, mid + TickPrice::FromTicks(5), 10000000);
+    vector<string> entered = {"S1", "S2", "S3", "S4"};
+    for (const string& id : entered)
+        engine.Submit(ExecutionOrder<Bond>(bond, BID, id, STOP, mid + TickPrice::FromTicks(4), 1000000., 0., "", false));
+    engine.SetQuote(bond, BID, mid + TickPrice::FromTicks(4), 10000000);
+    vector<string> fired;
+    for (const string& id : recorder.ids) {
+        if (find(entered.begin(), entered.end(), id) != entered.end())
+            fired.push_back(id);
+    }
+    return fired == entered;
+}
+
+void BenchMatching()
+{
+    cout << "== matchingengine: 1M limit/IOC/market orders ==" << endl;
+    const long n = 1000000;
+    ProductRegistry registry(vector<Bond>{Bond("91282CFX4", CUSIP, "T", 4.5f, date(2024, Nov, 30))});
+    const Bond& bond = registry.GetBond(0);
+    BondMatchingEngine engine(BROKERTEC, registry);
+    FillCounter counter;
+    engine.AddListener(&counter);
+    TickPrice mid = TickPrice::FromPoints(99);
+    for (int d = 1; d <= 5; ++d) {
+        engine.SetQuote(bond, BID, mid - TickPrice::FromTicks(d), 10000000);
+        engine.SetQuote(bond, OFFER, mid + TickPrice::FromTicks(d), 10000000);
+    }
+
+    // resting limits around the touch keep the book stocked for the crossing orders
+    vector<ExecutionOrder<Bond> > orders;
+    orders.reserve(n);
+    unsigned long seed = 9815;
+    for (long i = 0; i < n; ++i) {
+        seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+        PricingSide side = (seed >> 33) & 1 ? BID : OFFER;
+        int offset = int((seed >> 40) % 4);
+        long quantity = 1000000 * long(1 + (seed >> 50) % 3);
+        OrderType type = (i % 4 == 3) ? IOC : (i % 8 == 2) ? MARKET : LIMIT;
+        TickPrice price = (type == LIMIT)
+            ? (side == BID ? mid - TickPrice::FromTicks(offset) : mid + TickPrice::FromTicks(offset))
+            : (side == BID ? mid + TickPrice::FromTicks(2) : mid - TickPrice::FromTicks(2));
+        orders.emplace_back(bond, side, to_string(i), type, price, double(quantity), 0., "", false);
+    }
+
+    auto start = BenchClock::now();
+    for (const auto& order : orders)
+        engine.Submit(order);
+    double elapsed = Elapsed(start);
+
+    // a buy stop above the market fires once the bid is raised to it, with no trade on the venue
+    BondMatchingEngine quiet(BROKERTEC, registry);
+    FillCounter stopFills;
+    quiet.AddListener(&stopFills);
+    quiet.SetQuote(bond, BID, mid, 10000000);
+    quiet.SetQuote(bond, OFFER, mid + TickPrice::FromTicks(5), 10000000);
+    quiet.Submit(ExecutionOrder<Bond>(bond, BID, "S", STOP, mid + TickPrice::FromTicks(4), 1000000., 0., "", false));
+    bool waited = stopFills.fills == 0;
+    quiet.SetQuote(bond, BID, mid + TickPrice::FromTicks(4), 10000000);
+
+    cout << "  " << n / elapsed / 1e6 << "M orders/s  " << elapsed * 1e9 / n << "ns/order"
+         << "  fills=" << engine.GetFillCount() << "  reported=" << counter.fills
+         << ((waited && stopFills.fills == 1) ? "  (stop fired by quote)" : "  STOP NOT FIRED BY QUOTE")
+         << (StopsInTimePriority(registry) ? "  (stops fire in time priority)" : "  STOPS OUT OF ORDER") << endl;
+}
+
+// Drive a fresh market data service and router through a seeded stream of venue
+// level changes, latency samples and routing requests; returns a checksum of every
+// slice, or -1 if a route does not add up to its order
+long ReplayRoutes(const ProductRegistry& registry, unsigned long seed, long events)
+{
+    const Bond& bond = registry.GetBond(0);
+    BondMarketDataService marketData(registry);
+    BondSmartOrderRouter router(marketData);
+    TickPrice mid = TickPrice::FromPoints(99);
+    unsigned long checksum = 14695981039346656037UL;
+    RouteSlice slices[MARKET_COUNT];
+    for (long i = 0; i < events; ++i) {
+        seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+        unsigned long r = seed >> 24;
+        Market venue = Market(r % MARKET_COUNT);
+        PricingSide side = (r >> 2) & 1 ? BID : OFFER;
+        int offset = 1 + int((r >> 3) % 8);
+        switch ((r >> 6) % 10) {
+        case 0: case 1: case 2: case 3: {
+            long quantity = 1000000 * long((r >> 10) % 6);
+            TickPrice price = (side == BID) ? mid - TickPrice::FromTicks(offset) : mid + TickPrice::FromTicks(offset);
+            BookDelta<Bond> delta(bond, venue, quantity > 0 ? MODIFY_LEVEL : DELETE_LEVEL, side, price, quantity);
+            marketData.OnDelta(delta);
+            break;
+        }
+        case 4:
+            router.RecordLatency(venue, double(20000 + (r >> 10) % 60000));
+            break;
+        default: {
+            long quantity = 1000000 * long(1 + (r >> 10) % 20);
+            TickPrice limit = (side == BID) ? mid + TickPrice::FromTicks(offset) : mid - TickPrice::FromTicks(offset);
+            size_t count = router.Route(bond, side, (r >> 16) & 1, limit, quantity, slices);
+            long total = 0;
+            for (size_t k = 0; k < count; ++k) {
+                total += slices[k].quantity;
+                checksum = (checksum ^ (unsigned long)(slices[k].venue * 1000003L + slices[k].quantity)) * 1099511628211UL;
+            }
+            if (total != quantity)
+                return -1;
+        }
+        }
+    }
+    return long(checksum >> 1);
+}
+
+void BenchRouter()
+{
+    cout << "== smartorderrouter: 1M routing decisions over three venues ==" << endl;
+    const long n = 1000000;
+    ProductRegistry registry(vector<Bond>{Bond("91282CFX4", CUSIP, "T", 4.5f, date(2024, Nov, 30))});
+    const Bond& bond = registry.GetBond(0);
+
+    long first = ReplayRoutes(registry, 9815, 200000);
+    long second = ReplayRoutes(registry, 9815, 200000);
+    cout << "  replay checksum=" << first << (first == second && first >= 0 ? "  identical" : "  MISMATCH") << endl;
+
+    BondMarketDataService marketData(registry);
+    BondSmartOrderRouter router(marketData);
+    TickPrice mid = TickPrice::FromPoints(99);
+    for (int v = 0; v < MARKET_COUNT; ++v) {
+        for (int d = 1; d <= 5; ++d) {
+            BookDelta<Bond> bid(bond, Market(v), ADD_LEVEL, BID, mid - TickPrice::FromTicks(d), 2000000 * (v + 1));
+            BookDelta<Bond> offer(bond, Market(v), ADD_LEVEL, OFFER, mid + TickPrice::FromTicks(d), 2000000 * (3 - v));
+            marketData.OnDelta(bid);
+            marketData.OnDelta(offer);
+        }
+        router.RecordLatency(Market(v), 30000. + 10000. * ((v + 1) % MARKET_COUNT));
+    }
+    RouteSlice slices[MARKET_COUNT];
+    long sink = 0;
+    auto start = BenchClock::now();
+    for (long i = 0; i < n; ++i) {
+        PricingSide side = (i & 1) ? BID : OFFER;
+        long quantity = 1000000 * (1 + i % 25);
+        TickPrice limit = (side == BID) ? mid + TickPrice::FromTicks(3) : mid - TickPrice::FromTicks(3);
+        size_t count = router.Route(bond, side, i % 3 != 0, limit, quantity, slices);
+        sink += long(count) + slices[0].quantity;
+    }
+    double elapsed = Elapsed(start);
+
+    cout << "  " << elapsed * 1e9 / n << "ns/decision  (checksum " << sink << ")" << endl;
+}
+
+// Count child orders and fill each one at once, as a venue taking every peak would
+class ChildFiller: public ServiceListener<ExecutionOrder<Bond> >
+{
+public:
+    explicit ChildFiller(BondAlgoSlicingService& _slicer): slicer(_slicer) {}
+    long children = 0;
+    long quantity = 0;
+    void ProcessAdd(ExecutionOrder<Bond>& data) override {
+        ++children;
+        quantity += data.GetVisibleQuantity();
+        ExecutionReport<Bond> fill(data.GetProduct(), data.GetOrderId(), BROKERTEC, data.GetSide(), ORDER_FILLED, data.GetPrice(), data.GetVisibleQuantity(), 0);
+        slicer.OnChildReport(fill);
+    }
+    void ProcessRemove(ExecutionOrder<Bond>& data) override {}
+    void ProcessUpdate(ExecutionOrder<Bond>& data) override {}
+private:
+    BondAlgoSlicingService& slicer;
+};
+
+// Keep the last child a slicer sends, without filling it
+class ChildKeeper: public ServiceListener<ExecutionOrder<Bond> >
+{
+public:
+    long children = 0;
+    string lastId;
+    void ProcessAdd(ExecutionOrder<Bond>& data) override { ++children; lastId = data.GetOrderId(); }
+    void ProcessRemove(ExecutionOrder<Bond>& data) override {}
+    void ProcessUpdate(ExecutionOrder<Bond>& data) override {}
+};
+
+// An iceberg cancelled with a peak working sends nothing more when that peak fills,
+// and the late fill leaves the parent that reuses its slot alone
+bool LateFillIgnored(const ProductRegistry& registry)
+{
+    const Bond& bond = registry.GetBond(0);
+    BondAlgoSlicingService slicer(registry);
+    ChildKeeper keeper;
+    slicer.AddListener(&keeper);
+    TickPrice price = TickPrice::FromPoints(99);
+    ParentId cancelled = slicer.StartIceberg("C", bond, BID, LIMIT, price, 5000000, 1000000);
+    slicer.Advance(1);
+    string peak = keeper.lastId;
+    slicer.Cancel(cancelled);
+    slicer.StartIceberg("R", bond, BID, LIMIT, price, 2000000, 1000000);
+    slicer.Advance(2);
+    ExecutionReport<Bond> late(bond, peak, BROKERTEC, BID, ORDER_FILLED, price, 1000000, 0);
+    slicer.OnChildReport(late);
+    slicer.Advance(100);
+    return keeper.children == 2 && slicer.GetActiveCount() == 1;
+}
+
+// An empty iceberg is refused at start and sends no zero-quantity child
+bool EmptyIcebergRefused(const ProductRegistry& registry)
+{
+    BondAlgoSlicingService slicer(registry);
+    ChildKeeper keeper;
+    slicer.AddListener(&keeper);
+    ParentId parent = slicer.StartIceberg("E", registry.GetBond(0), BID, LIMIT, TickPrice::FromPoints(99), 0, 1000000);
+    slicer.Advance(100);
+    return parent == BondAlgoSlicingService::NO_PARENT && keeper.children == 0 && slicer.GetActiveCount() == 0;
+}
+
+void BenchSlicer()
+{
+    cout << "== algoslicer: 50k concurrent TWAP/VWAP/iceberg parents on a timing wheel ==" << endl;
+    ProductRegistry registry(vector<Bond>{Bond("91282CFX4", CUSIP, "T", 4.5f, date(2024, Nov, 30))});
+    const Bond& bond = registry.GetBond(0);
+    BondAlgoSlicingService slicer(registry);
+    ChildFiller filler(slicer);
+    slicer.AddListener(&filler);
+    int profile = slicer.AddVolumeProfile({0.18, 0.12, 0.09, 0.08, 0.08, 0.1, 0.15, 0.2});
+    TickPrice price = TickPrice::FromPoints(99);
+
+    long total = 0;
+    auto start = BenchClock::now();
+    for (long i = 0; i < 50000; ++i) {
+        string id = "P" + to_string(i);
+        PricingSide side = (i & 1) ? BID : OFFER;
+        long quantity = 1000000 * (5 + i % 16);
+        total += quantity;
+        uint64_t begin = uint64_t(i % 1000);
+        switch (i % 5) {
+        case 0: case 1: case 2:
+            slicer.StartTwap(id, bond, side, LIMIT, price, quantity, begin, begin + 10000, 10);
+            break;
+        case 3:
+            slicer.StartVwap(id, bond, side, LIMIT, price, quantity, begin, begin + 10000, profile);
+            break;
+        default:
+            slicer.StartIceberg(id, bond, side, LIMIT, price, quantity, 1000000);
+        }
+    }
+    double starting = Elapsed(start);
+    start = BenchClock::now();
+    for (uint64_t t = 1; t <= 20000; ++t)
+        slicer.Advance(t);
+    double slicing = Elapsed(start);
+
+    cout << "  start=" << starting * 1e9 / 50000 << "ns/parent"
+         << "  slice=" << slicing * 1e9 / filler.children << "ns/child"
+         << "  children=" << filler.children
+         << ((filler.quantity == total && slicer.GetActiveCount() == 0) ? "  all parents worked in full" : "  QUANTITY MISMATCH")
+         << (LateFillIgnored(registry) ? "  (late fill ignored)" : "  LATE FILL REARMED")
+         << (EmptyIcebergRefused(registry) ? "  (empty iceberg refused)" : "  EMPTY ICEBERG SENT") << endl;
+}
+
+// The same strategies behind a virtual interface, for comparison
+class VirtualStrategy
+{
+public:
+    virtual ~VirtualStrategy() = default;
+    virtual bool Decide(const TopOfBook<Bond>& top, ProductHandle handle, AlgoOrder& order) = 0;
+};
+
+template<typename S>
+class VirtualAdapter: public VirtualStrategy
+{
+public:
+    explicit VirtualAdapter(size_t products): strategy(products) {}
+    bool Decide(const TopOfBook<Bond>& top, ProductHandle handle, AlgoOrder& order) override { return strategy.Decide(top, handle, order); }
+private:
+    S strategy;
+};
+
+void BenchStrategies()
+{
+    cout << "== algostrategies: 10M top of book decisions over 1024 books ==" << endl;
+    const long n = 10000000;
+    const size_t books = 1024;
+    ProductRegistry registry(vector<Bond>{Bond("91282CFX4", CUSIP, "T", 4.5f, date(2024, Nov, 30))});
+    const Bond& bond = registry.GetBond(0);
+    vector<TopOfBook<Bond> > tops;
+    for (int i = 0; i < 256; ++i) {
+        TickPrice bid = TickPrice::FromPoints(99) + TickPrice::FromTicks(i % 7);
+        TickPrice offer = bid + TickPrice::FromTicks(1 + i % 3);
+        tops.emplace_back(bond, Order(bid, 1000000 * (1 + i % 9), BID), Order(offer, 1000000 * (1 + i % 5), OFFER), BROKERTEC, BROKERTEC);
+    }
+
+    auto run = [&](auto& decide) {
+        AlgoOrder order;
+        long sent = 0;
+        auto start = BenchClock::now();
+        for (long i = 0; i < n; ++i) {
+            if (decide(tops[i & 255], ProductHandle(i & (books - 1)), order))
+                sent += order.quantity;
+        }
+        return make_pair(Elapsed(start) * 1e9 / n, sent);
+    };
+
+    BondAlgoStrategies set(books);
+    auto staticDecide = [&set](const TopOfBook<Bond>& top, ProductHandle handle, AlgoOrder& order) {return set.Decide(top, handle, order);};
+    auto single = run(staticDecide);
+    BondAlgoStrategies mixedSet(books);
+    for (size_t h = 0; h < books; ++h) {
+        switch (h % 4) {
+        case 1: mixedSet.Select<TightSpreadCross>(ProductHandle(h)); break;
+        case 2: mixedSet.Select<PassiveJoin>(ProductHandle(h)); break;
+        case 3: mixedSet.Select<ImbalanceTake>(ProductHandle(h)); break;
+        }
+    }
+    auto mixedDecide = [&mixedSet](const TopOfBook<Bond>& top, ProductHandle handle, AlgoOrder& order) {return mixedSet.Decide(top, handle, order);};
+    auto mixed = run(mixedDecide);
+
+    vector<unique_ptr<VirtualStrategy> > strategies;
+    strategies.push_back(make_unique<VirtualAdapter<AlternatingCross> >(books));
+    strategies.push_back(make_unique<VirtualAdapter<TightSpreadCross> >(books));
+    strategies.push_back(make_unique<VirtualAdapter<PassiveJoin> >(books));
+    strategies.push_back(make_unique<VirtualAdapter<ImbalanceTake> >(books));
+    vector<VirtualStrategy*> perBook(books);
+    for (size_t h = 0; h < books; ++h)
+        perBook[h] = strategies[h % 4].get();
+    auto virtualDecide = [&perBook](const TopOfBook<Bond>& top, ProductHandle handle, AlgoOrder& order) {return perBook[handle]->Decide(top, handle, order);};
+    auto virtualMixed = run(virtualDecide);
+
+    cout << "  one strategy=" << single.first << "ns/decision"
+         << "  four mixed=" << mixed.first << "ns/decision"
+         << "  four mixed, virtual=" << virtualMixed.first << "ns/decision"
+         << ((mixed.second == virtualMixed.second) ? "  (same orders)" : "  ORDERS DIFFER") << endl;
+}
+
+// Order tracking as string-keyed map entries, one allocation per order
+struct LegacyOrderRecord
+{
+    ExecutionOrder<Bond> order;
+    long filled;
+};
+
+void BenchOrderStore()
+{
+    cout << "== orderstore: 5M orders through new, partial fill and fill, 4096 working at a time ==" << endl;
+    const long n = 5000000;
+    const long working = 4096;
+    const size_t products = 64;
+    ProductRegistry registry(vector<Bond>{Bond("91282CFX4", CUSIP, "T", 4.5f, date(2024, Nov, 30))});
+    const Bond& bond = registry.GetBond(0);
+    TickPrice price = TickPrice::FromPoints(99);
+
+    OrderStore<ExecutionOrder<Bond> > store(products, 1024);
+    vector<OrderId> ring(working, OrderStore<ExecutionOrder<Bond> >::NO_ORDER);
+    long sink = 0;
+    auto start = BenchClock::now();
+    for (long i = 0; i < n; ++i) {
+        OrderId& slot = ring[i & (working - 1)];
+        if (slot != OrderStore<ExecutionOrder<Bond> >::NO_ORDER) {
+            store.Fill(slot, store.GetLeavesQuantity(slot));
+            sink += *store.GetState(slot);
+        }
+        slot = store.Create(ProductHandle(i % products), 2000000, [&](OrderId id) {
+            string text = to_string(id);
+            return ExecutionOrder<Bond>(bond, BID, text, LIMIT, price, 600000, 1400000, text, false);
+        });
+        store.Fill(ring[(i + working / 2) & (working - 1)], 500000);
+    }
+    double storeTime = Elapsed(start);
+    // the first order has long been retired; it and an ID never issued read as nothing
+    OrderId retired = OrderId(1);
+    bool defined = !store.GetState(retired) && store.GetFilledQuantity(retired) == 0 && store.GetLeavesQuantity(retired) == 0
+        && !store.GetState(OrderStore<ExecutionOrder<Bond> >::NO_ORDER) && store.GetLeavesQuantity(OrderId(1) << 40) == 0;
+    // IDs are read only behind their prefix, so another sender's "5-1" is not taken for order 5's child
+    OrderId parsed = 0;
+    bool namespaced = OrderStore<ExecutionOrder<Bond> >::ParseId("A5-1", "A", parsed) && parsed == 5
+        && !OrderStore<ExecutionOrder<Bond> >::ParseId("5-1", "A", parsed) && !OrderStore<ExecutionOrder<Bond> >::ParseId("A", "A", parsed);
+
+    unordered_map<string, LegacyOrderRecord> legacy;
+    vector<string> legacyRing(working);
+    long legacySink = 0;
+    start = BenchClock::now();
+    for (long i = 0; i < n; ++i) {
+        string& slot = legacyRing[i & (working - 1)];
+        if (!slot.empty()) {
+            auto it = legacy.find(slot);
+            legacySink += (it->second.filled + 1500000 >= 2000000) ? STATE_FILLED : STATE_PARTIALLY_FILLED;
+            legacy.erase(it);
+        }
+        slot = to_string(i + 1);
+        legacy.emplace(slot, LegacyOrderRecord{ExecutionOrder<Bond>(bond, BID, slot, LIMIT, price, 600000, 1400000, slot, false), 0});
+        const string& half = legacyRing[(i + working / 2) & (working - 1)];
+        if (!half.empty())
+            legacy.find(half)->second.filled += 500000;
+    }
+    double legacyTime = Elapsed(start);
+
+    cout << "  store=" << storeTime * 1e9 / n << "ns/order (" << store.GetSlotCount() << " slots)"
+         << "  string map=" << legacyTime * 1e9 / n << "ns/order"
+         << ((sink == legacySink) ? "  (same states)" : "  STATES DIFFER")
+         << (defined ? "  (retired IDs read as nothing)" : "  RETIRED ID READ")
+         << (namespaced ? "  (IDs read behind their prefix)" : "  FOREIGN ID READ") << endl;
+}
+
+void BenchRiskGate()
+{
+    cout << "== pretraderisk: 5M pre-trade checks with positions moving under them ==" << endl;
+    const long n = 5000000;
+    ProductRegistry registry(vector<Bond>{Bond("91282CFX4", CUSIP, "T", 4.5f, date(2024, Nov, 30))});
+    const Bond& bond = registry.GetBond(0);
+    BondPositionService positions(registry);
+    BondRiskService risk(map<string, double>{{"91282CFX4", 0.0185}}, registry);
+    BondPreTradeRiskGate gate(registry, positions, risk, RiskLimits{20000000, 60000000, 2000000, 1000000000});
+    gate.AddBucket(BucketedSector<Bond>(registry.GetBonds(), "FrontEnd"), 1000000.);
+    positions.AddListener(&gate);
+    risk.AddListener(&gate);
+
+    vector<ExecutionOrder<Bond> > orders;
+    for (int i = 0; i < 64; ++i) {
+        long quantity = 1000000 * (1 + (i * 7) % 30);
+        orders.emplace_back(bond, (i % 3 == 0) ? OFFER : BID, to_string(i), MARKET, TickPrice::FromPoints(99), quantity * 3 / 10, quantity - quantity * 3 / 10, to_string(i), false);
+    }
+    string book = "TRSY1";
+    long passed = 0;
+    auto start = BenchClock::now();
+    for (long i = 0; i < n; ++i) {
+        const ExecutionOrder<Bond>& order = orders[i & 63];
+        if (!gate.Admit(order, Market(i % MARKET_COUNT)))
+            continue;
+        ++passed;
+        if ((i & 1023) == 0) {
+            long quantity = order.GetVisibleQuantity() + order.GetHiddenQuantity();
+            Trade<Bond> fill(bond, "EX" + to_string(i), order.GetPrice(), book, quantity, order.GetSide() == BID ? BUY : SELL);
+            positions.AddTrade(fill);
+        }
+    }
+    double elapsed = Elapsed(start);
+    // a new PV01 per unit re-bases the bucket the product is in
+    double bucketBefore = gate.GetBucketPV01(0);
+    risk.UpdateBondPV01("91282CFX4", 0.037);
+    bool rebased = fabs(gate.GetBucketPV01(0) - double(labs(gate.GetPosition(0))) * 0.037) < 1e-6 * (1. + bucketBefore);
+
+    const LatencyHistogram& latency = gate.GetLatency();
+    cout << "  " << elapsed * 1e9 / n << "ns/order through Admit  check p50=" << latency.GetPercentile(0.5)
+         << "ns p99=" << latency.GetPercentile(0.99) << "ns p99.9=" << latency.GetPercentile(0.999) << "ns max=" << latency.GetMax() << "ns" << endl;
+    cout << "  passed=" << passed << "  size=" << gate.GetCount(RISK_ORDER_SIZE) << "  position=" << gate.GetCount(RISK_POSITION)
+         << "  pv01=" << gate.GetCount(RISK_BUCKET_PV01) << "  rate=" << gate.GetCount(RISK_MESSAGE_RATE)
+         << "  final position=" << gate.GetPosition(0) << "  bucket pv01=" << bucketBefore
+         << (rebased ? "  (bucket re-based on a new PV01)" : "  BUCKET PV01 STALE") << endl;
+}
+
+// Take tokens from threads at once, each on its own key or all on key 0; returns ns per attempt and tokens granted
+pair<double, long> ContendLimiter(RateLimiter& limiter, int threads, bool shared, long attempts)
+{
+    atomic<long> granted(0);
+    vector<thread> workers;
+    auto start = BenchClock::now();
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            long mine = 0;
+            uint64_t due;
+            for (long i = 0; i < attempts; ++i) {
+                if (limiter.TryAcquire(shared ? 0 : size_t(t), CycleClock::Now(), 0, due))
+                    ++mine;
+            }
+            granted += mine;
+        });
+    }
+    for (auto& worker : workers)
+        worker.join();
+    return make_pair(Elapsed(start) * 1e9 / attempts, granted.load());
+}
+
+void BenchThrottle()
+{
+    cout << "== ratelimiter: token buckets and kill switch across 4 threads ==" << endl;
+    const long n = 5000000;
+    const int threads = 4;
+    double ticks = CycleClock::TicksPerSecond();
+
+    auto start = BenchClock::now();
+    uint64_t sink = 0;
+    for (long i = 0; i < n; ++i)
+        sink += CycleClock::Now();
+    double clockNs = Elapsed(start) * 1e9 / n;
+    start = BenchClock::now();
+    for (long i = 0; i < n; ++i)
+        sink += uint64_t(BenchClock::now().time_since_epoch().count());
+    double steadyNs = Elapsed(start) * 1e9 / n;
+    cout << "  CycleClock=" << clockNs << "ns  steady_clock=" << steadyNs << "ns  (" << ticks / 1e9 << " ticks/ns, checksum " << (sink & 0xff) << ")" << endl;
+
+    RateLimiter open(threads, 1e12, 1000000);
+    auto single = ContendLimiter(open, 1, false, n);
+    RateLimiter own(threads, 1e12, 1000000);
+    auto separate = ContendLimiter(own, threads, false, n);
+    RateLimiter one(1, 1e12, 1000000);
+    auto shared = ContendLimiter(one, threads, true, n);
+    cout << "  take: one thread=" << single.first << "ns  4 threads, own keys=" << separate.first << "ns  4 threads, one key=" << shared.first << "ns" << endl;
+
+    const double rate = 1000000.;
+    const long burst = 1000;
+    RateLimiter limited(1, rate, burst);
+    auto begin = BenchClock::now();
+    auto capped = ContendLimiter(limited, threads, true, n / 4);
+    double allowed = double(burst) + rate * Elapsed(begin);
+    cout << "  1M/s limit on one key: granted=" << capped.second << " of " << long(allowed) << " allowed"
+         << ((double(capped.second) <= allowed * 1.001) ? "  (within limit)" : "  OVER LIMIT") << endl;
+
+    KillSwitch killSwitch;
+    atomic<int> running(0);
+    vector<uint64_t> stopped(threads);
+    vector<thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            ++running;
+            while (!killSwitch.IsHalted()) {}
+            stopped[t] = CycleClock::Now();
+        });
+    }
+    while (running.load() < threads) {}
+    this_thread::sleep_for(chrono::milliseconds(10));
+    uint64_t halt = CycleClock::Now();
+    killSwitch.Halt();
+    for (auto& worker : workers)
+        worker.join();
+    uint64_t slowest = 0;
+    for (uint64_t s : stopped)
+        slowest = (s - halt > slowest) ? s - halt : slowest;
+    cout << "  kill switch: every thread stopped within " << double(slowest) / ticks * 1e9 << "ns of the halt" << endl;
+}
+
+// A stage of a service graph that does a fixed amount of work per event and passes it on
+class WorkStage: public ServiceListener<long>
+{
+public:
+    WorkStage(int _work, ServiceListener<long>* _next): work(_work), next(_next) {}
+    uint64_t checksum = 0;
+    void ProcessAdd(long& data) override {
+        uint64_t x = uint64_t(data);
+        for (int i = 0; i < work; ++i)
+            x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        checksum += x;
+        if (next != nullptr)
+            next->ProcessAdd(data);
+    }
+    void ProcessRemove(long& data) override {}
+    void ProcessUpdate(long& data) override {}
+private:
+    int work;
+    ServiceListener<long>* next;
+};
+
+void BenchBus()
+{
+    cout << "== servicebus: 500k events through ingest, two 200-step stages, in line and on queues ==" << endl;
+    const long n = 500000;
+    const int work = 200;
+    WorkStage lastSync(work, nullptr);
+    WorkStage firstSync(work, &lastSync);
+    auto start = BenchClock::now();
+    for (long i = 0; i < n; ++i)
+        firstSync.ProcessAdd(i);
+    double sync = Elapsed(start);
+    cout << "  in line: " << sync * 1e9 / n << "ns/event" << endl;
+
+    const char* names[] = {"spin", "yield", "block"};
+    for (WaitStrategy wait : {WAIT_SPIN, WAIT_YIELD, WAIT_BLOCK}) {
+        WorkStage last(work, nullptr);
+        AsyncListener<long> lastQueue(last, 4096, wait);
+        WorkStage first(work, &lastQueue);
+        AsyncListener<long> firstQueue(first, 4096, wait);
+        start = BenchClock::now();
+        for (long i = 0; i < n; ++i)
+            firstQueue.ProcessAdd(i);
+        firstQueue.Stop();
+        lastQueue.Stop();
+        double elapsed = Elapsed(start);
+        cout << "  " << names[wait] << ": " << elapsed * 1e9 / n << "ns/event"
+             << "  depth max " << firstQueue.GetMaxDepth() << "/" << lastQueue.GetMaxDepth()
+             << "  wait p50 " << lastQueue.GetLatency().GetPercentile(0.5) << "ns p99 " << lastQueue.GetLatency().GetPercentile(0.99) << "ns"
+             << ((first.checksum == firstSync.checksum && last.checksum == lastSync.checksum) ? "  (same results)" : "  RESULTS DIFFER") << endl;
+    }
+    cout << "  hardware threads: " << thread::hardware_concurrency() << endl;
+}
+
+// Counts the PV01 updates risk sends on
+class CountingPV01Listener: public ServiceListener<PV01<Bond> >
+{
+public:
+    long updates = 0;
+    void ProcessAdd(PV01<Bond>& data) override {}
+    void ProcessRemove(PV01<Bond>& data) override {}
+    void ProcessUpdate(PV01<Bond>& data) override { ++updates; }
+};
+
+void BenchBatch()
+{
+    cout << "== batch: 2M position updates over 7 bonds into risk, one at a time and in runs of 64 ==" << endl;
+    const char* cusips[] = {"91282CFX4", "91282CGA3", "91282CFZ9", "91282CFY2", "91282CFV8", "912810TM0", "912810TL2"};
+    vector<Bond> bonds;
+    map<string, double> pv01s;
+    for (int i = 0; i < 7; ++i) {
+        bonds.emplace_back(cusips[i], CUSIP, "T", 4.5f, date(2025 + i, Nov, 30));
+        pv01s[cusips[i]] = 0.01 * (i + 1);
+    }
+    ProductRegistry registry(bonds);
+    const size_t run = 64;
+    const long rounds = 2000000 / run;
+    vector<Position<Bond> > positions;
+    string book = "TRSY1";
+    for (size_t i = 0; i < run; ++i) {
+        positions.emplace_back(registry.GetBond(ProductHandle(i % 7)));
+        positions.back().ChangePosition(long(i + 1) * 1000000, book);
+    }
+
+    const char* names[] = {"one at a time", "batched"};
+    for (int batched = 0; batched < 2; ++batched) {
+        BondRiskService risk(pv01s, registry);
+        CountingPV01Listener counter;
+        risk.AddListener(&counter);
+        BondPositionServiceListener listener(risk);
+        auto start = BenchClock::now();
+        for (long r = 0; r < rounds; ++r) {
+            if (batched) {
+                listener.ProcessUpdateBatch(span<Position<Bond> >(positions));
+            } else {
+                for (auto& position : positions)
+                    listener.ProcessUpdate(position);
+            }
+        }
+        double elapsed = Elapsed(start);
+        cout << "  " << names[batched] << ": " << elapsed * 1e9 / double(rounds * run) << "ns/position  "
+             << counter.updates << " PV01 updates, quantity " << risk.GetData(cusips[6]).GetQuantity() << endl;
+    }
+}
+
+// A hop that folds the event into a checksum and hands it to the listeners after it
+class ForwardListener: public ServiceListener<long>
+{
+public:
+    explicit ForwardListener(uint64_t& _checksum): checksum(_checksum) {}
+    vector<ServiceListener<long>*> next;
+    void ProcessAdd(long& data) override {
+        checksum = (checksum ^ uint64_t(data)) * 1099511628211ULL;
+        for (auto listener : next)
+            listener->ProcessAdd(data);
+    }
+    void ProcessRemove(long& data) override {}
+    void ProcessUpdate(long& data) override {}
+private:
+    uint64_t& checksum;
+};
+
+// Count the streams a service hands its listeners
+class StreamCounter: public ServiceListener<PriceStream<Bond> >
+{
+public:
+    long streams = 0;
+    void ProcessAdd(PriceStream<Bond>& data) override { ++streams; }
+    void ProcessRemove(PriceStream<Bond>& data) override {}
+    void ProcessUpdate(PriceStream<Bond>& data) override {}
+};
+
+// The same hop as a pipeline stage
+class ForwardStage
+{
+public:
+    explicit ForwardStage(uint64_t& _checksum): checksum(_checksum) {}
+    template<typename Emit>
+    void Process(long& data, Emit&& emit) {
+        checksum = (checksum ^ uint64_t(data)) * 1099511628211ULL;
+        emit(data);
+    }
+private:
+    uint64_t& checksum;
+};
+
+void BenchPipeline()
+{
+    cout << "== pipeline: 2M prices through quote, algo stream, stream and stream history, virtual and static ==" << endl;
+    cout << "  (run where ./Output is missing to leave the file writes out)" << endl;
+    ProductRegistry registry(vector<Bond>{Bond("91282CFX4", CUSIP, "T", 4.5f, date(2024, Nov, 30))});
+    const long n = 2000000;
+    vector<Price<Bond> > prices;
+    for (int i = 0; i < 256; ++i) {
+        TickPrice bid = TickPrice::FromTicks(256 * 99 + i);
+        prices.push_back(Price<Bond>::FromBidOffer(registry.GetBond(0), bid, bid + TickPrice::FromTicks(1 + i % 3)));
+    }
+
+    BondAlgoStreamingService algoStream(registry);
+    BondStreamingService stream(registry);
+    BondStreamHistoricalConnector historyConnector;
+    BondStreamHistoricalData history(historyConnector);
+    BondStreamHistoricalListener historyListener(history);
+    BondPriceListener priceListener(algoStream);
+    BondAlgoStreamListener algoStreamListener(stream);
+    algoStream.AddListener(&algoStreamListener);
+    stream.AddListener(&historyListener);
+    ServiceListener<Price<Bond> >* entry = &priceListener;
+    srand(1);
+    auto start = BenchClock::now();
+    for (long i = 0; i < n; ++i)
+        entry->ProcessAdd(prices[i & 255]);
+    double virtualCall = Elapsed(start);
+    long virtualVisible = stream.GetData("91282CFX4").GetBidOrder().GetVisibleQuantity();
+    cout << "  virtual listeners: " << virtualCall * 1e9 / n << "ns/tick" << endl;
+
+    // the pipeline runs services of its own, as a service in a pipeline still hands its streams to its listeners
+    BondAlgoStreamingService pipelineAlgoStream(registry);
+    BondStreamingService pipelineStream(registry);
+    StaticPipeline pipeline(BondQuoteStage{}, BondAlgoStreamStage(pipelineAlgoStream), BondStreamStage(pipelineStream),
+        ListenerStage<BondStreamHistoricalListener>(historyListener));
+    srand(1);
+    start = BenchClock::now();
+    for (long i = 0; i < n; ++i)
+        pipeline.Push(prices[i & 255]);
+    double staticCall = Elapsed(start);
+    long staticVisible = pipelineStream.GetData("91282CFX4").GetBidOrder().GetVisibleQuantity();
+    StreamCounter tap;
+    pipelineAlgoStream.AddListener(&tap);
+    pipelineStream.AddListener(&tap);
+    for (long i = 0; i < 256; ++i)
+        pipeline.Push(prices[i]);
+    cout << "  static pipeline: " << staticCall * 1e9 / n << "ns/tick"
+         << (staticVisible == virtualVisible ? "  (same last stream)" : "  LAST STREAM DIFFERS")
+         << (pipelineStream.GetData("91282CFX4").GetBidOrder().GetPrice() == prices[255].GetBid()
+             && pipelineStream.GetData("91282CFX4").GetOfferOrder().GetPrice() == prices[255].GetOffer() ? "  (quoted at bid and offer)" : "  QUOTE OFF BY A TICK")
+         << (tap.streams == 2 * 256 ? "  (service listeners served)" : "  SERVICE LISTENERS SKIPPED") << endl;
+
+    cout << "  hops alone, 5 stages that each fold the event into a checksum:" << endl;
+    uint64_t virtualSum = 0, staticSum = 0;
+    vector<unique_ptr<ForwardListener> > hops;
+    for (int i = 0; i < 5; ++i) {
+        hops.push_back(make_unique<ForwardListener>(virtualSum));
+        if (i > 0)
+            hops[i - 1]->next.push_back(hops[i].get());
+    }
+    ServiceListener<long>* first = hops[0].get();
+    start = BenchClock::now();
+    for (long i = 0; i < n; ++i)
+        first->ProcessAdd(i);
+    virtualCall = Elapsed(start);
+    StaticPipeline hopPipeline{ForwardStage(staticSum), ForwardStage(staticSum), ForwardStage(staticSum), ForwardStage(staticSum), ForwardStage(staticSum)};
+    start = BenchClock::now();
+    for (long i = 0; i < n; ++i)
+        hopPipeline.Push(i);
+    staticCall = Elapsed(start);
+    cout << "  virtual listeners: " << virtualCall * 1e9 / n << "ns/tick  static pipeline: " << staticCall * 1e9 / n << "ns/tick"
+         << (staticSum == virtualSum ? "  (same checksum)" : "  CHECKSUMS DIFFER") << endl;
+}
+
+// A consumer that takes a fixed amount of work per price and remembers the last mid per product
+class SlowPriceConsumer: public ServiceListener<Price<Bond> >
+{
+public:
+    SlowPriceConsumer(const ProductRegistry& _registry, int _work): lastMid(_registry.Size()), registry(_registry), work(_work) {}
+    vector<long> lastMid;
+    long seen = 0;
+    uint64_t checksum = 0;
+    void ProcessAdd(Price<Bond>& data) override {}
+    void ProcessRemove(Price<Bond>& data) override {}
+    void ProcessUpdate(Price<Bond>& data) override {
+        uint64_t x = uint64_t(data.GetMid().GetTicks());
+        for (int i = 0; i < work; ++i)
+            x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        checksum += x;
+        lastMid[registry.HandleOf(data.GetProduct())] = long(data.GetMid().GetTicks());
+        ++seen;
+    }
+private:
+    const ProductRegistry& registry;
+    int work;
+};
+
+// A consumer that logs each event as its kind and product, holding up the first until released
+class GatedPriceLog: public ServiceListener<Price<Bond> >
+{
+public:
+    explicit GatedPriceLog(const ProductRegistry& _registry): registry(_registry) {}
+    atomic<bool> entered{false}, released{false};
+    string log;
+    void ProcessAdd(Price<Bond>& data) override { Record('A', data); }
+    void ProcessRemove(Price<Bond>& data) override { Record('R', data); }
+    void ProcessUpdate(Price<Bond>& data) override { Record('U', data); }
+private:
+    void Record(char kind, Price<Bond>& data) {
+        log += kind;
+        log += char('0' + registry.HandleOf(data.GetProduct()));
+        entered = true;
+        while (!released)
+            this_thread::yield();
+    }
+    const ProductRegistry& registry;
+};
+
+// Events of different kinds for a product that is already pending keep their net effect
+bool ConflatedKindsHold(const ProductRegistry& registry, vector<Price<Bond> >& prices)
+{
+    GatedPriceLog consumer(registry);
+    ConflatingListener<Price<Bond> > conflater(consumer, registry);
+    conflater.ProcessUpdate(prices[0]);
+    while (!consumer.entered)
+        this_thread::yield();
+    conflater.ProcessAdd(prices[1]); // an add then a remove: nothing
+    conflater.ProcessRemove(prices[1]);
+    conflater.ProcessRemove(prices[2]); // a remove then an update: both, in order
+    conflater.ProcessUpdate(prices[2]);
+    conflater.ProcessAdd(prices[3]); // an add then updates: one add
+    conflater.ProcessUpdate(prices[3]);
+    conflater.ProcessUpdate(prices[3]);
+    conflater.ProcessUpdate(prices[4]); // an update then a remove: the remove
+    conflater.ProcessRemove(prices[4]);
+    conflater.ProcessRemove(prices[5]); // a remove, an add and a remove: one remove
+    conflater.ProcessAdd(prices[5]);
+    conflater.ProcessRemove(prices[5]);
+    consumer.released = true;
+    conflater.Stop();
+    return consumer.log == "U0R2U2A3R4R5";
+}
+
+void BenchConflation()
+{
+    cout << "== conflation: 200k price updates over 7 bonds into a consumer taking 1000 steps each ==" << endl;
+    const char* cusips[] = {"91282CFX4", "91282CGA3", "91282CFZ9", "91282CFY2", "91282CFV8", "912810TM0", "912810TL2"};
+    vector<Bond> bonds;
+    for (int i = 0; i < 7; ++i)
+        bonds.emplace_back(cusips[i], CUSIP, "T", 4.5f, date(2025 + i, Nov, 30));
+    ProductRegistry registry(bonds);
+    const long n = 200000;
+    const int work = 1000;
+    vector<Price<Bond> > prices;
+    for (long i = 0; i < 7 * 64; ++i)
+        prices.emplace_back(registry.GetBond(ProductHandle(i % 7)), TickPrice::FromTicks(256 * 99 + i), TickPrice::FromTicks(2));
+    vector<long> expected(7);
+    for (long i = n - 7; i < n; ++i)
+        expected[i % 7] = prices[i % prices.size()].GetMid().GetTicks();
+
+    {
+        SlowPriceConsumer consumer(registry, work);
+        AsyncListener<Price<Bond> > queue(consumer, 4096, WAIT_YIELD);
+        auto start = BenchClock::now();
+        for (long i = 0; i < n; ++i)
+            queue.ProcessUpdate(prices[i % prices.size()]);
+        double produced = Elapsed(start);
+        queue.Stop();
+        double drained = Elapsed(start);
+        cout << "  queue: producer " << produced * 1e9 / n << "ns/update, drained in " << drained << "s, "
+             << consumer.seen << " delivered, max depth " << queue.GetMaxDepth()
+             << (consumer.lastMid == expected ? "  (latest state)" : "  STALE STATE") << endl;
+    }
+    {
+        SlowPriceConsumer consumer(registry, work);
+        ConflatingListener<Price<Bond> > conflater(consumer, registry);
+        auto start = BenchClock::now();
+        for (long i = 0; i < n; ++i)
+            conflater.ProcessUpdate(prices[i % prices.size()]);
+        double produced = Elapsed(start);
+        conflater.Stop();
+        double drained = Elapsed(start);
+        cout << "  conflating: producer " << produced * 1e9 / n << "ns/update, drained in " << drained << "s, "
+             << consumer.seen << " delivered, " << conflater.GetConflated() << " conflated, max depth " << conflater.GetMaxDepth()
+             << (consumer.lastMid == expected ? "  (latest state)" : "  STALE STATE")
+             << (ConflatedKindsHold(registry, prices) ? "  (kinds kept)" : "  KINDS LOST") << endl;
+    }
+}
+
+// Check the consolidated book against the sum of the venue books at every level in its window
+bool BooksAgree(BondMarketDataService& service, const Bond& bond)
+{
+    const FlatOrderBook& consolidated = service.GetConsolidatedBook(bond);
+    bool agree = true;
+    for (PricingSide side : {BID, OFFER}) {
+        auto check = [&](TickPrice price, long) {
+            if (!consolidated.Contains(price))
+                return;
+            long sum = 0;
+            for (int v = 0; v < MARKET_COUNT; ++v)
+                sum += service.GetVenueBook(bond, Market(v)).GetQuantity(side, price);
+            agree = agree && sum == consolidated.GetQuantity(side, price);
+        };
+        consolidated.ForEachLevel(side, SIZE_MAX, check);
+        for (int v = 0; v < MARKET_COUNT; ++v)
+            service.GetVenueBook(bond, Market(v)).ForEachLevel(side, SIZE_MAX, check);
+    }
+    return agree;
+}
+
+// Consolidation: venues quoting points apart, moved by up to 5 points with adds sent before deletes
+// Check the cached top of book against the best bid and offer across the venue books
+bool TopAgrees(BondMarketDataService& service, const Bond& bond)
+{
+    TickPrice bid, offer;
+    bool hasBid = false, hasOffer = false;
+    for (int v = 0; v < MARKET_COUNT; ++v) {
+        const FlatOrderBook& book = service.GetVenueBook(bond, Market(v));
+        if (book.HasLevels(BID) && (!hasBid || book.GetBest(BID) > bid)) {
+            bid = book.GetBest(BID);
+            hasBid = true;
+        }
+        if (book.HasLevels(OFFER) && (!hasOffer || book.GetBest(OFFER) < offer)) {
+            offer = book.GetBest(OFFER);
+            hasOffer = true;
+        }
+    }
+    const TopOfBook<Bond>& top = service.GetTopOfBook(bond.GetProductId());
+    return top.GetBidOrder().GetPrice() == bid && top.GetOfferOrder().GetPrice() == offer;
+}
+
+void BenchConsolidation()
+{
+    cout << "== consolidation: 3 venues over 2 points apart, 100K moves of up to 5 points ==" << endl;
+    ProductRegistry registry(vector<Bond>{Bond("91282CFX4", CUSIP, "T", 4.5f, date(2024, Nov, 30))});
+    const Bond& bond = registry.GetBond(0);
+    BondMarketDataService service(registry);
+    const long n = 100000;
+    const int depth = 5;
+    const int64_t offsets[MARKET_COUNT] = {0, 2 * 256, -64};
+    const int64_t moves[] = {1, 2 * 256 + 44, -5 * 256, 3 * 256 + 7, -1, 5 * 256, -2 * 256 - 3, -3 * 256};
+    int64_t mid = 100 * 256;
+    long deltas = 0;
+    bool agree = true, topAgrees = true;
+    auto quote = [&](Market venue, int64_t centre, DeltaAction action) {
+        for (int d = 1; d <= depth; ++d) {
+            BookDelta<Bond> bid(bond, venue, action, BID, TickPrice::FromTicks(centre - d), action == DELETE_LEVEL ? 0 : 1000000 * d);
+            BookDelta<Bond> offer(bond, venue, action, OFFER, TickPrice::FromTicks(centre + d), action == DELETE_LEVEL ? 0 : 1000000 * d);
+            service.OnDelta(bid);
+            service.OnDelta(offer);
+            deltas += 2;
+        }
+    };
+    for (int v = 0; v < MARKET_COUNT; ++v)
+        quote(Market(v), mid + offsets[v], ADD_LEVEL);
+    auto start = BenchClock::now();
+    for (long i = 0; i < n; ++i) {
+        int64_t next = mid + moves[i % 8];
+        for (int v = 0; v < MARKET_COUNT; ++v) {
+            quote(Market(v), next + offsets[v], ADD_LEVEL);
+            quote(Market(v), mid + offsets[v], DELETE_LEVEL);
+        }
+        mid = next;
+        agree = agree && BooksAgree(service, bond);
+        // a deep bid far under the touch, outside the consolidated window, must not move the touch
+        BookDelta<Bond> deep(bond, Market(i % MARKET_COUNT), ADD_LEVEL, BID, TickPrice::FromTicks(mid - 3 * 256), 1000000);
+        service.OnDelta(deep);
+        topAgrees = topAgrees && TopAgrees(service, bond);
+        BookDelta<Bond> gone(bond, Market(i % MARKET_COUNT), DELETE_LEVEL, BID, TickPrice::FromTicks(mid - 3 * 256), 0);
+        service.OnDelta(gone);
+        deltas += 2;
+    }
+    double elapsed = Elapsed(start);
+    cout << "  " << elapsed * 1e9 / deltas << "ns/delta, checks included"
+         << (agree ? "  (books agree)" : "  BOOKS DIFFER")
+         << (topAgrees ? "  (top of book at the venue touch)" : "  TOP OF BOOK STALE") << endl;
+}
+
+int main(int argc, char* argv[])
+{
+    vector<pair<string, function<void()> > > sections = {
+        {"streamreader", BenchStreamReader},
+        {"priceparser", BenchPriceParser},
+        {"priceformatter", BenchPriceFormatter},
+        {"asyncwriter", BenchAsyncWriter},
+        {"orderbook", BenchOrderBook},
+        {"matching", BenchMatching},
+        {"router", BenchRouter},
+        {"slicer", BenchSlicer},
+        {"strategies", BenchStrategies},
+        {"orderstore", BenchOrderStore},
+        {"risk", BenchRiskGate},
+        {"throttle", BenchThrottle},
+        {"bus", BenchBus},
+        {"batch", BenchBatch},
+        {"pipeline", BenchPipeline},
+        {"conflation", BenchConflation},
+        {"consolidation", BenchConsolidation},
+    };
+    string only = argc > 1 ? argv[1] : "";
+    for (auto& section : sections) {
+        if (only.empty() || only == section.first)
+            section.second();
+    }
+    return 0;
+}
@@ -11,14 +11,22 @@
 #include <fstream>
 #include "soa.hpp"
 #include "marketdataservice.hpp"
+#include "asyncwriter.hpp"
+#include "productregistry.hpp"
+#include <optional>
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include "smartorderrouter.hpp"
+#include "algostrategies.hpp"
+#include "orderstore.hpp"
+#include "ratelimiter.hpp"
 
 enum OrderType { FOK, IOC, MARKET, LIMIT, STOP };
 
-enum Market { BROKERTEC, ESPEED, CME };
-
 /**
  * An execution order that can be placed on an exchange.
- * Type T is the product type.
+ * Type T is the product type; the product is referenced, not copied, and must outlive the order.
  */
 template<typename T>
 class ExecutionOrder
@@ -27,7 +35,7 @@ class ExecutionOrder
 public:
 
   // ctor for an order
-  ExecutionOrder(const T &_product, PricingSide _side, string _orderId, OrderType _orderType, double _price, double _visibleQuantity, double _hiddenQuantity, string _parentOrderId, bool _isChildOrder);
+  ExecutionOrder(const T &_product, PricingSide _side, string _orderId, OrderType _orderType, TickPrice _price, double _visibleQuantity, double _hiddenQuantity, string _parentOrderId, bool _isChildOrder);
 
   // Get the product
   const T& GetProduct() const;
@@ -41,7 +49,7 @@ public:
   OrderType GetOrderType() const;
 
   // Get the price on this order
-  double GetPrice() const;
+  TickPrice GetPrice() const;
 
   // Get the visible quantity on this order
   long GetVisibleQuantity() const;
@@ -56,11 +64,11 @@ public:
   bool IsChildOrder() const;
 
 private:
-  T product;
+  const T* product;
   PricingSide side;
   string orderId;
   OrderType orderType;
-  double price;
+  TickPrice price;
   double visibleQuantity;
   double hiddenQuantity;
   string parentOrderId;
@@ -85,8 +93,8 @@ public:
 };
 
 template<typename T>
-ExecutionOrder<T>::ExecutionOrder(const T &_product, PricingSide _side, string _orderId, OrderType _orderType, double _price, double _visibleQuantity, double _hiddenQuantity, string _parentOrderId, bool _isChildOrder) :
-  product(_product)
+ExecutionOrder<T>::ExecutionOrder(const T &_product, PricingSide _side, string _orderId, OrderType _orderType, TickPrice _price, double _visibleQuantity, double _hiddenQuantity, string _parentOrderId, bool _isChildOrder) :
+  product(&_product)
 {
   side = _side;
   orderId = _orderId;
@@ -101,7 +109,7 @@ ExecutionOrder<T>::ExecutionOrder(const T &_product, PricingSide _side, string _
 template<typename T>
 const T& ExecutionOrder<T>::GetProduct() const
 {
-  return product;
+  return *product;
 }
 
 template<typename T>
@@ -117,7 +125,7 @@ OrderType ExecutionOrder<T>::GetOrderType() const
 }
 
 template<typename T>
-double ExecutionOrder<T>::GetPrice() const
+TickPrice ExecutionOrder<T>::GetPrice() const
 {
   return price;
 }
@@ -146,23 +154,167 @@ bool ExecutionOrder<T>::IsChildOrder() const
   return isChildOrder;
 }
 
+// State of an order after an execution report
+enum ExecutionStatus { ORDER_NEW, ORDER_PARTIALLY_FILLED, ORDER_FILLED, ORDER_CANCELLED, ORDER_REJECTED };
+
+/**
+ * An execution report for an order on a venue.
+ * A fill carries the fill price and quantity; a cancel or reject carries the
+ * quantity that will not trade. Leaves quantity is what is still working.
+ * Type T is the product type; the product is referenced, not copied, and must outlive the report.
+ */
+template<typename T>
+class ExecutionReport
+{
+
+public:
+
+  // ctor for a report
+  ExecutionReport(const T &_product, const string &_orderId, Market _venue, PricingSide _side, ExecutionStatus _status, TickPrice _price, long _quantity, long _leavesQuantity);
+
+  // Get the product
+  const T& GetProduct() const;
+
+  // Get the order ID
+  const string& GetOrderId() const;
+
+  // Get the venue
+  Market GetVenue() const;
+
+  // Get the side of the order
+  PricingSide GetSide() const;
+
+  // Get the order state after this report
+  ExecutionStatus GetStatus() const;
+
+  // Get the fill price
+  TickPrice GetPrice() const;
+
+  // Get the filled, cancelled or rejected quantity
+  long GetQuantity() const;
+
+  // Get the quantity still working
+  long GetLeavesQuantity() const;
+
+private:
+  const T* product;
+  string orderId;
+  Market venue;
+  PricingSide side;
+  ExecutionStatus status;
+  TickPrice price;
+  long quantity;
+  long leavesQuantity;
+
+};
+
+template<typename T>
+ExecutionReport<T>::ExecutionReport(const T &_product, const string &_orderId, Market _venue, PricingSide _side, ExecutionStatus _status, TickPrice _price, long _quantity, long _leavesQuantity) :
+  product(&_product), orderId(_orderId), venue(_venue), side(_side), status(_status), price(_price), quantity(_quantity), leavesQuantity(_leavesQuantity)
+{
+}
+
+template<typename T>
+const T& ExecutionReport<T>::GetProduct() const
+{
+  return *product;
+}
+
+template<typename T>
+const string& ExecutionReport<T>::GetOrderId() const
+{
+  return orderId;
+}
+
+template<typename T>
+Market ExecutionReport<T>::GetVenue() const
+{
+  return venue;
+}
+
+template<typename T>
+PricingSide ExecutionReport<T>::GetSide() const
+{
+  return side;
+}
+
+template<typename T>
+ExecutionStatus ExecutionReport<T>::GetStatus() const
+{
+  return status;
+}
+
+template<typename T>
+TickPrice ExecutionReport<T>::GetPrice() const
+{
+  return price;
+}
+
+template<typename T>
+long ExecutionReport<T>::GetQuantity() const
+{
+  return quantity;
+}
+
+template<typename T>
+long ExecutionReport<T>::GetLeavesQuantity() const
+{
+  return leavesQuantity;
+}
+
+/**
+ * A check an order has to pass before it is sent to a venue.
+ * Type T is the product type.
+ */
+template<typename T>
+class PreTradeCheck
+{
+
+public:
+
+  virtual ~PreTradeCheck() = default;
+
+  // Whether the order may be sent to the market; a check that refuses it reports why
+  virtual bool Admit(const ExecutionOrder<T> &order, Market market) = 0;
+
+};
+
 template<typename T>
 class AlgoExecutionService: public Service<string, ExecutionOrder<T> > {
 public:
     virtual void Execute(OrderBook<T>& orderBook) = 0;
 };
 
+/**
+ * Bond Algo Execution Service which turns market data into orders.
+ * Each product is worked by one of the BondAlgoStrategies, AlternatingCross
+ * unless another is selected at startup. An order that takes a level is sent
+ * as a MARKET order and a passive one as a LIMIT order, showing 30% of its
+ * quantity. Orders are kept in an OrderStore under their 64-bit id; their order
+ * id is that number after ID_PREFIX, so children named by other senders, such as
+ * the slicer's, are never taken for ours. They are filled or cancelled by the
+ * venue reports for them or for the children the router split them into.
+ */
 class BondAlgoExecutionService: public AlgoExecutionService<Bond> {
 private:
-    map<string, ExecutionOrder<Bond> > bondExecutionOrders;
+    const ProductRegistry& registry;
+    OrderStore<ExecutionOrder<Bond> > orders;
     vector< ServiceListener<ExecutionOrder<Bond> >* > BondExecutionListeners;
-    map<string, bool> bidOffer;
-    int orderNum;//it will be converted to order id
+    BondAlgoStrategies strategies;
 public:
-    BondAlgoExecutionService(){orderNum=1;}
+    // The text every algo order id starts with
+    static constexpr string_view ID_PREFIX = "ALGO";
 
+    explicit BondAlgoExecutionService(const ProductRegistry& _registry):
+        registry(_registry), orders(_registry.Size()), strategies(_registry.Size()) {}
+
+    // Get the last order sent for a product
     ExecutionOrder<Bond>& GetData(string key) override{
-        return bondExecutionOrders.find(key)->second;
+        ProductHandle handle = registry.Find(key);
+        ExecutionOrder<Bond>* order = (handle == ProductRegistry::NOT_FOUND) ? nullptr : orders.Find(orders.GetLast(handle));
+        if (order == nullptr)
+            throw out_of_range("no order for " + key);
+        return *order;
     }
 
     void OnMessage(ExecutionOrder<Bond> &data) override {}
@@ -171,83 +323,110 @@ public:
 
     const vector< ServiceListener<ExecutionOrder<Bond> >* >& GetListeners() const override {return BondExecutionListeners;}
 
+    // Work a product with strategy S from now on
+    template<typename S>
+    void UseStrategy(const string& productId) {
+        ProductHandle handle = registry.Find(productId);
+        if (handle != ProductRegistry::NOT_FOUND)
+            strategies.Select<S>(handle);
+    }
+
+    // Get strategy S, to configure it for every product it works
+    template<typename S>
+    S& GetStrategy() {
+        return strategies.Get<S>();
+    }
+
+    // Decide on the touch of a full book; a level the order takes is removed from the book
     void Execute(OrderBook<Bond>& orderBook) override {
         const Bond& product = orderBook.GetProduct();
-        string bondID = product.GetProductId();
-        // First execute set to buy
-        if (bidOffer.find(bondID) == bidOffer.end()) {
-            bidOffer.insert(make_pair(bondID, true));
-        } else {
-            bidOffer[bondID] =! bidOffer[bondID];
-        }
-        if (bidOffer[bondID]) {
-            vector<Order> offers = orderBook.GetOfferStack();
-            auto index = offers.begin();
-            double price = offers[0].GetPrice();
-            for (auto it = offers.begin()+1; it != offers.end(); ++it){
-                if (it->GetPrice() < price) {
-                    price = it->GetPrice();
-                    index = it;
-                }
-            }
-            long quantity = index->GetQuantity();
-            long visible= quantity * 0.3;
-            long invisible= quantity - visible;
-            offers.erase(index);
-            orderBook.SetOfferStack(offers);
-            ExecutionOrder<Bond> executionOrder(product, BID, to_string(orderNum), MARKET, price, visible, invisible, to_string(orderNum), false);
-            orderNum++;
-            auto m_algo_exe=bondExecutionOrders.find(bondID);
-            if(m_algo_exe==bondExecutionOrders.end()){
-                bondExecutionOrders.insert(make_pair(bondID, executionOrder));
-                for (auto & BondExecutionListener : BondExecutionListeners){
-                    BondExecutionListener->ProcessAdd(executionOrder);
-                }
-            }
-            else{
-                bondExecutionOrders.erase(bondID);
-                bondExecutionOrders.insert(make_pair(bondID, executionOrder));
-                for (auto & BondExecutionListener : BondExecutionListeners){
-                    BondExecutionListener->ProcessAdd(executionOrder);
-                }
-            }
+        ProductHandle handle = registry.HandleOf(product);
+        if (handle == ProductRegistry::NOT_FOUND)
+            return;
+        vector<Order>& bids = orderBook.GetBidStack();
+        vector<Order>& offers = orderBook.GetOfferStack();
+        auto byPrice = [](const Order& a, const Order& b) {return a.GetPrice() < b.GetPrice();};
+        auto bestBid = max_element(bids.begin(), bids.end(), byPrice);
+        auto bestOffer = min_element(offers.begin(), offers.end(), byPrice);
+        TopOfBook<Bond> top(product, bestBid == bids.end() ? Order(TickPrice(), 0, BID) : *bestBid,
+            bestOffer == offers.end() ? Order(TickPrice(), 0, OFFER) : *bestOffer, BROKERTEC, BROKERTEC);
+        AlgoOrder order;
+        if (!strategies.Decide(top, handle, order))
+            return;
+        Send(handle, product, order);
+        if (order.passive)
+            return;
+        if (order.side == BID)
+            offers.erase(bestOffer);
+        else
+            bids.erase(bestBid);
+    }
+
+    // Decide on a top of book update
+    void Execute(const TopOfBook<Bond>& topOfBook) {
+        ProductHandle handle = registry.HandleOf(topOfBook.GetProduct());
+        if (handle == ProductRegistry::NOT_FOUND)
+            return;
+        AlgoOrder order;
+        if (strategies.Decide(topOfBook, handle, order))
+            Send(handle, topOfBook.GetProduct(), order);
+    }
+
+    // Fill or cancel the order a venue report is for; reports for other orders are ignored
+    void OnReport(const ExecutionReport<Bond>& report) {
+        OrderId id;
+        if (!OrderStore<ExecutionOrder<Bond> >::ParseId(report.GetOrderId(), ID_PREFIX, id))
+            return;
+        switch (report.GetStatus()) {
+        case ORDER_PARTIALLY_FILLED:
+        case ORDER_FILLED:
+            orders.Fill(id, report.GetQuantity());
+            break;
+        case ORDER_CANCELLED:
+        case ORDER_REJECTED:
+            orders.Cancel(id, report.GetQuantity());
+            break;
+        case ORDER_NEW:
+            break;
         }
-        else{
-            vector<Order> bids = orderBook.GetBidStack();
-            auto index=bids.begin();
-            double p=bids[0].GetPrice();
-            for(auto it = bids.begin() + 1; it < bids.end(); ++it){
-                if(it->GetPrice() > p){
-                    p=it->GetPrice();
-                    index=it;
-                }
-            }
-            long q=index->GetQuantity();
-            long visible = q*0.3;
-            long invisible=q-visible;
-            bids.erase(index);
-            orderBook.SetBidStack(bids);
-            ExecutionOrder<Bond> executionOrder(product, OFFER, to_string(orderNum), MARKET, p, visible, invisible, to_string(orderNum), false);
-            orderNum++;
-            auto m_algo_exe= bondExecutionOrders.find(bondID);
-            if(m_algo_exe==bondExecutionOrders.end()){
-                bondExecutionOrders.insert(make_pair(bondID, executionOrder));
-                for (auto & BondExecutionListener : BondExecutionListeners){
-                    BondExecutionListener->ProcessAdd(executionOrder);
-                }
-            }
-            else{
-                bondExecutionOrders.erase(bondID);
-                bondExecutionOrders.insert(make_pair(bondID, executionOrder));
-                for (auto & BondExecutionListener : BondExecutionListeners){
-                    BondExecutionListener->ProcessAdd(executionOrder);
-                }
-            }
+    }
+
+    // Get the orders sent and their state
+    const OrderStore<ExecutionOrder<Bond> >& GetOrders() const {
+        return orders;
+    }
+
+private:
+    void Send(ProductHandle handle, const Bond& product, const AlgoOrder& order) {
+        long visible = order.quantity * 0.3;
+        long invisible = order.quantity - visible;
+        OrderId id = orders.Create(handle, order.quantity, [&](OrderId orderId) {
+            string text = string(ID_PREFIX) + to_string(orderId);
+            return ExecutionOrder<Bond>(product, order.side, text, order.passive ? LIMIT : MARKET, order.price, visible, invisible, text, false);
+        });
+        ExecutionOrder<Bond> executionOrder = *orders.Find(id);
+        for (auto & BondExecutionListener : BondExecutionListeners){
+            BondExecutionListener->ProcessAdd(executionOrder);
         }
     }
 };
 
-class BondMarketDataListeners: public ServiceListener<OrderBook<Bond> > {
+class BondAlgoOrderReportListener: public ServiceListener<ExecutionReport<Bond> > {
+private:
+    BondAlgoExecutionService& bondAlgoExecutionService;
+public:
+    explicit BondAlgoOrderReportListener(BondAlgoExecutionService& src): bondAlgoExecutionService(src) {}
+
+    virtual ~BondAlgoOrderReportListener() = default;
+
+    void ProcessAdd(ExecutionReport<Bond> &data) override {bondAlgoExecutionService.OnReport(data);}
+
+    void ProcessRemove(ExecutionReport<Bond> &data) override {}
+
+    void ProcessUpdate(ExecutionReport<Bond> &data) override {}
+};
+
+class BondMarketDataListeners: public ServiceListener<TopOfBook<Bond> > {
 private:
     BondAlgoExecutionService& bondAlgoExecutionService;
 public:
@@ -255,115 +434,133 @@ public:
 
     virtual ~BondMarketDataListeners() = default;
 
-    void ProcessUpdate(OrderBook<Bond> &data) override{bondAlgoExecutionService.Execute(data);}
+    void ProcessUpdate(TopOfBook<Bond> &data) override{bondAlgoExecutionService.Execute(data);}
 
-    void ProcessRemove(OrderBook<Bond> &data) override{}
+    void ProcessRemove(TopOfBook<Bond> &data) override{}
 
-    void ProcessAdd(OrderBook<Bond> &data) override{}
+    void ProcessAdd(TopOfBook<Bond> &data) override{}
 };
 
+// Get the text of an order type
+string_view ToString(OrderType orderType)
+{
+    switch(orderType){
+        case FOK: return "FOK";
+        case IOC: return "IOC";
+        case MARKET: return "MARKET";
+        case LIMIT: return "LIMIT";
+        case STOP: return "STOP";
+    }
+    return "";
+}
+
 class BondExecutionConnector: public Connector<pair<Market, ExecutionOrder<Bond> > > {
+private:
+    AsyncLogWriter& writer;
+    int fileId;
 public:
+    explicit BondExecutionConnector(AsyncLogWriter& _writer = AsyncLogWriter::Default()):
+        writer(_writer), fileId(_writer.Open("./Output/ExecutionOrders.txt")) {}
+
     void Publish(pair<Market, ExecutionOrder<Bond> > &data) override {
-        ofstream oFile;
-        oFile.open("./Output/ExecutionOrders.txt", ios_base::app);
-        Market market = data.first;
-        ExecutionOrder<Bond> executionOrder = data.second;
-        string orderId = executionOrder.GetOrderId();
-        oFile << orderId << ",";
-        Bond product = executionOrder.GetProduct();
-        string bondID = product.GetProductId();
-        oFile << bondID << ",";
-        PricingSide side = executionOrder.GetSide();
-        if (side == BID) {
-            oFile << "BID,";
-        } else {
-            oFile << "OFFER,";
-        }
-        OrderType orderType = executionOrder.GetOrderType();
-        switch(orderType){
-            case FOK: oFile << "FOK,";
-                break;
-            case IOC: oFile << "IOC,";
-                break;
-            case MARKET: oFile << "MARKET,";
-                break;
-            case LIMIT: oFile << "LIMIT,";
-                break;
-            case STOP: oFile << "STOP,";
-                break;
-        }
-        long visible = executionOrder.GetVisibleQuantity();
-        oFile << to_string(visible) << ",";
-        long hidden = executionOrder.GetHiddenQuantity();
-        oFile << to_string(hidden) << ",";
-        switch(market){
-            case BROKERTEC: oFile << "BROKERTEC,";
-                break;
-            case ESPEED: oFile << "ESPEED,";
-                break;
-            case CME: oFile << "CME,";
-                break;
-        }
-        double price = executionOrder.GetPrice();
-        int part1 = int(price);
-        double p2 = price - double(part1);
-        int part2 = int(p2*32);
-        double p3 = p2 - double(part2)/32;
-        int part3 = round(p3*256);
-        string p_str;
-        if(part2>=10){
-            p_str=to_string(part1)+"-"+to_string(part2)+to_string(part3);
-        } else {
-            p_str=to_string(part1)+"-"+"0"+to_string(part2)+to_string(part3);
-        }
-        oFile << p_str << "\n";
-        oFile.close();
+        const ExecutionOrder<Bond>& executionOrder = data.second;
+        LogLine line;
+        line << executionOrder.GetOrderId() << ',';
+        line << executionOrder.GetProduct().GetProductId() << ',';
+        line << (executionOrder.GetSide() == BID ? "BID," : "OFFER,");
+        line << ToString(executionOrder.GetOrderType()) << ',';
+        line << executionOrder.GetVisibleQuantity() << ',';
+        line << executionOrder.GetHiddenQuantity() << ',';
+        line << ToString(data.first) << ',';
+        line.AppendPrice(executionOrder.GetPrice()) << '\n';
+        writer.Append(fileId, line);
     }
 };
 
 class BondExecutionService: public ExecutionService<Bond> {
 private:
-    map<string, ExecutionOrder<Bond> > bondExecutionOrders;
+    const ProductRegistry& registry;
+    vector<optional<ExecutionOrder<Bond> > > bondExecutionOrders; // last order, indexed by product handle
     vector< ServiceListener<ExecutionOrder<Bond> >* > orderListeners;
+    vector< ServiceListener<pair<Market, ExecutionOrder<Bond> > >* > venueListeners;
     BondExecutionConnector bondExecutionConnector;
+    vector<PreTradeCheck<Bond>* > preTradeChecks;
+    KillSwitch& killSwitch;
 public:
+    // ctor for a service that sends nothing while killSwitch is halted
+    explicit BondExecutionService(const ProductRegistry& _registry, KillSwitch& _killSwitch = KillSwitch::Global()):
+        registry(_registry), bondExecutionOrders(_registry.Size()), killSwitch(_killSwitch) {}
+
+    // Pass every order through check before it is sent, after the checks added before it.
+    // An order a check refuses goes no further.
+    void AddPreTradeCheck(PreTradeCheck<Bond>* check) {preTradeChecks.push_back(check);}
+
     ExecutionOrder<Bond>& GetData(string key) override{
-        return bondExecutionOrders.find(key)->second;
+        return bondExecutionOrders.at(registry.Find(key)).value();
     }
 
     void OnMessage(ExecutionOrder<Bond> &data) override{}
 
     void AddListener(ServiceListener<ExecutionOrder<Bond> > *listener) override {orderListeners.push_back(listener);}
 
+    // Listen to orders as they are sent to a venue
+    virtual void AddListener(ServiceListener<pair<Market, ExecutionOrder<Bond> > > *listener) {venueListeners.push_back(listener);}
+
     const vector< ServiceListener<ExecutionOrder<Bond> >* >& GetListeners() const override {return orderListeners;}
 
-    void ExecuteOrder(const ExecutionOrder<Bond>& order, Market market) override {
-        string productId = order.GetProduct().GetProductId();
-        auto it=bondExecutionOrders.find(productId);
+    void ExecuteOrder(const ExecutionOrder<Bond>& order, Market market) override {Submit(order, market);}
+
+    // Pass an order through the checks and send it if they admit it. Returns whether it went to the venue;
+    // an order for a bond outside the registry is dropped before the checks see it.
+    bool Submit(const ExecutionOrder<Bond>& order, Market market) {
+        if (killSwitch.IsHalted() || registry.HandleOf(order.GetProduct()) == ProductRegistry::NOT_FOUND)
+            return false;
+        for (auto & check : preTradeChecks) {
+            if (!check->Admit(order, market))
+                return false;
+        }
+        return Release(order, market);
+    }
+
+    // Send an order that has passed the pre-trade checks, or that a check held back and now lets go.
+    // Returns whether it was sent.
+    bool Release(const ExecutionOrder<Bond>& order, Market market) {
+        ProductHandle handle = registry.HandleOf(order.GetProduct());
+        if (killSwitch.IsHalted() || handle == ProductRegistry::NOT_FOUND)
+            return false;
+        bondExecutionOrders[handle].emplace(order);
         ExecutionOrder<Bond> copy = order;
-        if(it == bondExecutionOrders.end()){
-            bondExecutionOrders.insert(make_pair(productId, order));
-            for(auto & exeOrderListener : orderListeners){
-                exeOrderListener->ProcessAdd(copy);
-            }
-        } else {
-            bondExecutionOrders.erase(productId);
-            bondExecutionOrders.insert(make_pair(productId, order));
-            for (auto & exeOrderListener : orderListeners) {
-                exeOrderListener->ProcessAdd(copy);
-            }
+        for(auto & exeOrderListener : orderListeners){
+            exeOrderListener->ProcessAdd(copy);
         }
         pair<Market, ExecutionOrder<Bond> > currentOrder(make_pair(market,copy));
         bondExecutionConnector.Publish(currentOrder);
+        for(auto & venueListener : venueListeners){
+            venueListener->ProcessAdd(currentOrder);
+        }
+        return true;
     }
 };
 
+// Routes each algo order through the smart order router. An order that fits on
+// one venue goes out whole; otherwise each venue gets a child order carrying the
+// parent's id and its share of the parent's visible quantity. The time each
+// venue takes to accept an order is fed back to the router as a latency sample;
+// an order the checks refuse or hold back gives no sample, so a venue does not
+// look fast because its orders are turned away.
 class BondAlgoExecutionListener: public ServiceListener<ExecutionOrder<Bond> > {
 private:
     BondExecutionService& bondExecutionService;
+    BondSmartOrderRouter& bondRouter;
+
+    void Send(const ExecutionOrder<Bond>& order, Market market) {
+        auto start = chrono::steady_clock::now();
+        if (bondExecutionService.Submit(order, market))
+            bondRouter.RecordLatency(market, chrono::duration<double, nano>(chrono::steady_clock::now() - start).count());
+    }
 public:
-    explicit BondAlgoExecutionListener(BondExecutionService& src): bondExecutionService(src){}
+    BondAlgoExecutionListener(BondExecutionService& src, BondSmartOrderRouter& router):
+        bondExecutionService(src), bondRouter(router){}
 
     virtual ~BondAlgoExecutionListener() = default;
 
@@ -372,17 +569,21 @@ public:
     void ProcessRemove(ExecutionOrder<Bond> &data) override {}
 
     void ProcessAdd(ExecutionOrder<Bond> &data) override {
-        int i = rand() % 3;
-        Market market;
-        switch(i) {
-            case 0: market=BROKERTEC;
-                break;
-            case 1: market=ESPEED;
-                break;
-            case 2: market=CME;
-                break;
+        long visible = data.GetVisibleQuantity();
+        long quantity = visible + data.GetHiddenQuantity();
+        bool limited = data.GetOrderType() != MARKET && data.GetOrderType() != STOP;
+        RouteSlice slices[MARKET_COUNT];
+        size_t count = bondRouter.Route(data.GetProduct(), data.GetSide(), limited, data.GetPrice(), quantity, slices);
+        if (count == 1) {
+            Send(data, slices[0].venue);
+            return;
+        }
+        for (size_t k = 0; k < count; ++k) {
+            long childVisible = slices[k].quantity * visible / quantity;
+            ExecutionOrder<Bond> child(data.GetProduct(), data.GetSide(), data.GetOrderId() + "-" + to_string(k + 1), data.GetOrderType(),
+                data.GetPrice(), childVisible, slices[k].quantity - childVisible, data.GetOrderId(), true);
+            Send(child, slices[k].venue);
         }
-        bondExecutionService.ExecuteOrder(data, market);
     }
 };
 
@@ -0,0 +1,283 @@
+/**
+ * flatorderbook.hpp
+ * Defines a per-product price ladder held in a flat tick-indexed array.
+ *
+ * Aggregate quantities live in one contiguous window of CAPACITY ticks per
+ * side, addressed by tick modulo CAPACITY, so the window is a ring that can
+ * slide with the market without moving any level. A bitmap per side marks the
+ * occupied levels: updating a level is O(1), the best bid and offer are cached
+ * and, when the best level is removed, the next one is found by scanning the
+ * bitmap a 64-tick word at a time.
+ */
+#ifndef FLAT_ORDER_BOOK_HPP
+#define FLAT_ORDER_BOOK_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include "tickprice.hpp"
+
+using namespace std;
+
+// Side for market data
+enum PricingSide { BID, OFFER };
+
+class FlatOrderBook
+{
+
+public:
+
+  // Number of ticks covered by the window, 4 points
+  static const int64_t CAPACITY = 1024;
+
+  // ctor for an empty book
+  FlatOrderBook();
+
+  // Set the aggregate quantity at a price level; a quantity of 0 removes the level.
+  // A price outside the window slides the window onto it, dropping levels that fall out on either side.
+  void SetLevel(PricingSide side, TickPrice price, long quantity);
+
+  // Set a level as above, calling dropped(side, price, quantity) for each level a slide drops, before the level is set
+  template<typename F>
+  void SetLevel(PricingSide side, TickPrice price, long quantity, F dropped);
+
+  // Add to the aggregate quantity at a price level; the level is removed once it reaches 0
+  void AddQuantity(PricingSide side, TickPrice price, long quantity);
+
+  // Add to a level as above, calling dropped(side, price, quantity) for each level a slide drops
+  template<typename F>
+  void AddQuantity(PricingSide side, TickPrice price, long quantity, F dropped);
+
+  // Get the aggregate quantity at a price level
+  long GetQuantity(PricingSide side, TickPrice price) const;
+
+  // Is the price inside the window, so that setting it drops no level?
+  bool Contains(TickPrice price) const;
+
+  // Get the total quantity on the side at prices at or better than limit, counting no further than cap
+  long GetDepthThrough(PricingSide side, TickPrice limit, long cap) const;
+
+  // Is there any level on the side?
+  bool HasLevels(PricingSide side) const;
+
+  // Get the number of levels on the side
+  size_t GetLevelCount(PricingSide side) const;
+
+  // Get the best price on the side; only meaningful when the side has levels
+  TickPrice GetBest(PricingSide side) const;
+
+  // Remove every level from both sides
+  void Clear();
+
+  // Remove every level from both sides and centre the window on a price
+  void Clear(TickPrice centre);
+
+  // Call f(price, quantity) for up to maxLevels levels on the side, best first
+  template<typename F>
+  void ForEachLevel(PricingSide side, size_t maxLevels, F f) const;
+
+private:
+  static const int64_t MASK = CAPACITY - 1;
+  static const int64_t WORDS = CAPACITY / 64;
+
+  bool InWindow(int64_t tick) const;
+  template<typename F>
+  void Slide(int64_t tick, F &dropped);
+  int64_t NextLevel(PricingSide side, int64_t fromTick) const;
+
+  long quantities[2][CAPACITY];
+  uint64_t occupied[2][WORDS];
+  size_t levelCount[2];
+  int64_t bestTick[2];
+  int64_t base;
+
+};
+
+FlatOrderBook::FlatOrderBook() : levelCount{0, 0}, bestTick{0, 0}, base(0)
+{
+  memset(quantities, 0, sizeof(quantities));
+  memset(occupied, 0, sizeof(occupied));
+}
+
+bool FlatOrderBook::InWindow(int64_t tick) const
+{
+  return tick >= base && tick < base + CAPACITY;
+}
+
+// Move the window so that it is centered on tick. The window start stays a
+// multiple of 64 so whole bitmap words enter and leave it.
+template<typename F>
+void FlatOrderBook::Slide(int64_t tick, F &dropped)
+{
+  int64_t newBase = (tick & ~int64_t(63)) - CAPACITY / 2;
+  if (levelCount[BID] + levelCount[OFFER] > 0) {
+    for (int s = 0; s < 2; ++s) {
+      for (int64_t w = base >> 6; w < (base + CAPACITY) >> 6; ++w) {
+        if (w >= newBase >> 6 && w < (newBase + CAPACITY) >> 6)
+          continue;
+        uint64_t& bits = occupied[s][w & (WORDS - 1)];
+        levelCount[s] -= size_t(__builtin_popcountll(bits));
+        for (uint64_t left = bits; left; left &= left - 1) {
+          int64_t level = (w << 6) + __builtin_ctzll(left);
+          dropped(PricingSide(s), TickPrice::FromTicks(level), quantities[s][level & MASK]);
+        }
+        bits = 0;
+        memset(&quantities[s][(w << 6) & MASK], 0, 64 * sizeof(long));
+      }
+    }
+  }
+  base = newBase;
+  for (int s = 0; s < 2; ++s) {
+    if (levelCount[s] > 0 && !InWindow(bestTick[s]))
+      bestTick[s] = NextLevel(PricingSide(s), s == BID ? base + CAPACITY - 1 : base);
+  }
+}
+
+// Find the first occupied level at or behind fromTick, moving away from the touch
+int64_t FlatOrderBook::NextLevel(PricingSide side, int64_t fromTick) const
+{
+  if (!InWindow(fromTick))
+    return fromTick;
+  const uint64_t* bits = occupied[side];
+  if (side == BID) {
+    int64_t w = fromTick >> 6;
+    uint64_t word = bits[w & (WORDS - 1)] & (~uint64_t(0) >> (63 - (fromTick & 63)));
+    while (true) {
+      if (word)
+        return (w << 6) + 63 - __builtin_clzll(word);
+      if (--w < base >> 6)
+        return fromTick;
+      word = bits[w & (WORDS - 1)];
+    }
+  }
+  int64_t w = fromTick >> 6;
+  uint64_t word = bits[w & (WORDS - 1)] & (~uint64_t(0) << (fromTick & 63));
+  while (true) {
+    if (word)
+      return (w << 6) + __builtin_ctzll(word);
+    if (++w >= (base + CAPACITY) >> 6)
+      return fromTick;
+    word = bits[w & (WORDS - 1)];
+  }
+}
+
+void FlatOrderBook::SetLevel(PricingSide side, TickPrice price, long quantity)
+{
+  SetLevel(side, price, quantity, [](PricingSide, TickPrice, long) {});
+}
+
+template<typename F>
+void FlatOrderBook::SetLevel(PricingSide side, TickPrice price, long quantity, F dropped)
+{
+  int64_t tick = price.GetTicks();
+  if (!InWindow(tick)) {
+    if (quantity <= 0)
+      return;
+    Slide(tick, dropped);
+  }
+  int64_t index = tick & MASK;
+  uint64_t bit = uint64_t(1) << (tick & 63);
+  uint64_t& word = occupied[side][index >> 6];
+  if (quantity > 0) {
+    quantities[side][index] = quantity;
+    if (word & bit)
+      return;
+    word |= bit;
+    bool better = (side == BID) ? tick > bestTick[side] : tick < bestTick[side];
+    if (levelCount[side]++ == 0 || better)
+      bestTick[side] = tick;
+    return;
+  }
+  if (!(word & bit))
+    return;
+  quantities[side][index] = 0;
+  word &= ~bit;
+  if (--levelCount[side] > 0 && tick == bestTick[side])
+    bestTick[side] = NextLevel(side, side == BID ? tick - 1 : tick + 1);
+}
+
+void FlatOrderBook::AddQuantity(PricingSide side, TickPrice price, long quantity)
+{
+  SetLevel(side, price, GetQuantity(side, price) + quantity);
+}
+
+template<typename F>
+void FlatOrderBook::AddQuantity(PricingSide side, TickPrice price, long quantity, F dropped)
+{
+  SetLevel(side, price, GetQuantity(side, price) + quantity, dropped);
+}
+
+long FlatOrderBook::GetQuantity(PricingSide side, TickPrice price) const
+{
+  int64_t tick = price.GetTicks();
+  return InWindow(tick) ? quantities[side][tick & MASK] : 0;
+}
+
+bool FlatOrderBook::Contains(TickPrice price) const
+{
+  return InWindow(price.GetTicks());
+}
+
+long FlatOrderBook::GetDepthThrough(PricingSide side, TickPrice limit, long cap) const
+{
+  long total = 0;
+  int64_t tick = bestTick[side];
+  for (size_t i = 0; i < levelCount[side] && total < cap; ++i) {
+    tick = NextLevel(side, tick);
+    if (side == BID ? tick < limit.GetTicks() : tick > limit.GetTicks())
+      break;
+    total += quantities[side][tick & MASK];
+    tick += (side == BID) ? -1 : 1;
+  }
+  return total;
+}
+
+bool FlatOrderBook::HasLevels(PricingSide side) const
+{
+  return levelCount[side] > 0;
+}
+
+size_t FlatOrderBook::GetLevelCount(PricingSide side) const
+{
+  return levelCount[side];
+}
+
+TickPrice FlatOrderBook::GetBest(PricingSide side) const
+{
+  return TickPrice::FromTicks(bestTick[side]);
+}
+
+void FlatOrderBook::Clear()
+{
+  for (int s = 0; s < 2; ++s) {
+    for (int64_t w = 0; w < WORDS; ++w) {
+      uint64_t bits = occupied[s][w];
+      while (bits) {
+        quantities[s][(w << 6) + __builtin_ctzll(bits)] = 0;
+        bits &= bits - 1;
+      }
+      occupied[s][w] = 0;
+    }
+    levelCount[s] = 0;
+  }
+}
+
+void FlatOrderBook::Clear(TickPrice centre)
+{
+  Clear();
+  base = (centre.GetTicks() & ~int64_t(63)) - CAPACITY / 2;
+}
+
+template<typename F>
+void FlatOrderBook::ForEachLevel(PricingSide side, size_t maxLevels, F f) const
+{
+  size_t n = (levelCount[side] < maxLevels) ? levelCount[side] : maxLevels;
+  int64_t tick = bestTick[side];
+  for (size_t i = 0; i < n; ++i) {
+    tick = NextLevel(side, tick);
+    f(TickPrice::FromTicks(tick), quantities[side][tick & MASK]);
+    tick += (side == BID) ? -1 : 1;
+  }
+}
+
+#endif
@@ -0,0 +1,190 @@
+/**
+ * fractionalprice.hpp
+ * Parsing and formatting of US Treasury fractional prices quoted in 32nds and 256ths.
+ *
+ * A price such as 100-25+ reads as 100 + 25/32 + 4/256, and 99-237 reads as
+ * 99 + 23/32 + 7/256. The last digit is in 256ths (0-7) and '+' stands for
+ * a half 32nd, i.e. 4/256. Internally a price is a whole number of 1/256 ticks.
+ */
+#ifndef FRACTIONAL_PRICE_HPP
+#define FRACTIONAL_PRICE_HPP
+
+#include <string_view>
+#include <charconv>
+#include <cstddef>
+#include <cstring>
+#include <cmath>
+#include <climits>
+#include <array>
+#include "tickprice.hpp"
+
+using namespace std;
+
+// Number of ticks in one point of price
+const long long TICKS_PER_POINT = TickPrice::TICKS_PER_POINT;
+
+// Largest whole number of points a price may carry, so its tick count fits in a long long
+const long long MAX_WHOLE_POINTS = LLONG_MAX / TICKS_PER_POINT;
+
+// Parse a fractional price into 1/256 ticks; returns false if the text is malformed
+bool ParseFractionalTicks(string_view text, long long &ticks)
+{
+  const char* first = text.data();
+  const char* last = first + text.size();
+  long long whole = 0;
+  auto [dash, ec] = from_chars(first, last, whole);
+  if (ec != errc() || dash == last || *dash != '-' || whole > MAX_WHOLE_POINTS || whole < -MAX_WHOLE_POINTS)
+    return false;
+  const char* frac = dash + 1;
+  size_t fracLength = size_t(last - frac);
+  if (fracLength < 2 || fracLength > 3)
+    return false;
+  unsigned d0 = unsigned(frac[0] - '0');
+  unsigned d1 = unsigned(frac[1] - '0');
+  if (d0 > 3 || d1 > 9 || d0 * 10 + d1 > 31)
+    return false;
+  unsigned d2 = 0;
+  if (fracLength == 3) {
+    if (frac[2] == '+') {
+      d2 = 4;
+    } else {
+      d2 = unsigned(frac[2] - '0');
+      if (d2 > 7)
+        return false;
+    }
+  }
+  ticks = whole * TICKS_PER_POINT + (d0 * 10 + d1) * 8 + d2;
+  return true;
+}
+
+// Parse a fractional price into a decimal price; malformed text yields 0
+double ParseFractionalPrice(string_view text)
+{
+  long long ticks = 0;
+  if (!ParseFractionalTicks(text, ticks))
+    return 0.;
+  return double(ticks) / double(TICKS_PER_POINT);
+}
+
+// Parse a fractional price onto the tick grid; malformed text yields a zero price
+TickPrice ParseTickPrice(string_view text)
+{
+  long long ticks = 0;
+  if (!ParseFractionalTicks(text, ticks))
+    return TickPrice();
+  return TickPrice::FromTicks(ticks);
+}
+
+// Parse n fractional price fields in blocks, handing each field's tick count and
+// validity to store(index, ticks, valid); a field is valid exactly when
+// ParseFractionalTicks accepts it.
+// The fields are first scanned into small fixed-size blocks of digits, then the
+// digit checks and tick arithmetic run over each block as a straight-line loop
+// without branches, which the compiler turns into vector instructions.
+template<typename Store>
+void ParseFractionalBlocks(const string_view* fields, size_t n, Store store)
+{
+  const size_t BLOCK = 16;
+  long long whole[BLOCK] = {};
+  unsigned char c0[BLOCK], c1[BLOCK], c2[BLOCK], valid[BLOCK];
+  for (size_t base = 0; base < n; base += BLOCK) {
+    size_t count = (n - base < BLOCK) ? n - base : BLOCK;
+    for (size_t i = 0; i < count; ++i) {
+      string_view field = fields[base + i];
+      const char* first = field.data();
+      const char* last = first + field.size();
+      auto [dash, ec] = from_chars(first, last, whole[i]);
+      size_t fracLength = (dash < last) ? size_t(last - dash - 1) : 0;
+      valid[i] = (ec == errc() && dash < last && *dash == '-' && fracLength >= 2 && fracLength <= 3
+        && whole[i] <= MAX_WHOLE_POINTS && whole[i] >= -MAX_WHOLE_POINTS);
+      whole[i] = valid[i] ? whole[i] : 0;
+      c0[i] = valid[i] ? dash[1] : '0';
+      c1[i] = valid[i] ? dash[2] : '0';
+      c2[i] = (valid[i] && fracLength == 3) ? dash[3] : '0';
+    }
+    for (size_t i = 0; i < count; ++i) {
+      // a non-digit wraps to a large unsigned value and fails its range check
+      unsigned d0 = unsigned(c0[i] - '0');
+      unsigned d1 = unsigned(c1[i] - '0');
+      unsigned d2 = (c2[i] == '+') ? 4u : unsigned(c2[i] - '0');
+      valid[i] &= (d0 <= 3) & (d1 <= 9) & (d0 * 10 + d1 <= 31) & (d2 <= 7);
+      long long ticks = whole[i] * TICKS_PER_POINT + (d0 * 10 + d1) * 8 + d2;
+      store(base + i, ticks, valid[i] != 0);
+    }
+  }
+}
+
+// Parse n fractional price fields into decimal prices in one call.
+// Malformed fields yield 0, as with ParseFractionalPrice.
+void ParseFractionalPrices(const string_view* fields, size_t n, double* prices)
+{
+  ParseFractionalBlocks(fields, n, [prices](size_t i, long long ticks, bool valid) {
+    prices[i] = valid ? double(ticks) / double(TICKS_PER_POINT) : 0.;
+  });
+}
+
+// Parse n fractional price fields onto the tick grid in one call.
+// Malformed fields yield a zero price, as with ParseTickPrice.
+void ParseTickPrices(const string_view* fields, size_t n, TickPrice* prices)
+{
+  ParseFractionalBlocks(fields, n, [prices](size_t i, long long ticks, bool valid) {
+    prices[i] = TickPrice::FromTicks(valid ? ticks : 0);
+  });
+}
+
+// Table of the "XXY" suffix for each of the 256 ticks within a point:
+// XX is the zero-padded number of 32nds and Y the remaining 256ths.
+constexpr array<array<char, 3>, 256> MakeTickSuffixTable()
+{
+  array<array<char, 3>, 256> table{};
+  for (int t = 0; t < 256; ++t) {
+    table[t][0] = char('0' + t / 80);
+    table[t][1] = char('0' + (t / 8) % 10);
+    table[t][2] = char('0' + t % 8);
+  }
+  return table;
+}
+
+constexpr array<array<char, 3>, 256> TICK_SUFFIX = MakeTickSuffixTable();
+
+// Longest text written by FormatFractionalTicks, sign and separator included
+const size_t FRACTIONAL_PRICE_MAX_LENGTH = 24;
+
+// Write ticks as NNN-XXY into buf, which must hold FRACTIONAL_PRICE_MAX_LENGTH chars;
+// returns one past the last char written. No terminator is appended.
+char* FormatFractionalTicks(long long ticks, char* buf)
+{
+  if (ticks < 0) {
+    *buf++ = '-';
+    ticks = -ticks;
+  }
+  buf = to_chars(buf, buf + 20, ticks / TICKS_PER_POINT).ptr;
+  *buf++ = '-';
+  memcpy(buf, TICK_SUFFIX[ticks % TICKS_PER_POINT].data(), 3);
+  return buf + 3;
+}
+
+// Write a decimal price as NNN-XXY, rounded to the nearest 1/256
+char* FormatFractionalPrice(double price, char* buf)
+{
+  return FormatFractionalTicks(llround(price * double(TICKS_PER_POINT)), buf);
+}
+
+// Write a tick price as NNN-XXY; exact, no rounding involved
+char* FormatTickPrice(TickPrice price, char* buf)
+{
+  return FormatFractionalTicks(price.GetTicks(), buf);
+}
+
+// Write n prices as NNN-XXY, each followed by sep, into buf, which must hold
+// n * (FRACTIONAL_PRICE_MAX_LENGTH + 1) chars; returns one past the last char written
+char* FormatFractionalPrices(const double* prices, size_t n, char* buf, char sep)
+{
+  for (size_t i = 0; i < n; ++i) {
+    buf = FormatFractionalPrice(prices[i], buf);
+    *buf++ = sep;
+  }
+  return buf;
+}
+
+#endif
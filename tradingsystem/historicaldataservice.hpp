@@ -21,6 +21,7 @@
 #include "riskservice.hpp"
 #include "streamingservice.hpp"
 #include "tradebookingservice.hpp"
+#include "asyncwriter.hpp"
 
 /**
  * Service for processing and persisting historical data to a persistent store.
@@ -39,8 +40,22 @@ public:
 };
 
 class BondPositionHistoricalConnector: public Connector<pair<string, Position<Bond> > > {
+private:
+    AsyncLogWriter& writer;
+    int fileId;
 public:
+    explicit BondPositionHistoricalConnector(AsyncLogWriter& _writer = AsyncLogWriter::Default()):
+        writer(_writer), fileId(_writer.Open("./Output/Historical/position.txt")) {}
+
     void Publish(pair<string, Position<Bond> > &data) override;
+
+    // Write a run of positions, keyed from firstKey up, as one record
+    void Publish(long firstKey, span<Position<Bond> > data);
+
+private:
+    string batch; // lines of the run being written, reused from run to run
+
+    static void Format(LogLine& line, Position<Bond> &position);
 };
 
 class BondPositionHistoricalData: public HistoricalDataService<Position<Bond> > {
@@ -70,6 +85,12 @@ public:
         ++counter;
         PersistData(k,data);
     }
+
+    // Persist a run of positions under consecutive keys
+    void SetPersistKeys(span<Position<Bond> > data){
+        b_pos_historical.Publish(counter, data);
+        counter += int(data.size());
+    }
 };
 
 class BondPositionHistoricalListener: public ServiceListener<Position<Bond> > {
@@ -85,22 +106,39 @@ public:
     void ProcessRemove(Position<Bond> &data) override{}
 
     void ProcessUpdate(Position<Bond> &data) override {b_historical_data.SetPersistKey(data);}
+
+    void ProcessUpdateBatch(span<Position<Bond> > data) override {b_historical_data.SetPersistKeys(data);}
 };
 
-void BondPositionHistoricalConnector::Publish(pair<string, Position<Bond> > &data){
-    ofstream oFile;
-    oFile.open("./Output/Historical/position.txt", ios_base::app);//open the file to append
-    string k=data.first;
-    oFile << data.first << ",";
-    oFile << data.second.GetProduct().GetProductId() << ",";
-    oFile << to_string(data.second.GetAggregatePosition()) << ",";
+// Everything on a line after its key
+void BondPositionHistoricalConnector::Format(LogLine& line, Position<Bond> &position){
+    line << position.GetProduct().GetProductId() << ',';
+    line << position.GetAggregatePosition() << ',';
     string book="TRSY1";
-    oFile << to_string(data.second.GetPosition(book)) << ",";
+    line << position.GetPosition(book) << ',';
     book="TRSY2";
-    oFile << to_string(data.second.GetPosition(book)) << ",";
+    line << position.GetPosition(book) << ',';
     book="TRSY3";
-    oFile << to_string(data.second.GetPosition(book)) << "\n";
-    oFile.close();
+    line << position.GetPosition(book) << '\n';
+}
+
+void BondPositionHistoricalConnector::Publish(pair<string, Position<Bond> > &data){
+    LogLine line;
+    line << data.first << ',';
+    Format(line, data.second);
+    writer.Append(fileId, line);
+}
+
+// One record takes its slots in the writer's ring in one go, instead of one claim per line
+void BondPositionHistoricalConnector::Publish(long firstKey, span<Position<Bond> > data){
+    batch.clear();
+    for (auto & position : data) {
+        LogLine line;
+        line << firstKey++ << ',';
+        Format(line, position);
+        batch.append(line.Data(), line.Size());
+    }
+    writer.Append(fileId, batch.data(), batch.size());
 }
 
 class BondRiskRecord {
@@ -112,22 +150,22 @@ public:
 };
 
 class BondRiskHistoricalConnector: public Connector<BondRiskRecord> {
+private:
+    AsyncLogWriter& writer;
+    int fileId;
 public:
+    explicit BondRiskHistoricalConnector(AsyncLogWriter& _writer = AsyncLogWriter::Default()):
+        writer(_writer), fileId(_writer.Open("./Output/Historical/risk.txt")) {}
+
     void Publish(BondRiskRecord &data) override {
-        ofstream oFile;
-        oFile.open("./Output/Historical/risk.txt", ios_base::app);//open the file to append
-        oFile << data.persistKey << ",";
-        //get pv01
-        PV01<Bond> thepv01=data.b_pv01;
-        oFile << data.b_pv01.GetProduct().GetProductId() << ",";
-        //get pv01
-//        double pv01_d=thepv01.GetPV01();
-        oFile << to_string(data.b_pv01.GetQuantity()) << ",";
-        PV01<BucketedSector<Bond> > sector_pv01 = data.front_end;
-        oFile << to_string(sector_pv01.GetPV01()) << ",";
-        oFile << to_string(data.belly.GetPV01()) << ",";
-        oFile << to_string(data.long_end.GetPV01()) << "\n";
-        oFile.close();
+        LogLine line;
+        line << data.persistKey << ',';
+        line << data.b_pv01.GetProduct().GetProductId() << ',';
+        line << data.b_pv01.GetQuantity() << ',';
+        line.AppendFixed(data.front_end.GetPV01()) << ',';
+        line.AppendFixed(data.belly.GetPV01()) << ',';
+        line.AppendFixed(data.long_end.GetPV01()) << '\n';
+        writer.Append(fileId, line);
     }
 };
 
@@ -233,7 +271,13 @@ public:
 };
 
 class BondExecutionHistoricalConnector: public Connector<pair<string,ExecutionOrder<Bond> > > {
+private:
+    AsyncLogWriter& writer;
+    int fileId;
 public:
+    explicit BondExecutionHistoricalConnector(AsyncLogWriter& _writer = AsyncLogWriter::Default()):
+        writer(_writer), fileId(_writer.Open("./Output/Historical/executions.txt")) {}
+
     void Publish(pair<string, ExecutionOrder<Bond> > &data) override;
 };
 
@@ -281,53 +325,27 @@ public:
 };
 
 void BondExecutionHistoricalConnector::Publish(pair<string, ExecutionOrder<Bond> > &data){
-    ofstream oFile;
-    oFile.open("./Output/Historical/executions.txt", ios_base::app);//open the file to append
-    oFile << data.first << ",";
-//    ExecutionOrder<Bond> exe_order=data.second;//get the execution order
-    oFile << data.second.GetOrderId() << ",";//write orderid to file
-    oFile << data.second.GetProduct().GetProductId() << ",";//write cusip to file
-    PricingSide side=data.second.GetSide();//Get side
-    if(side==BID){
-        oFile << "BID,";//write side to file
-    } else{
-        oFile << "OFFER,";//write side to file
-    }
-    OrderType o_type = data.second.GetOrderType();//get order type
-    switch(o_type){
-        case FOK: oFile << "FOK,";
-            break;
-        case IOC: oFile << "IOC,";
-            break;
-        case MARKET: oFile << "MARKET,";
-            break;
-        case LIMIT: oFile << "LIMIT,";
-            break;
-        case STOP: oFile << "STOP,";
-            break;
-    }
-    oFile << to_string(data.second.GetVisibleQuantity()) << ",";//write to file
-    oFile << to_string(data.second.GetHiddenQuantity()) << ",";//write to file
-    double p=data.second.GetPrice();//get price
-    int part1=int(p);//get the integer part of price
-    double p2=p-double(part1);//get the decimal part of price
-    int part2=int(p2*32);//get part2 of price
-    double p3=p2-double(part2)/32;//get last part of price
-    int part3=round(p3*256);//get part3 of price
-    string p_str;//store the string of price
-    if(part2>=10){
-        p_str=to_string(part1)+"-"+to_string(part2)+to_string(part3);//construct price string
-    }
-    else{
-        p_str=to_string(part1)+"-"+"0"+to_string(part2)+to_string(part3);
-    }
-    oFile << p_str << "\n";//write to file
-    oFile.close();
+    LogLine line;
+    line << data.first << ',';
+    line << data.second.GetOrderId() << ',';//write orderid
+    line << data.second.GetProduct().GetProductId() << ',';//write cusip
+    line << (data.second.GetSide() == BID ? "BID," : "OFFER,");//write side
+    line << ToString(data.second.GetOrderType()) << ',';//write order type
+    line << data.second.GetVisibleQuantity() << ',';
+    line << data.second.GetHiddenQuantity() << ',';
+    line.AppendPrice(data.second.GetPrice()) << '\n';
+    writer.Append(fileId, line);
 }
 
 class BondIqHistoricalConnector: public Connector<pair<string,Inquiry<Bond> > >
 {
+private:
+    AsyncLogWriter& writer;
+    int fileId;
 public:
+    explicit BondIqHistoricalConnector(AsyncLogWriter& _writer = AsyncLogWriter::Default()):
+        writer(_writer), fileId(_writer.Open("./Output/Historical/allinquiries.txt")) {}
+
     // Publish data to the Connector
     virtual void Publish(pair<string, Inquiry<Bond> > &data);
 };
@@ -385,57 +403,52 @@ public:
     void ProcessAdd(Inquiry<Bond> &data) override{b_historical_data.SetPersistKey(data);}
 };
 
-void BondIqHistoricalConnector::Publish(pair<string, Inquiry<Bond> > &data1){
-    ofstream oFile;
-    oFile.open("./Output/Historical/allinquiries.txt", ios_base::app);//open the file to append
-    oFile << data1.first << ",";
-//    Inquiry<Bond> data=data1.second;//get price stream
-    oFile << data1.second.GetInquiryId() << ",";
-    oFile << data1.second.GetProduct().GetProductId() << ",";//write cusip to file
-    Side side=data1.second.GetSide();//get side
-    if(side == BUY){
-        oFile << "BUY,";
-    } else{
-        oFile << "SELL,";
-    }
-    oFile << to_string(data1.second.GetQuantity()) << ",";
-    oFile << PriceProcess(data1.second.GetPrice()) << ",";
-    InquiryState s=data1.second.GetState();//get inquiry state
-    switch(s){
-        case RECEIVED:
-            oFile << "RECEIVED\n"; break;
-        case QUOTED:
-            oFile << "QUOTED\n";break;
-        case REJECTED:
-            oFile << "REJECTED\n";break;
-        case CUSTOMER_REJECTED:
-            oFile << "CUSTOMER_REJECTED\n";break;
-        case DONE:
-            oFile << "DONE\n";break;
+// Get the text of an inquiry state
+string_view ToString(InquiryState state)
+{
+    switch(state){
+        case RECEIVED: return "RECEIVED";
+        case QUOTED: return "QUOTED";
+        case DONE: return "DONE";
+        case REJECTED: return "REJECTED";
+        case CUSTOMER_REJECTED: return "CUSTOMER_REJECTED";
     }
-    oFile.close();
+    return "";
+}
+
+void BondIqHistoricalConnector::Publish(pair<string, Inquiry<Bond> > &data1){
+    LogLine line;
+    line << data1.first << ',';
+    line << data1.second.GetInquiryId() << ',';
+    line << data1.second.GetProduct().GetProductId() << ',';//write cusip
+    line << (data1.second.GetSide() == BUY ? "BUY," : "SELL,");
+    line << data1.second.GetQuantity() << ',';
+    line.AppendPrice(data1.second.GetPrice()) << ',';
+    line << ToString(data1.second.GetState()) << '\n';
+    writer.Append(fileId, line);
 }
 
-class BondStreamHistoricalConnector: public Connector<pair<string,PriceStream<Bond> > > {
+class BondStreamHistoricalConnector final: public Connector<pair<string,PriceStream<Bond> > > {
+private:
+    AsyncLogWriter& writer;
+    int fileId;
 public:
+    explicit BondStreamHistoricalConnector(AsyncLogWriter& _writer = AsyncLogWriter::Default()):
+        writer(_writer), fileId(_writer.Open("./Output/Historical/streaming.txt")) {}
+
     void Publish(pair<string, PriceStream<Bond> > &data1) override {
-        ofstream oFile;
-        oFile.open("./Output/Historical/streaming.txt", ios_base::app);//open the file to append
-        oFile << data1.first << ",";
-        oFile << data1.second.GetProduct().GetProductId() << ",";
-        PriceStreamOrder bid_order=data1.second.GetBidOrder();//get bid order
-        oFile << PriceProcess(data1.second.GetBidOrder().GetPrice()) << ",";//write to file
-        oFile << to_string(bid_order.GetVisibleQuantity()) << ",";//write to file
-        oFile << to_string(bid_order.GetHiddenQuantity()) << ",";//write to file
-        PriceStreamOrder offer_order=data1.second.GetOfferOrder();//get offer order
-        oFile << PriceProcess(offer_order.GetPrice()) << ",";//write to file
-        oFile << to_string(offer_order.GetVisibleQuantity()) << ",";
-        oFile << to_string(offer_order.GetHiddenQuantity()) << "\n";
-        oFile.close();
+        LogLine line;
+        const PriceStreamOrder& bid_order=data1.second.GetBidOrder();//get bid order
+        const PriceStreamOrder& offer_order=data1.second.GetOfferOrder();//get offer order
+        line << data1.first << ',';
+        line << data1.second.GetProduct().GetProductId() << ',';
+        line.AppendPrice(bid_order.GetPrice()) << ',' << bid_order.GetVisibleQuantity() << ',' << bid_order.GetHiddenQuantity() << ',';
+        line.AppendPrice(offer_order.GetPrice()) << ',' << offer_order.GetVisibleQuantity() << ',' << offer_order.GetHiddenQuantity() << '\n';
+        writer.Append(fileId, line);
     }
 };
 
-class BondStreamHistoricalData: public HistoricalDataService<PriceStream<Bond> >
+class BondStreamHistoricalData final: public HistoricalDataService<PriceStream<Bond> >
 {
 private:
     int counter;
@@ -466,7 +479,7 @@ public:
     }
 };
 
-class BondStreamHistoricalListener: public ServiceListener<PriceStream<Bond> >
+class BondStreamHistoricalListener final: public ServiceListener<PriceStream<Bond> >
 {
 private:
     BondStreamHistoricalData& b_historical_data;
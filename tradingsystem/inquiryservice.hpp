@@ -9,13 +9,14 @@
 
 #include "soa.hpp"
 #include "tradebookingservice.hpp"
+#include "fractionalprice.hpp"
 
 // Various inqyury states
 enum InquiryState { RECEIVED, QUOTED, DONE, REJECTED, CUSTOMER_REJECTED };
 
 /**
  * Inquiry object modeling a customer inquiry from a client.
- * Type T is the product type.
+ * Type T is the product type; the product is referenced, not copied, and must outlive the inquiry.
  */
 template<typename T>
 class Inquiry
@@ -24,7 +25,7 @@ class Inquiry
 public:
 
   // ctor for an inquiry
-  Inquiry(string _inquiryId, const T &_product, Side _side, long _quantity, double _price, InquiryState _state);
+  Inquiry(string _inquiryId, const T &_product, Side _side, long _quantity, TickPrice _price, InquiryState _state);
 
   // Get the inquiry ID
   const string& GetInquiryId() const;
@@ -39,21 +40,21 @@ public:
   long GetQuantity() const;
 
   // Get the price that we have responded back with
-  double GetPrice() const;
+  TickPrice GetPrice() const;
 
   // Get the current state on the inquiry
   InquiryState GetState() const;
 
   void SetState(InquiryState _state) {state = _state;}
 
-  void SetPrice(double _price) {price = _price;}
+  void SetPrice(TickPrice _price) {price = _price;}
 
 private:
   string inquiryId;
-  T product;
+  const T* product;
   Side side;
   long quantity;
-  double price;
+  TickPrice price;
   InquiryState state;
 
 };
@@ -70,7 +71,7 @@ class InquiryService : public Service<string,Inquiry <T> >
 public:
 
   // Send a quote back to the client
-  virtual void SendQuote(const string &inquiryId, double price) = 0;
+  virtual void SendQuote(const string &inquiryId, TickPrice price) = 0;
 
   // Reject an inquiry from the client
   virtual void RejectInquiry(const string &inquiryId) = 0;
@@ -78,8 +79,8 @@ public:
 };
 
 template<typename T>
-Inquiry<T>::Inquiry(string _inquiryId, const T &_product, Side _side, long _quantity, double _price, InquiryState _state) :
-  product(_product)
+Inquiry<T>::Inquiry(string _inquiryId, const T &_product, Side _side, long _quantity, TickPrice _price, InquiryState _state) :
+  product(&_product)
 {
   inquiryId = _inquiryId;
   side = _side;
@@ -97,7 +98,7 @@ const string& Inquiry<T>::GetInquiryId() const
 template<typename T>
 const T& Inquiry<T>::GetProduct() const
 {
-  return product;
+  return *product;
 }
 
 template<typename T>
@@ -113,7 +114,7 @@ long Inquiry<T>::GetQuantity() const
 }
 
 template<typename T>
-double Inquiry<T>::GetPrice() const
+TickPrice Inquiry<T>::GetPrice() const
 {
   return price;
 }
@@ -155,8 +156,7 @@ public:
                 bondInquiryCache.insert(make_pair(iqId,data));//insert data
             }
             else{
-                bondInquiryCache.erase(iqId);//erase old record
-                bondInquiryCache.insert(make_pair(iqId,data));//insert data
+                it->second=data;//replace old record; data may be that record, as SendQuote passes it
             }
             for(auto & bondInquiryListener : bondInquiryListeners){
                 bondInquiryListener->ProcessAdd(data);
@@ -169,8 +169,7 @@ public:
                 bondInquiryCache.insert(make_pair(iqId,data));//insert data
             }
             else{
-                bondInquiryCache.erase(iqId);//erase old record
-                bondInquiryCache.insert(make_pair(iqId,data));//insert data
+                it->second=data;//replace old record; data may be that record, as SendQuote passes it
             }
         }
     }
@@ -183,7 +182,7 @@ public:
         return bondInquiryListeners;
     }
 
-    void SendQuote(const string& inquiryId, double price) override{
+    void SendQuote(const string& inquiryId, TickPrice price) override{
         auto it=bondInquiryCache.find(inquiryId);
         if(it==bondInquiryCache.end()){
             return;
@@ -205,49 +204,38 @@ void BondInquiryPublishConnector::SetPublish(Inquiry<Bond> &data, BondInquirySer
 class BondInquiryConnector: public Connector<Inquiry<Bond> >
 {
 private:
-    int counter;
+    StreamReader reader;
 public:
-    BondInquiryConnector(){counter=0;}
+    explicit BondInquiryConnector(const string& path = "./Input/inquiries.txt"):reader(path){}
 
     virtual void Publish(Inquiry<Bond> &data){}
 
-    virtual void Subscribe(BondInquiryService& b_inquire, map<string, Bond> m_bond) {
-        ifstream iFile;
-        iFile.open("./Input/inquiries.txt");
-        string line;
-        try{
-            for (int i = 0; i < counter; ++i)
-                getline(iFile,line);
-        } catch(...){
-            iFile.close();
-            return;
-        }
-        if (getline(iFile, line)) {
-            ++counter;
-            stringstream sStream(line);
-            string tmp;
-            vector<string> data;
-            while (getline(sStream, tmp, ',')) {
-                data.push_back(tmp);
-            }
-            string inquireId = data[0];
-            string bondId = data[1];
-            Side side = data[2]=="SELL"?SELL:BUY;
-            long qty=stol(data[3]);//get quantity
-            int index = 0;
-            for (; index < data[4].size(); ++index) {
-                if (data[4][index] == '-')
-                    break;
-            }
-            double bid1 = stod(data[4].substr(0, index));
-            string bid_string = data[4].substr(index + 1);
-            bid1 += (bid_string[2]=='+')?0.:(stoi(bid_string.substr(2)) / 256.);
-            bid1 += stod(bid_string.substr(0, 2)) / 32.;
-            Bond bnd=m_bond[bondId];
-            Inquiry<Bond> iq_bnd(inquireId,bnd,side,qty,bid1,RECEIVED);
-            b_inquire.OnMessage(iq_bnd);
-        }
-        iFile.close();
+    // Push the next inquiry in the file to the service; returns false once the file is exhausted
+    virtual bool Subscribe(BondInquiryService& b_inquire, const ProductRegistry& registry) {
+        string_view line;
+        if (!reader.NextLine(line))
+            return false;
+        string_view data[5];
+        if (SplitFields(line, data, 5) < 5)
+            return true;
+        ProductHandle handle = registry.Find(data[1]);
+        if (handle == ProductRegistry::NOT_FOUND)
+            return true;
+        string inquireId(data[0]);
+        Side side = data[2]=="SELL"?SELL:BUY;
+        long qty=ParseLong(data[3]);//get quantity
+        TickPrice bid1 = ParseTickPrice(data[4]);
+        Inquiry<Bond> iq_bnd(inquireId,registry.GetBond(handle),side,qty,bid1,RECEIVED);
+        b_inquire.OnMessage(iq_bnd);
+        return true;
+    }
+
+    // Push every remaining inquiry in the file to the service in one pass
+    long SubscribeAll(BondInquiryService& b_inquire, const ProductRegistry& registry) {
+        long count = 0;
+        while (Subscribe(b_inquire, registry))
+            ++count;
+        return count;
     }
 };
 
@@ -262,7 +250,7 @@ public:
 
     virtual void ProcessAdd(Inquiry<Bond> &data) {
         const string& inquiryId = data.GetInquiryId();
-        double price = 100;
+        TickPrice price = TickPrice::FromPoints(100);
         b_inquire.SendQuote(inquiryId, price);
     }
 
@@ -0,0 +1,166 @@
+/**
+ * latencyhistogram.hpp
+ * Defines a fixed-size log-linear histogram of latencies.
+ *
+ * Values below 8 have a bucket each; above that every power of two is split
+ * into 8 equal buckets, so a bucket is never wider than 1/8 of its lower
+ * bound. The buckets are one fixed array of counts: recording a value is a
+ * bit scan and an increment and never allocates, and percentiles are read
+ * off the counts to within a bucket.
+ */
+#ifndef LATENCY_HISTOGRAM_HPP
+#define LATENCY_HISTOGRAM_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <bit>
+#include <ostream>
+
+using namespace std;
+
+class LatencyHistogram
+{
+
+public:
+
+  // Buckets per power of two, as a number of bits
+  static const int SUB_BITS = 3;
+  static const int SUB_BUCKETS = 1 << SUB_BITS;
+  static const int BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+  // ctor for an empty histogram
+  LatencyHistogram();
+
+  // Count one value
+  void Record(uint64_t value);
+
+  // Add another histogram's counts to this one
+  void Merge(const LatencyHistogram &other);
+
+  // Forget every value
+  void Reset();
+
+  // Get the number of values recorded
+  uint64_t GetCount() const;
+
+  // Get the largest value recorded
+  uint64_t GetMax() const;
+
+  // Get the mean of the values recorded
+  double GetMean() const;
+
+  // Get the value at or below which a share q of the values fall, to within a bucket
+  uint64_t GetPercentile(double q) const;
+
+  // Write one line per non-empty bucket: its lowest and highest value and its count
+  void Print(ostream &output) const;
+
+private:
+  static int BucketOf(uint64_t value);
+  static uint64_t LowestOf(int bucket);
+  static uint64_t HighestOf(int bucket);
+
+  uint64_t counts[BUCKETS];
+  uint64_t count;
+  uint64_t max;
+  double sum;
+
+};
+
+LatencyHistogram::LatencyHistogram()
+{
+  Reset();
+}
+
+int LatencyHistogram::BucketOf(uint64_t value)
+{
+  if (value < SUB_BUCKETS)
+    return int(value);
+  int shift = int(bit_width(value)) - 1 - SUB_BITS;
+  return (shift + 1) * SUB_BUCKETS + int((value >> shift) & (SUB_BUCKETS - 1));
+}
+
+uint64_t LatencyHistogram::LowestOf(int bucket)
+{
+  if (bucket < SUB_BUCKETS)
+    return uint64_t(bucket);
+  int shift = bucket / SUB_BUCKETS - 1;
+  return uint64_t(SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+}
+
+uint64_t LatencyHistogram::HighestOf(int bucket)
+{
+  if (bucket < SUB_BUCKETS)
+    return uint64_t(bucket);
+  return LowestOf(bucket) + (uint64_t(1) << (bucket / SUB_BUCKETS - 1)) - 1;
+}
+
+void LatencyHistogram::Record(uint64_t value)
+{
+  ++counts[BucketOf(value)];
+  ++count;
+  sum += double(value);
+  if (value > max)
+    max = value;
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram &other)
+{
+  for (int b = 0; b < BUCKETS; ++b)
+    counts[b] += other.counts[b];
+  count += other.count;
+  sum += other.sum;
+  if (other.max > max)
+    max = other.max;
+}
+
+void LatencyHistogram::Reset()
+{
+  for (int b = 0; b < BUCKETS; ++b)
+    counts[b] = 0;
+  count = 0;
+  max = 0;
+  sum = 0;
+}
+
+uint64_t LatencyHistogram::GetCount() const
+{
+  return count;
+}
+
+uint64_t LatencyHistogram::GetMax() const
+{
+  return max;
+}
+
+double LatencyHistogram::GetMean() const
+{
+  return (count == 0) ? 0. : sum / double(count);
+}
+
+// The highest value of the bucket holding the value of that rank, but never above the maximum
+uint64_t LatencyHistogram::GetPercentile(double q) const
+{
+  if (count == 0)
+    return 0;
+  uint64_t rank = uint64_t(q * double(count) + 0.5);
+  if (rank < 1)
+    rank = 1;
+  uint64_t seen = 0;
+  for (int b = 0; b < BUCKETS; ++b) {
+    seen += counts[b];
+    if (seen >= rank)
+      return (HighestOf(b) < max) ? HighestOf(b) : max;
+  }
+  return max;
+}
+
+void LatencyHistogram::Print(ostream &output) const
+{
+  for (int b = 0; b < BUCKETS; ++b) {
+    if (counts[b] > 0)
+      output << LowestOf(b) << '-' << HighestOf(b) << ',' << counts[b] << '\n';
+  }
+}
+
+#endif
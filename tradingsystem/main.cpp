@@ -1,12 +1,21 @@
 
 #include <iostream>
 #include <memory>
+#include <algorithm>
+#include "productregistry.hpp"
 #include "tradebookingservice.hpp"
 #include "positionservice.hpp"
 #include "pricingservice.hpp"
 #include "riskservice.hpp"
 #include "marketdataservice.hpp"
 #include "executionservice.hpp"
+#include "matchingengine.hpp"
+#include "algoslicer.hpp"
+#include "pretraderisk.hpp"
+#include "orderthrottle.hpp"
+#include "servicebus.hpp"
+#include "pipelinerunner.hpp"
+#include "staticpipeline.hpp"
 #include "streamingservice.hpp"
 #include "inquiryservice.hpp"
 #include "historicaldataservice.hpp"
@@ -15,25 +24,14 @@ using namespace std;
 
 int main() {
     int numOftrades=18, numofprice=36, numofmarket=36, numofiq=36;
-    map<string, Bond> m_bond;
-    ifstream iFile("./Input/bonds.txt");//construct input file
-    string line;//store each read line
-    while(getline(iFile, line)){
-        stringstream sStream(line);
-        string tmp;
-        vector<string> data;
-        while (getline(sStream, tmp, ',')) {
-            data.push_back(tmp);
-        }
-        date maturity(from_simple_string(data[3]));//get maturity
-        Bond bond(data[0],CUSIP,data[2],stof(data[1]),maturity);//construct bond
-        m_bond.insert(std::make_pair(data[0],bond));//add this entry to m_bond
-    }
+    //intern every bond into a dense product handle
+    ProductRegistry registry("./Input/bonds.txt");
     vector<string> bids; //store bond ids
     map<string, double> m_bond_pv01;
-    for(auto & it : m_bond){
-        bids.push_back(it.first);//push bond ids to bids
+    for(auto & bond : registry.GetBonds()){
+        bids.push_back(bond.GetProductId());//push bond ids to bids
     }
+    sort(bids.begin(), bids.end());
     //assign reasonable values as pv01
     m_bond_pv01[bids[0]]=0.295;
     m_bond_pv01[bids[1]]=0.102;
@@ -42,12 +40,12 @@ int main() {
     m_bond_pv01[bids[4]]=0.0707;
     m_bond_pv01[bids[5]]=0.0455;
     m_bond_pv01[bids[6]]=0.0235;
-    PV01<Bond> temp(m_bond[bids[0]],0,0);
+    PV01<Bond> temp(registry.GetBond(registry.Find(bids[0])),0,0);
     //configure services, listeners, etc and link them together
     BondTradeBookService bt_service;//construct trade book service
     BondTradeBookingConnector bt_connector; //construct trade book connector
-    BondPositionService bposition; //construct bond position service
-    BondRiskService bndrisk(m_bond_pv01, m_bond); //construct bond risk service
+    BondPositionService bposition(registry); //construct bond position service
+    BondRiskService bndrisk(m_bond_pv01, registry); //construct bond risk service
     BondRiskHistoricalConnector b_risk_connector; //construct bond risk historical data connector
     BondRiskHistoricalData b_risk_data(b_risk_connector); //construct bond risk historical data service
     //and link with corresponding connector
@@ -66,76 +64,106 @@ int main() {
     auto bp_his_listener= make_shared<BondPositionHistoricalListener>(bp_his_data);
     //construct bond position listener and link with risk service
     auto bnd_pos_listener= make_shared<BondPositionServiceListener>(bndrisk) ;
+    //run risk on its own thread, behind a queue the position service hands its positions to
+    ServiceBus bus;
+    AsyncListener<Position<Bond> > b_risk_queue(*bnd_pos_listener);
+    bus.Add("positions->risk", b_risk_queue);
     //add positionlisteners to bond position service
-    bposition.AddListener(bnd_pos_listener.get());
+    bposition.AddListener(&b_risk_queue);
     bposition.AddListener(bp_his_listener.get());
     //construct trade listener and link with bond position service
     auto ptr_bt_listen= make_shared<BondTradeListener>(bposition);
     //add trade listener to tradebooking service
     bt_service.AddListener(ptr_bt_listen.get());
-    //flow trade data to trade book connector, no more than 60
-    for(int i=0;i<numOftrades;++i){
-        bt_connector.Subscribe(bt_service, m_bond);
-    }
     //construct bond price service
-    BondPriceService bp_service;
+    BondPriceService bp_service(registry);
     //construct price connector
     BondPriceConnector bp_connector;
     //construct bond algo stream service
-    BondAlgoStreamingService b_algo_stream;
-    //construct bond price listener and link with algo stream service
-    auto b_price_listener= make_shared<BondPriceListener>(b_algo_stream);
-    //add bond price listener to bond price serivce
-    bp_service.AddListener(b_price_listener.get());
+    BondAlgoStreamingService b_algo_stream(registry);
     //construct bond stream service
-    BondStreamingService b_stream_service;
+    BondStreamingService b_stream_service(registry);
     //construct bond stream connector for historical data
     BondStreamHistoricalConnector b_stream_connect;
     //construct bond stream historical service and link with connector
     BondStreamHistoricalData b_stream_data(b_stream_connect);
     //construct bond stream listener for historical data service and link with bond stream historical service
-    auto b_stream_listen= make_shared<BondStreamHistoricalListener>(b_stream_data);
-    //add listener to bond stream service
-    b_stream_service.AddListener(b_stream_listen.get());
-    //construct bond algo stream listener and link with bond stream service
-    auto b_algo_stream_listener = make_shared<BondAlgoStreamListener>(b_stream_service);
-    //add bond algo stream listener to bond algo stream service
-    b_algo_stream.AddListener(b_algo_stream_listener.get() );
-    //flow price data to bond price connector
-    for(int i=1;i<=numofprice;++i){
-        bp_connector.Subscribe(bp_service,m_bond);
-    }
+    BondStreamHistoricalListener b_stream_listen(b_stream_data);
+    //wire quoting, algo streaming, streaming and stream history at compile time, so a price runs through them as one call chain
+    StaticPipeline b_stream_pipeline(BondQuoteStage{}, BondAlgoStreamStage(b_algo_stream), BondStreamStage(b_stream_service),
+        ListenerStage<BondStreamHistoricalListener>(b_stream_listen));
+    PipelineListener<Price<Bond>, decltype(b_stream_pipeline)> b_price_listener(b_stream_pipeline);
+    //run algo streaming on its own thread, behind a queue the price service hands its prices to
+    AsyncListener<Price<Bond> > b_price_queue(b_price_listener);
+    bus.Add("prices->algo streaming", b_price_queue);
+    //add bond price listener to bond price serivce
+    bp_service.AddListener(&b_price_queue);
     //test the update pv01 function
     bndrisk.UpdateBondPV01(bids[2],0.03);
     //construct bond execution service
-    BondExecutionService b_exe_service;
+    BondExecutionService b_exe_service(registry);
     //construct bond execution connector for historical data
     BondExecutionHistoricalConnector b_exe_connect;
     //construct bond execution historical data service and link with connector
     BondExecutionHistoricalData b_exe_data(b_exe_connect);
     //construct bond executionorder listener and link with bond execution historical data service
     auto b_exe_listen= make_shared<BondExecutionHistoricalListener>(b_exe_data);
-    //construct bond algoexecution listener and link with bond execution service
-    auto b_algo_listener= make_shared<BondAlgoExecutionListener>(b_exe_service);
+    //construct market data service
+    BondMarketDataService bm_ds(registry);
+    //construct the smart order router over the market data's venue books
+    BondSmartOrderRouter b_router(bm_ds);
+    //construct bond algoexecution listener and link with bond execution service and the router it routes through
+    auto b_algo_listener= make_shared<BondAlgoExecutionListener>(b_exe_service, b_router);
     //add bond execution listener to bond execution service
     b_exe_service.AddListener(b_exe_listen.get());
-    //construct market data service
-    BondMarketDataService bm_ds;
     //construct bond algo execution service
-    BondAlgoExecutionService b_algo_exe;
+    BondAlgoExecutionService b_algo_exe(registry);
     //add algo listener to bond algo execution service
     b_algo_exe.AddListener(b_algo_listener.get());
     //construct bond market data listener and link with bond algo execution service
     auto b_mkt_listener= make_shared<BondMarketDataListeners>(b_algo_exe) ;
     //add bond market data listener to market data service
     bm_ds.AddListener(b_mkt_listener.get());
+    //construct the simulated venues and match every order sent to them
+    BondExchangeSimulator b_exchange(registry);
+    b_exe_service.AddListener(&b_exchange);
+    //construct the slicing service for parent orders; its children are routed like the algo's orders
+    BondAlgoSlicingService b_slicer(registry);
+    b_slicer.AddListener(b_algo_listener.get());
+    BondAlgoSliceReportListener b_slice_reports(b_slicer);
+    b_exchange.AddListener(&b_slice_reports);
+    BondAlgoOrderReportListener b_order_reports(b_algo_exe);
+    b_exchange.AddListener(&b_order_reports);
+    //book the venues' fills as trades once each order has been matched; the trades feed's thread books them,
+    //taking them off a queue the market data feed's thread hands them to
+    BondTradeBatchBooker b_booker(bt_service, bposition);
+    LinkQueue<vector<Trade<Bond> > > b_fill_link;
+    bus.Add("fills->positions", b_fill_link);
+    BondFillBookingListener b_fill_booking(b_fill_link);
+    b_exchange.AddListener(&b_fill_booking);
+    b_exe_service.AddListener(&b_fill_booking);
+    //check every order against size, position, bucket PV01 and venue message rate limits before it is sent
+    BondPreTradeRiskGate b_risk_gate(registry, bposition, bndrisk, RiskLimits{25000000, 50000000, 10000, 1000000000});
+    const vector<Bond>& bonds = registry.GetBonds();//listed by maturity
+    b_risk_gate.AddBucket(BucketedSector<Bond>(vector<Bond>(bonds.begin(), bonds.begin() + 2), "FrontEnd"), 10000000.);
+    b_risk_gate.AddBucket(BucketedSector<Bond>(vector<Bond>(bonds.begin() + 2, bonds.begin() + 5), "Belly"), 10000000.);
+    b_risk_gate.AddBucket(BucketedSector<Bond>(vector<Bond>(bonds.begin() + 5, bonds.end()), "LongEnd"), 10000000.);
+    bposition.AddListener(&b_risk_gate);
+    bndrisk.AddListener(&b_risk_gate);
+    b_risk_gate.AddListener(&b_slice_reports);
+    b_risk_gate.AddListener(&b_order_reports);
+    b_exe_service.AddPreTradeCheck(&b_risk_gate);
+    //throttle each venue and product to 2000 orders a second in bursts of 20, holding an order up to 1ms before rejecting it
+    BondOrderThrottle b_throttle(registry, b_exe_service, 2000., 20, THROTTLE_QUEUE);
+    b_throttle.AddListener(&b_slice_reports);
+    b_throttle.AddListener(&b_order_reports);
+    b_exe_service.AddPreTradeCheck(&b_throttle);
+    //seed each venue with the depth market data shows on it
+    BondVenueDepthListener b_depth(b_exchange);
+    bm_ds.AddListener(&b_depth);
 
     //construct bond market data connector
     BondMarketDataConnector bm_connect;
-    //flow market data to bond market data service
-    for(int i=0;i<numofmarket;++i){
-        bm_connect.Subscribe(bm_ds,m_bond);
-    }
     //construct inquiry connector for publish
     BondInquiryPublishConnector b_publish;
     //construct inquiry connector for historical data
@@ -153,9 +181,54 @@ int main() {
     b_inquire.AddListener(b_iq_listen.get());
     //construct bond inquiry connector
     BondInquiryConnector b_iq_connect;
+
+    //run each feed through its own services on its own thread
+    PipelineRunner runner;
+    //flow trade data to trade book connector, no more than 60, then book the fills market data brings
+    runner.Add("trades", [&] {
+        long events = 0;
+        for(int i=0;i<numOftrades;++i){
+            if (bt_connector.Subscribe(bt_service, registry))
+                ++events;
+        }
+        return events + long(b_fill_link.Pump(b_booker));
+    });
+    //flow price data to bond price connector
+    runner.Add("prices", [&] {
+        long events = 0;
+        for(int i=1;i<=numofprice;++i){
+            if (bp_connector.Subscribe(bp_service,registry))
+                ++events;
+        }
+        return events;
+    });
+    //flow market data to bond market data service, then send the orders the throttle still holds as they come due
+    runner.Add("market data", [&] {
+        long events = 0;
+        for(int i=0;i<numofmarket;++i){
+            if (bm_connect.Subscribe(bm_ds,registry))
+                ++events;
+        }
+        while (b_throttle.GetHeldCount() > 0)
+            b_throttle.Release(CycleClock::Now());
+        b_fill_link.Close();
+        return events;
+    });
     //flow data into bond inquiry service, no more than 60
-    for(int i=0;i<numofiq;++i){
-        b_iq_connect.Subscribe(b_inquire,m_bond);
-    }
+    runner.Add("inquiries", [&] {
+        long events = 0;
+        for(int i=0;i<numofiq;++i){
+            if (b_iq_connect.Subscribe(b_inquire,registry))
+                ++events;
+        }
+        return events;
+    });
+    runner.Run();
+    bus.StopAll();
+    runner.Report(cout);
+    bus.Report(cout);
+    const LatencyHistogram& checks = b_risk_gate.GetLatency();
+    cout << "pre-trade checks: " << checks.GetCount() << " (" << b_risk_gate.GetCount(RISK_PASSED) << " passed)"
+         << ", p50 " << checks.GetPercentile(0.5) << "ns, p99 " << checks.GetPercentile(0.99) << "ns, max " << checks.GetMax() << "ns" << endl;
     return 0;
 }
\ No newline at end of file
@@ -11,14 +11,21 @@
 #include <vector>
 #include "soa.hpp"
 #include "products.hpp"
+#include "streamreader.hpp"
+#include "productregistry.hpp"
+#include "fractionalprice.hpp"
+#include "flatorderbook.hpp"
 #include <map>
 #include <fstream>
 #include <sstream>
 
 using namespace std;
 
-// Side for market data
-enum PricingSide { BID, OFFER };
+// Venue for market data and execution
+enum Market { BROKERTEC, ESPEED, CME };
+
+// Number of venues
+const int MARKET_COUNT = 3;
 
 /**
  * A market data order with price, quantity, and side.
@@ -29,10 +36,10 @@ class Order
 public:
 
   // ctor for an order
-  Order(double _price, long _quantity, PricingSide _side);
+  Order(TickPrice _price, long _quantity, PricingSide _side);
 
   // Get the price on the order
-  double GetPrice() const;
+  TickPrice GetPrice() const;
 
   // Get the quantity on the order
   long GetQuantity() const;
@@ -41,7 +48,7 @@ public:
   PricingSide GetSide() const;
 
 private:
-  double price;
+  TickPrice price;
   long quantity;
   PricingSide side;
 
@@ -72,7 +79,7 @@ private:
 
 /**
  * Order book with a bid and offer stack.
- * Type T is the product type.
+ * Type T is the product type; the product is referenced, not copied, and must outlive the book.
  */
 template<typename T>
 class OrderBook
@@ -92,17 +99,105 @@ public:
   // Get the offer stack
   const vector<Order>& GetOfferStack() const;
 
+  // Get the stacks for refilling in place
+  vector<Order>& GetBidStack() {return bidStack;}
+  vector<Order>& GetOfferStack() {return offerStack;}
+
   void SetBidStack(const vector<Order>& offer) {bidStack = offer;}
 
   void SetOfferStack(const vector<Order>& offer) {offerStack = offer;}
 
 private:
-  T product;
+  const T* product;
   vector<Order> bidStack;
   vector<Order> offerStack;
 
 };
 
+/**
+ * The best bid and offer of a product's book.
+ * Type T is the product type; the product is referenced, not copied, and must outlive the record.
+ */
+template<typename T>
+class TopOfBook
+{
+
+public:
+
+  // ctor for a top of book
+  TopOfBook(const T &_product, const Order &_bidOrder, const Order &_offerOrder, Market _bidVenue, Market _offerVenue);
+
+  // Get the product
+  const T& GetProduct() const;
+
+  // Get the best bid order; a zero order when there are no bids
+  const Order& GetBidOrder() const;
+
+  // Get the best offer order; a zero order when there are no offers
+  const Order& GetOfferOrder() const;
+
+  // Get the venue showing the most quantity at the best bid
+  Market GetBidVenue() const;
+
+  // Get the venue showing the most quantity at the best offer
+  Market GetOfferVenue() const;
+
+  // Set the best bid and offer; returns false if nothing changed
+  bool Set(const Order &_bidOrder, const Order &_offerOrder, Market _bidVenue, Market _offerVenue);
+
+private:
+  const T* product;
+  Order bidOrder;
+  Order offerOrder;
+  Market bidVenue;
+  Market offerVenue;
+
+};
+
+// Kind of change to an aggregated price level
+enum DeltaAction { ADD_LEVEL, MODIFY_LEVEL, DELETE_LEVEL };
+
+/**
+ * A change to one aggregated price level of an order book.
+ * Type T is the product type; the product is referenced, not copied, and must outlive the delta.
+ */
+template<typename T>
+class BookDelta
+{
+
+public:
+
+  // ctor for a delta
+  BookDelta(const T &_product, Market _venue, DeltaAction _action, PricingSide _side, TickPrice _price, long _quantity);
+
+  // Get the product
+  const T& GetProduct() const;
+
+  // Get the venue whose book changed
+  Market GetVenue() const;
+
+  // Get the kind of change
+  DeltaAction GetAction() const;
+
+  // Get the side of the level
+  PricingSide GetSide() const;
+
+  // Get the price of the level
+  TickPrice GetPrice() const;
+
+  // Get the new aggregate quantity at the level; 0 for a delete
+  long GetQuantity() const;
+
+private:
+  const T* product;
+  Market venue;
+  DeltaAction action;
+  PricingSide side;
+  TickPrice price;
+  long quantity;
+
+};
+
 /**
  * Market Data Service which distributes market data
  * Keyed on product identifier.
@@ -120,167 +215,427 @@ public:
   // Aggregate the order book
   virtual const OrderBook<T>& AggregateDepth(const string &productId) = 0;
 
+  // Apply a single level change to a venue's book
+  virtual void OnDelta(BookDelta<T> &delta) = 0;
+
 };
 
+// Get the text of a market
+string_view ToString(Market market)
+{
+    switch(market){
+        case BROKERTEC: return "BROKERTEC";
+        case ESPEED: return "ESPEED";
+        case CME: return "CME";
+    }
+    return "";
+}
+
+// Parse a venue name; returns false if it is not a known venue
+bool ParseMarket(string_view text, Market &market)
+{
+    for (int i = 0; i < MARKET_COUNT; ++i) {
+        if (text == ToString(Market(i))) {
+            market = Market(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Are two orders at the same price for the same quantity?
+bool SameLevel(const Order &lhs, const Order &rhs)
+{
+  return lhs.GetPrice() == rhs.GetPrice() && lhs.GetQuantity() == rhs.GetQuantity();
+}
+
 /**
- * Bond Market Data Service which distributes bond market data
+ * Bond Market Data Service which distributes bond market data.
+ * Every venue's depth for a product is aggregated into its own FlatOrderBook,
+ * and a consolidated FlatOrderBook per product is kept as their sum: a venue
+ * level change adjusts the consolidated level by the difference, so the cost
+ * per change does not grow with the number of venues. When a venue book
+ * slides its window and drops levels, or a level falls outside the
+ * consolidated window, the consolidated book is rebuilt from the venue books
+ * around the touch across the venues instead, and the top of book is read
+ * again; venue levels outside its window are left out of it until the market
+ * comes back to them. The OrderBook handed
+ * out is a view of the consolidated ladder, refilled in place so it is served
+ * without allocation, and GetVenueQuantity attributes any consolidated level
+ * to the venues showing it.
+ * Full snapshots go to the OrderBook listeners; level deltas are applied in
+ * O(1) and go to the BookDelta listeners, with a snapshot available on demand
+ * through GetData. A snapshot is also passed on as the deltas it implies.
+ * A top of book record per product is kept current and goes to the TopOfBook
+ * listeners only when the best bid or offer changes.
  */
 class BondMarketDataService: public MarketDataService<Bond> {
 private:
-    multimap<string, OrderBook<Bond> > bondOrderBooks;
+    const ProductRegistry& registry;
+    vector<FlatOrderBook> bondBooks; // consolidated, indexed by product handle
+    vector<FlatOrderBook> venueBooks; // indexed by product handle * MARKET_COUNT + venue
+    vector<OrderBook<Bond> > bondViews; // indexed by product handle
     vector< ServiceListener<OrderBook<Bond> >* > bondListeners;
-public:
-    BidOffer GetBestBidOffer(const string &productId) override {
-        const OrderBook<Bond>& orderBook = AggregateDepth(productId);
-        const vector<Order>& bids = orderBook.GetBidStack();
-        const vector<Order>& offers = orderBook.GetOfferStack();
-        double bid1 = bids[0].GetPrice();
-        double offer1 = offers[0].GetPrice();
-        int bid_i = 0, offer_i = 0;
-        for (int i = 1; i < bids.size(); ++i){
-            double tmp = bids[i].GetPrice();
-            if (tmp > bid1){
-                bid1 = tmp;
-                bid_i = i;
-            }
+    vector<TopOfBook<Bond> > bondTops; // indexed by product handle
+    vector< ServiceListener<BookDelta<Bond> >* > bondDeltaListeners;
+    vector< ServiceListener<TopOfBook<Bond> >* > bondTopListeners;
+    FlatOrderBook snapshot; // scratch for diffing a snapshot against the venue's book
+    vector<Order> staleLevels; // scratch for the levels a snapshot removes
+
+    FlatOrderBook& VenueBook(ProductHandle handle, Market venue) {
+        return venueBooks[size_t(handle) * MARKET_COUNT + venue];
+    }
+
+    // Set a venue level and move the consolidated level by the same amount, or rebuild the
+    // consolidated book if either window has to slide; returns whether it was rebuilt
+    bool SetVenueLevel(ProductHandle handle, Market venue, PricingSide side, TickPrice price, long quantity) {
+        FlatOrderBook& book = VenueBook(handle, venue);
+        FlatOrderBook& consolidated = bondBooks[handle];
+        long before = book.GetQuantity(side, price);
+        bool dropped = false;
+        book.SetLevel(side, price, quantity, [&dropped](PricingSide, TickPrice, long) {dropped = true;});
+        long after = book.GetQuantity(side, price);
+        if (dropped || (after > 0 && !consolidated.Contains(price))) {
+            Resync(handle, price);
+            return true;
         }
-        for (int i = 1; i < offers.size(); ++i){
-            double tmp = offers[i].GetPrice();
-            if (tmp < offer1){
-                offer1 = tmp;
-                offer_i = i;
+        consolidated.AddQuantity(side, price, after - before);
+        return false;
+    }
+
+    // Get the mid of the best bid and offer across the venues; price if no venue shows either side
+    TickPrice VenueTouch(ProductHandle handle, TickPrice price) {
+        bool hasBid = false, hasOffer = false;
+        TickPrice bid, offer;
+        for (int v = 0; v < MARKET_COUNT; ++v) {
+            const FlatOrderBook& book = VenueBook(handle, Market(v));
+            if (book.HasLevels(BID) && (!hasBid || book.GetBest(BID) > bid)) {
+                bid = book.GetBest(BID);
+                hasBid = true;
+            }
+            if (book.HasLevels(OFFER) && (!hasOffer || book.GetBest(OFFER) < offer)) {
+                offer = book.GetBest(OFFER);
+                hasOffer = true;
             }
         }
-        return {bids[bid_i],offers[offer_i]};
+        if (hasBid && hasOffer)
+            return Midpoint(bid, offer);
+        return hasBid ? bid : hasOffer ? offer : price;
     }
 
+    // Rebuild the consolidated book as the sum of the venue books, in a window centred on the
+    // touch across the venues, so a deep level far from it cannot push the best levels out
+    void Resync(ProductHandle handle, TickPrice price) {
+        FlatOrderBook& consolidated = bondBooks[handle];
+        consolidated.Clear(VenueTouch(handle, price));
+        for (int v = 0; v < MARKET_COUNT; ++v) {
+            for (PricingSide side : {BID, OFFER}) {
+                VenueBook(handle, Market(v)).ForEachLevel(side, SIZE_MAX, [&consolidated, side](TickPrice level, long quantity) {
+                    if (consolidated.Contains(level))
+                        consolidated.AddQuantity(side, level, quantity);
+                });
+            }
+        }
+    }
 
-    const OrderBook<Bond>& AggregateDepth(const string &productId) override {
-        pair<multimap<string, OrderBook<Bond> >::iterator, multimap<string, OrderBook<Bond> >::iterator> range = bondOrderBooks.equal_range(productId);
-        const Bond& product = range.first->second.GetProduct();
-        map<double, long> bid_result;
-        map<double, long> offer_result;
-        for(auto it = range.first; it != range.second; ++it){
-            vector<Order> bids = it->second.GetBidStack();
-            vector<Order> offers = it->second.GetOfferStack();
-            for(const auto & j : bids){
-                bid_result[j.GetPrice()] += j.GetQuantity();
+    // Get the venue showing the most quantity at a consolidated level
+    Market TopVenue(ProductHandle handle, PricingSide side, TickPrice price) {
+        Market best = BROKERTEC;
+        long bestQuantity = 0;
+        for (int v = 0; v < MARKET_COUNT; ++v) {
+            long quantity = VenueBook(handle, Market(v)).GetQuantity(side, price);
+            if (quantity > bestQuantity) {
+                best = Market(v);
+                bestQuantity = quantity;
             }
-            for(const auto & j : offers){
-                offer_result[j.GetPrice()] += j.GetQuantity();
+        }
+        return best;
+    }
+
+    // Apply a venue level change and pass it on; ADD_LEVEL reaches listeners as
+    // ProcessAdd, MODIFY_LEVEL as ProcessUpdate and DELETE_LEVEL as ProcessRemove.
+    // Returns whether the consolidated book was rebuilt.
+    bool ApplyDelta(ProductHandle handle, BookDelta<Bond> &delta) {
+        long quantity = (delta.GetAction() == DELETE_LEVEL) ? 0 : delta.GetQuantity();
+        bool rebuilt = SetVenueLevel(handle, delta.GetVenue(), delta.GetSide(), delta.GetPrice(), quantity);
+        for (auto& i: bondDeltaListeners) {
+            switch (delta.GetAction()) {
+            case ADD_LEVEL: i->ProcessAdd(delta); break;
+            case MODIFY_LEVEL: i->ProcessUpdate(delta); break;
+            case DELETE_LEVEL: i->ProcessRemove(delta); break;
             }
         }
-        vector<Order> bids(bid_result.size(), Order(0., 0, BID));
-        vector<Order> offers(offer_result.size(), Order(0., 0, OFFER));
-        int index = 0;
-        for (auto & i: bid_result) {
-            bids[index++] = Order(i.first, i.second, BID);
+        return rebuilt;
+    }
+
+    // Refill the product's view from its ladder, best level first
+    OrderBook<Bond>& RefreshView(ProductHandle handle) {
+        OrderBook<Bond>& view = bondViews.at(handle);
+        const FlatOrderBook& book = bondBooks[handle];
+        vector<Order>& bids = view.GetBidStack();
+        vector<Order>& offers = view.GetOfferStack();
+        bids.clear();
+        offers.clear();
+        book.ForEachLevel(BID, SIZE_MAX, [&bids](TickPrice price, long quantity) {bids.emplace_back(price, quantity, BID);});
+        book.ForEachLevel(OFFER, SIZE_MAX, [&offers](TickPrice price, long quantity) {offers.emplace_back(price, quantity, OFFER);});
+        return view;
+    }
+
+    // Read the product's touch back from its ladder and notify if it moved
+    void RefreshTop(ProductHandle handle) {
+        const FlatOrderBook& book = bondBooks[handle];
+        Order bid(TickPrice(), 0, BID);
+        Order offer(TickPrice(), 0, OFFER);
+        Market bidVenue = BROKERTEC, offerVenue = BROKERTEC;
+        if (book.HasLevels(BID)) {
+            bid = Order(book.GetBest(BID), book.GetQuantity(BID, book.GetBest(BID)), BID);
+            bidVenue = TopVenue(handle, BID, book.GetBest(BID));
+        }
+        if (book.HasLevels(OFFER)) {
+            offer = Order(book.GetBest(OFFER), book.GetQuantity(OFFER, book.GetBest(OFFER)), OFFER);
+            offerVenue = TopVenue(handle, OFFER, book.GetBest(OFFER));
+        }
+        TopOfBook<Bond>& top = bondTops[handle];
+        if (!top.Set(bid, offer, bidVenue, offerVenue))
+            return;
+        for (auto& i: bondTopListeners) {
+            i->ProcessUpdate(top);
         }
-        index = 0;
-        for (auto & i: offer_result) {
-            bids[index++] = Order(i.first, i.second, OFFER);
+    }
+
+public:
+    explicit BondMarketDataService(const ProductRegistry& _registry):
+        registry(_registry), bondBooks(_registry.Size()), venueBooks(_registry.Size() * MARKET_COUNT) {
+        bondViews.reserve(registry.Size());
+        bondTops.reserve(registry.Size());
+        for (const Bond& bond : registry.GetBonds()) {
+            bondViews.emplace_back(bond, vector<Order>(), vector<Order>());
+            bondTops.emplace_back(bond, Order(TickPrice(), 0, BID), Order(TickPrice(), 0, OFFER), BROKERTEC, BROKERTEC);
         }
-        OrderBook<Bond> result(product, bids, offers);
-        bondOrderBooks.erase(range.first, range.second);
-        bondOrderBooks.insert(make_pair(productId, result));
-        return bondOrderBooks.find(productId)->second;
+    }
+
+    // Get the best bid/offer order from the cached top of book; an empty side gives a zero order
+    BidOffer GetBestBidOffer(const string &productId) override {
+        const TopOfBook<Bond>& top = bondTops.at(registry.Find(productId));
+        return {top.GetBidOrder(), top.GetOfferOrder()};
+    }
+
+    // Get the cached top of book
+    const TopOfBook<Bond>& GetTopOfBook(const string &productId) {
+        return bondTops.at(registry.Find(productId));
+    }
+
+    // Get the quantity a venue shows at a consolidated price level
+    long GetVenueQuantity(const string &productId, Market venue, PricingSide side, TickPrice price) {
+        ProductHandle handle = registry.Find(productId);
+        if (handle == ProductRegistry::NOT_FOUND)
+            return 0;
+        return VenueBook(handle, venue).GetQuantity(side, price);
+    }
+
+    // Get the consolidated ladder of a registered product
+    const FlatOrderBook& GetConsolidatedBook(const Bond &product) {
+        return bondBooks.at(registry.HandleOf(product));
+    }
+
+    // Get one venue's ladder of a registered product
+    const FlatOrderBook& GetVenueBook(const Bond &product, Market venue) {
+        return venueBooks.at(size_t(registry.HandleOf(product)) * MARKET_COUNT + venue);
+    }
+
+    const OrderBook<Bond>& AggregateDepth(const string &productId) override {
+        return RefreshView(registry.Find(productId));
     }
 
     OrderBook<Bond>& GetData(string key) override{
-        AggregateDepth(key);
-        return bondOrderBooks.find(key)->second;
+        return RefreshView(registry.Find(key));
     }
 
+    // A snapshot without a venue is taken as BROKERTEC's
     void OnMessage(OrderBook<Bond> &data) override {
-        bondOrderBooks.insert(make_pair(data.GetProduct().GetProductId(),data));
-        auto& tmp = GetData(data.GetProduct().GetProductId());
+        OnMessage(data, BROKERTEC);
+    }
+
+    // A snapshot replaces the venue's book; orders at the same price are aggregated.
+    // The difference from the venue's previous book goes to the BookDelta listeners.
+    void OnMessage(OrderBook<Bond> &data, Market venue) {
+        const Bond& product = data.GetProduct();
+        ProductHandle handle = registry.HandleOf(product);
+        if (handle == ProductRegistry::NOT_FOUND)
+            return;
+        FlatOrderBook& book = VenueBook(handle, venue);
+        snapshot.Clear();
+        for (const Order& order : data.GetBidStack())
+            snapshot.AddQuantity(BID, order.GetPrice(), order.GetQuantity());
+        for (const Order& order : data.GetOfferStack())
+            snapshot.AddQuantity(OFFER, order.GetPrice(), order.GetQuantity());
+        staleLevels.clear();
+        for (PricingSide side : {BID, OFFER}) {
+            book.ForEachLevel(side, SIZE_MAX, [this, side](TickPrice price, long quantity) {
+                if (snapshot.GetQuantity(side, price) == 0)
+                    staleLevels.emplace_back(price, quantity, side);
+            });
+        }
+        for (const Order& level : staleLevels) {
+            BookDelta<Bond> delta(product, venue, DELETE_LEVEL, level.GetSide(), level.GetPrice(), 0);
+            ApplyDelta(handle, delta);
+        }
+        for (PricingSide side : {BID, OFFER}) {
+            snapshot.ForEachLevel(side, SIZE_MAX, [&, side](TickPrice price, long quantity) {
+                long before = book.GetQuantity(side, price);
+                if (before == quantity)
+                    return;
+                BookDelta<Bond> delta(product, venue, before == 0 ? ADD_LEVEL : MODIFY_LEVEL, side, price, quantity);
+                ApplyDelta(handle, delta);
+            });
+        }
+        OrderBook<Bond>& view = RefreshView(handle);
         for (auto& i: bondListeners) {
-            i->ProcessUpdate(tmp);
+            i->ProcessUpdate(view);
         }
+        RefreshTop(handle);
+    }
+
+    void OnDelta(BookDelta<Bond> &delta) override {
+        ProductHandle handle = registry.HandleOf(delta.GetProduct());
+        if (handle == ProductRegistry::NOT_FOUND)
+            return;
+        const FlatOrderBook& book = bondBooks[handle];
+        PricingSide side = delta.GetSide();
+        // only a level at or inside the touch, or a rebuild of the ladder, can move the top of book
+        bool atTouch = !book.HasLevels(side) ||
+            (side == BID ? delta.GetPrice() >= book.GetBest(BID) : delta.GetPrice() <= book.GetBest(OFFER));
+        if (ApplyDelta(handle, delta) || atTouch)
+            RefreshTop(handle);
     }
 
     void AddListener(ServiceListener<OrderBook<Bond> > *listener) override{
         bondListeners.push_back(listener);
     }
 
+    virtual void AddListener(ServiceListener<BookDelta<Bond> > *listener){
+        bondDeltaListeners.push_back(listener);
+    }
+
+    virtual void AddListener(ServiceListener<TopOfBook<Bond> > *listener){
+        bondTopListeners.push_back(listener);
+    }
+
     const vector< ServiceListener<OrderBook<Bond> >* >& GetListeners() const override{
         return bondListeners;
     }
 
 };
 
+/**
+ * Bond Market Data Connector reading five-deep books from a file of
+ * id,bid,offer[,venue] lines; a line without a venue is BROKERTEC's.
+ * In snapshot mode every line is pushed as a full OrderBook. In incremental
+ * mode each line is compared with the previous book for the same product and
+ * venue, and only the changed levels are pushed, as BookDelta records.
+ */
 class BondMarketDataConnector: public Connector<OrderBook<Bond> >
 {
 private:
-    int counter;
+    StreamReader reader;
+    bool incremental;
+    vector<Order> bidStack;
+    vector<Order> offerStack;
+    vector<vector<Order> > lastBids; // indexed by product handle * MARKET_COUNT + venue, incremental mode only
+    vector<vector<Order> > lastOffers;
+
+    // Push the level changes from before to after; both stacks are best first
+    static void PushDeltas(BondMarketDataService& service, const Bond& product, Market venue, PricingSide side,
+                           const vector<Order>& before, const vector<Order>& after) {
+        size_t i = 0, j = 0;
+        while (i < before.size() || j < after.size()) {
+            bool takeBefore = j == after.size() || (i < before.size() &&
+                (side == BID ? before[i].GetPrice() > after[j].GetPrice() : before[i].GetPrice() < after[j].GetPrice()));
+            if (takeBefore) {
+                BookDelta<Bond> delta(product, venue, DELETE_LEVEL, side, before[i].GetPrice(), 0);
+                service.OnDelta(delta);
+                ++i;
+            } else if (i == before.size() || before[i].GetPrice() != after[j].GetPrice()) {
+                BookDelta<Bond> delta(product, venue, ADD_LEVEL, side, after[j].GetPrice(), after[j].GetQuantity());
+                service.OnDelta(delta);
+                ++j;
+            } else {
+                if (before[i].GetQuantity() != after[j].GetQuantity()) {
+                    BookDelta<Bond> delta(product, venue, MODIFY_LEVEL, side, after[j].GetPrice(), after[j].GetQuantity());
+                    service.OnDelta(delta);
+                }
+                ++i;
+                ++j;
+            }
+        }
+    }
+
 public:
-    BondMarketDataConnector():counter(0) {}
+    explicit BondMarketDataConnector(const string& path = "./Input/marketdata.txt", bool _incremental = false):reader(path), incremental(_incremental) {}
 
     virtual void Publish(OrderBook<Bond> &data){}
 
-    virtual void Subscribe(BondMarketDataService& bondMarketDataService, map<string, Bond> bondMap) {
-        ifstream iFile;
-        iFile.open("./Input/marketdata.txt");
-        vector<Order> bidStack;
-        vector<Order> offerStack;
-        string line;
-        try{
-            for (int i = 0; i < counter; ++i)
-                getline(iFile,line);
-        } catch(...){
-            iFile.close();
-            return;
+    // Push the next order book in the file to the service; returns false once the file is exhausted
+    virtual bool Subscribe(BondMarketDataService& bondMarketDataService, const ProductRegistry& registry) {
+        string_view line;
+        if (!reader.NextLine(line))
+            return false;
+        string_view data[4];
+        size_t fields = SplitFields(line, data, 4);
+        if (fields < 3)
+            return true;
+        Market venue = BROKERTEC;
+        if (fields == 4 && !ParseMarket(data[3], venue))
+            return true;
+        ProductHandle handle = registry.Find(data[0]);
+        if (handle == ProductRegistry::NOT_FOUND)
+            return true;
+        TickPrice bid1 = ParseTickPrice(data[1]);
+        TickPrice offer1 = ParseTickPrice(data[2]);
+        long volume = 10000000;
+        bidStack.clear();
+        offerStack.clear();
+        for(int i=0;i<5;++i){
+            TickPrice bid = bid1 - TickPrice::FromTicks(i);
+            TickPrice offer = offer1 + TickPrice::FromTicks(i);
+            bidStack.emplace_back(bid, volume, BID);
+            offerStack.emplace_back(offer, volume, OFFER);
         }
-        if (getline(iFile, line)) {
-            ++counter;
-            stringstream sStream(line);
-            string tmp;
-            vector<string> data;
-            while (getline(sStream, tmp, ',')) {
-                data.push_back(tmp);
-            }
-            string bondId=data[0];
-            int index = 0;
-            for (; index < data[1].size(); ++index) {
-                if (data[1][index] == '-')
-                    break;
-            }
-            double bid1 = stod(data[1].substr(0, index));
-            string bid_string = data[1].substr(index + 1);
-            bid1 += (bid_string[2]=='+')?0.:(stoi(bid_string.substr(2)) / 256.);
-            bid1 += stod(bid_string.substr(0, 2)) / 32.;
-            index = 0;
-            for (; index < data[2].size(); ++index) {
-                if (data[2][index] == '-')
-                    break;
-            }
-            double offer1 = stod(data[2].substr(0, index));
-            string offer_string = data[2].substr(index + 1);
-            offer1 += (offer_string[2]=='+')?0.:(stoi(offer_string.substr(2)) / 256.);
-            offer1 += stod(offer_string.substr(0, 2)) / 32.;
-            long volume = 10000000;
-            for(int i=0;i<5;++i){
-                double bid = bid1 - i * 1.0 / 256.0;
-                double offer = offer1 + i * 1.0 / 256.0;
-                bidStack.emplace_back(bid, volume, BID);
-                offerStack.emplace_back(offer, volume, OFFER);
-            }
-            Bond product = bondMap[bondId];
+        const Bond& product = registry.GetBond(handle);
+        if (!incremental) {
             OrderBook<Bond> result(product, bidStack, offerStack);
-            bondMarketDataService.OnMessage(result);
+            bondMarketDataService.OnMessage(result, venue);
+            return true;
+        }
+        if (lastBids.size() < registry.Size() * MARKET_COUNT) {
+            lastBids.resize(registry.Size() * MARKET_COUNT);
+            lastOffers.resize(registry.Size() * MARKET_COUNT);
         }
-        iFile.close();
+        size_t slot = size_t(handle) * MARKET_COUNT + venue;
+        PushDeltas(bondMarketDataService, product, venue, BID, lastBids[slot], bidStack);
+        PushDeltas(bondMarketDataService, product, venue, OFFER, lastOffers[slot], offerStack);
+        lastBids[slot].swap(bidStack);
+        lastOffers[slot].swap(offerStack);
+        return true;
+    }
+
+    // Push every remaining order book in the file to the service in one pass
+    long SubscribeAll(BondMarketDataService& bondMarketDataService, const ProductRegistry& registry) {
+        long count = 0;
+        while (Subscribe(bondMarketDataService, registry))
+            ++count;
+        return count;
     }
 };
 
-Order::Order(double _price, long _quantity, PricingSide _side)
+Order::Order(TickPrice _price, long _quantity, PricingSide _side)
 {
   price = _price;
   quantity = _quantity;
   side = _side;
 }
 
-double Order::GetPrice() const
+TickPrice Order::GetPrice() const
 {
   return price;
 }
@@ -312,14 +667,14 @@ const Order& BidOffer::GetOfferOrder() const
 
 template<typename T>
 OrderBook<T>::OrderBook(const T &_product, const vector<Order> &_bidStack, const vector<Order> &_offerStack) :
-  product(_product), bidStack(_bidStack), offerStack(_offerStack)
+  product(&_product), bidStack(_bidStack), offerStack(_offerStack)
 {
 }
 
 template<typename T>
 const T& OrderBook<T>::GetProduct() const
 {
-  return product;
+  return *product;
 }
 
 template<typename T>
@@ -334,4 +689,94 @@ const vector<Order>& OrderBook<T>::GetOfferStack() const
   return offerStack;
 }
 
+template<typename T>
+TopOfBook<T>::TopOfBook(const T &_product, const Order &_bidOrder, const Order &_offerOrder, Market _bidVenue, Market _offerVenue) :
+  product(&_product), bidOrder(_bidOrder), offerOrder(_offerOrder), bidVenue(_bidVenue), offerVenue(_offerVenue)
+{
+}
+
+template<typename T>
+const T& TopOfBook<T>::GetProduct() const
+{
+  return *product;
+}
+
+template<typename T>
+const Order& TopOfBook<T>::GetBidOrder() const
+{
+  return bidOrder;
+}
+
+template<typename T>
+const Order& TopOfBook<T>::GetOfferOrder() const
+{
+  return offerOrder;
+}
+
+template<typename T>
+Market TopOfBook<T>::GetBidVenue() const
+{
+  return bidVenue;
+}
+
+template<typename T>
+Market TopOfBook<T>::GetOfferVenue() const
+{
+  return offerVenue;
+}
+
+template<typename T>
+bool TopOfBook<T>::Set(const Order &_bidOrder, const Order &_offerOrder, Market _bidVenue, Market _offerVenue)
+{
+  if (SameLevel(bidOrder, _bidOrder) && SameLevel(offerOrder, _offerOrder) && bidVenue == _bidVenue && offerVenue == _offerVenue)
+    return false;
+  bidOrder = _bidOrder;
+  offerOrder = _offerOrder;
+  bidVenue = _bidVenue;
+  offerVenue = _offerVenue;
+  return true;
+}
+
+template<typename T>
+BookDelta<T>::BookDelta(const T &_product, Market _venue, DeltaAction _action, PricingSide _side, TickPrice _price, long _quantity) :
+  product(&_product), venue(_venue), action(_action), side(_side), price(_price), quantity(_quantity)
+{
+}
+
+template<typename T>
+const T& BookDelta<T>::GetProduct() const
+{
+  return *product;
+}
+
+template<typename T>
+Market BookDelta<T>::GetVenue() const
+{
+  return venue;
+}
+
+template<typename T>
+DeltaAction BookDelta<T>::GetAction() const
+{
+  return action;
+}
+
+template<typename T>
+PricingSide BookDelta<T>::GetSide() const
+{
+  return side;
+}
+
+template<typename T>
+TickPrice BookDelta<T>::GetPrice() const
+{
+  return price;
+}
+
+template<typename T>
+long BookDelta<T>::GetQuantity() const
+{
+  return quantity;
+}
+
 #endif
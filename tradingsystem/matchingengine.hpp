@@ -0,0 +1,508 @@
+/**
+ * matchingengine.hpp
+ * Defines an in-process price-time priority matching engine per venue.
+ *
+ * Each venue keeps, per product, a FlatOrderBook of the total quantity resting
+ * at every price and, alongside it, a FIFO of resting orders per price level,
+ * linked by index through one pooled order array. Matching walks the contra
+ * side from the touch; an order's visible quantity trades first and its hidden
+ * quantity is shown again, at the back of the queue, once the visible part is
+ * gone. Client orders get ExecutionReports; the liquidity that market data
+ * shows on the venue is seeded as quote orders that rest but are not reported.
+ */
+#ifndef MATCHING_ENGINE_HPP
+#define MATCHING_ENGINE_HPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <type_traits>
+#include "soa.hpp"
+#include "products.hpp"
+#include "productregistry.hpp"
+#include "marketdataservice.hpp"
+#include "executionservice.hpp"
+
+using namespace std;
+
+/**
+ * Matching engine for one venue.
+ * LIMIT orders match up to their price and rest the remainder; MARKET orders
+ * match at any price and IOC orders up to their price, cancelling the rest;
+ * FOK orders trade in full up to their price or not at all. STOP orders wait
+ * until the venue trades at or through their price, or its own side of the
+ * market is quoted there (the bid for a buy stop, the offer for a sell stop),
+ * and then match as MARKET.
+ * A resting price outside the FlatOrderBook window of a working book is
+ * outside the venue's price band and is rejected.
+ */
+class BondMatchingEngine
+{
+
+public:
+
+  // ctor for a venue's engine over every registered product
+  BondMatchingEngine(Market _venue, const ProductRegistry &_registry);
+
+  // Match an order on this venue; reports go to the listeners
+  void Submit(const ExecutionOrder<Bond> &order);
+
+  // Set the quote quantity that market data shows at a price; 0 removes it.
+  // Quotes keep their place in the queue and rest without matching, but fire any stop they reach.
+  void SetQuote(const Bond &product, PricingSide side, TickPrice price, long quantity);
+
+  // Get the total quantity resting at a price
+  long GetRestingQuantity(const Bond &product, PricingSide side, TickPrice price) const;
+
+  // Get the resting book of a product
+  const FlatOrderBook& GetBook(const Bond &product) const;
+
+  // Get the venue
+  Market GetVenue() const;
+
+  // Get the number of fills so far
+  long GetFillCount() const;
+
+  // Listen to reports for client orders
+  void AddListener(ServiceListener<ExecutionReport<Bond> > *listener);
+
+private:
+  static const int32_t NONE = -1;
+  static const int64_t MASK = FlatOrderBook::CAPACITY - 1;
+
+  // A resting order's client order ID is kept in orderIds at the same index
+  struct RestingOrder
+  {
+    TickPrice price;
+    long visible;
+    long hidden;
+    long peak;
+    int32_t prev;
+    int32_t next;
+    PricingSide side;
+    bool quote;
+  };
+  static_assert(is_trivially_copyable_v<RestingOrder>, "resting orders are pooled and copied without allocating");
+
+  struct ProductBook
+  {
+    FlatOrderBook levels;
+    int32_t head[2][FlatOrderBook::CAPACITY];
+    int32_t tail[2][FlatOrderBook::CAPACITY];
+    int32_t quote[2][FlatOrderBook::CAPACITY];
+    TickPrice lastTrade;
+    bool traded = false;
+  };
+
+  struct PendingStop
+  {
+    ProductHandle handle;
+    ExecutionOrder<Bond> order;
+  };
+
+  bool InBand(const ProductBook &book, TickPrice price) const;
+  int32_t Allocate();
+  void Append(ProductBook &book, int32_t index);
+  void Unlink(ProductBook &book, int32_t index);
+  long Match(ProductHandle handle, const Bond &product, const string &orderId, PricingSide side, bool limited, TickPrice limit, long quantity);
+  void Rest(ProductHandle handle, const ExecutionOrder<Bond> &order, long quantity);
+  bool Reached(const ProductBook &book, const ExecutionOrder<Bond> &stop) const;
+  void TriggerStops(ProductHandle handle);
+  void Report(const Bond &product, const string &orderId, PricingSide side, ExecutionStatus status, TickPrice price, long quantity, long leavesQuantity);
+  void Dispatch();
+
+  Market venue;
+  const ProductRegistry& registry;
+  vector<ProductBook> books; // indexed by product handle
+  vector<RestingOrder> orders;
+  vector<string> orderIds; // indexed like orders; reassigned in place so a reused slot keeps its capacity
+  vector<int32_t> freeOrders;
+  vector<PendingStop> stops;
+  vector< ServiceListener<ExecutionReport<Bond> >* > reportListeners;
+  vector<ExecutionReport<Bond> > pendingReports;
+  bool dispatching;
+  long fillCount;
+
+};
+
+/**
+ * The simulated venues behind BondExecutionService.
+ * Listens to orders as they are sent to a venue and matches them in that
+ * venue's engine.
+ */
+class BondExchangeSimulator: public ServiceListener<pair<Market, ExecutionOrder<Bond> > >
+{
+
+public:
+
+  // ctor for one engine per venue
+  explicit BondExchangeSimulator(const ProductRegistry &registry);
+
+  // Get a venue's engine
+  BondMatchingEngine& GetEngine(Market venue);
+
+  // Listen to reports from every venue
+  void AddListener(ServiceListener<ExecutionReport<Bond> > *listener);
+
+  void ProcessAdd(pair<Market, ExecutionOrder<Bond> > &data) override;
+
+  void ProcessRemove(pair<Market, ExecutionOrder<Bond> > &data) override {}
+
+  void ProcessUpdate(pair<Market, ExecutionOrder<Bond> > &data) override {}
+
+private:
+  vector<BondMatchingEngine> engines;
+
+};
+
+/**
+ * Seeds each venue's engine with the depth market data shows on that venue.
+ */
+class BondVenueDepthListener: public ServiceListener<BookDelta<Bond> >
+{
+
+public:
+
+  explicit BondVenueDepthListener(BondExchangeSimulator &_simulator) : simulator(_simulator) {}
+
+  void ProcessAdd(BookDelta<Bond> &data) override;
+
+  void ProcessRemove(BookDelta<Bond> &data) override;
+
+  void ProcessUpdate(BookDelta<Bond> &data) override;
+
+private:
+  BondExchangeSimulator& simulator;
+
+};
+
+BondMatchingEngine::BondMatchingEngine(Market _venue, const ProductRegistry &_registry) :
+  venue(_venue), registry(_registry), books(_registry.Size()), dispatching(false), fillCount(0)
+{
+  for (ProductBook &book : books) {
+    for (int s = 0; s < 2; ++s) {
+      for (int64_t i = 0; i < FlatOrderBook::CAPACITY; ++i) {
+        book.head[s][i] = NONE;
+        book.tail[s][i] = NONE;
+        book.quote[s][i] = NONE;
+      }
+    }
+  }
+}
+
+// An empty book takes any price; a working book only prices inside its window
+bool BondMatchingEngine::InBand(const ProductBook &book, TickPrice price) const
+{
+  return book.levels.Contains(price) || (!book.levels.HasLevels(BID) && !book.levels.HasLevels(OFFER));
+}
+
+int32_t BondMatchingEngine::Allocate()
+{
+  if (!freeOrders.empty()) {
+    int32_t index = freeOrders.back();
+    freeOrders.pop_back();
+    return index;
+  }
+  orders.emplace_back();
+  orderIds.emplace_back();
+  return int32_t(orders.size() - 1);
+}
+
+void BondMatchingEngine::Append(ProductBook &book, int32_t index)
+{
+  RestingOrder &order = orders[index];
+  int64_t slot = order.price.GetTicks() & MASK;
+  order.prev = book.tail[order.side][slot];
+  order.next = NONE;
+  if (order.prev == NONE)
+    book.head[order.side][slot] = index;
+  else
+    orders[order.prev].next = index;
+  book.tail[order.side][slot] = index;
+}
+
+void BondMatchingEngine::Unlink(ProductBook &book, int32_t index)
+{
+  RestingOrder &order = orders[index];
+  int64_t slot = order.price.GetTicks() & MASK;
+  if (order.prev == NONE)
+    book.head[order.side][slot] = order.next;
+  else
+    orders[order.prev].next = order.next;
+  if (order.next == NONE)
+    book.tail[order.side][slot] = order.prev;
+  else
+    orders[order.next].prev = order.prev;
+}
+
+void BondMatchingEngine::Report(const Bond &product, const string &orderId, PricingSide side, ExecutionStatus status, TickPrice price, long quantity, long leavesQuantity)
+{
+  if (!reportListeners.empty())
+    pendingReports.emplace_back(product, orderId, venue, side, status, price, quantity, leavesQuantity);
+}
+
+// Reports are delivered once matching is done, so a listener may submit again;
+// reports from such a nested submit are delivered by the outermost call
+void BondMatchingEngine::Dispatch()
+{
+  if (dispatching)
+    return;
+  dispatching = true;
+  for (size_t i = 0; i < pendingReports.size(); ++i) {
+    ExecutionReport<Bond> report = pendingReports[i];
+    for (auto &listener : reportListeners)
+      listener->ProcessAdd(report);
+  }
+  pendingReports.clear();
+  dispatching = false;
+}
+
+// Take quantity from the contra side, best price first and oldest order first
+// within a price; returns the quantity left over
+long BondMatchingEngine::Match(ProductHandle handle, const Bond &product, const string &orderId, PricingSide side, bool limited, TickPrice limit, long quantity)
+{
+  ProductBook &book = books[handle];
+  PricingSide contra = (side == BID) ? OFFER : BID;
+  while (quantity > 0 && book.levels.HasLevels(contra)) {
+    TickPrice price = book.levels.GetBest(contra);
+    if (limited && (side == BID ? price > limit : price < limit))
+      break;
+    int64_t slot = price.GetTicks() & MASK;
+    while (quantity > 0 && book.head[contra][slot] != NONE) {
+      int32_t index = book.head[contra][slot];
+      RestingOrder &resting = orders[index];
+      long fill = (quantity < resting.visible) ? quantity : resting.visible;
+      resting.visible -= fill;
+      quantity -= fill;
+      book.levels.AddQuantity(contra, price, -fill);
+      book.lastTrade = price;
+      book.traded = true;
+      ++fillCount;
+      Report(product, orderId, side, quantity == 0 ? ORDER_FILLED : ORDER_PARTIALLY_FILLED, price, fill, quantity);
+      bool requeue = false;
+      if (resting.visible == 0 && resting.hidden > 0) {
+        // show the next slice of the hidden quantity behind everyone already at the level
+        resting.visible = (resting.hidden < resting.peak) ? resting.hidden : resting.peak;
+        resting.hidden -= resting.visible;
+        requeue = true;
+      }
+      long leaves = resting.visible + resting.hidden;
+      if (!resting.quote)
+        Report(product, orderIds[index], resting.side, leaves == 0 ? ORDER_FILLED : ORDER_PARTIALLY_FILLED, price, fill, leaves);
+      if (requeue) {
+        Unlink(book, index);
+        Append(book, index);
+      } else if (leaves == 0) {
+        if (resting.quote)
+          book.quote[contra][slot] = NONE;
+        Unlink(book, index);
+        freeOrders.push_back(index);
+      }
+    }
+  }
+  return quantity;
+}
+
+void BondMatchingEngine::Rest(ProductHandle handle, const ExecutionOrder<Bond> &order, long quantity)
+{
+  ProductBook &book = books[handle];
+  int32_t index = Allocate();
+  RestingOrder &resting = orders[index];
+  orderIds[index] = order.GetOrderId();
+  resting.price = order.GetPrice();
+  resting.side = order.GetSide();
+  resting.quote = false;
+  resting.peak = (order.GetVisibleQuantity() > 0) ? order.GetVisibleQuantity() : quantity;
+  resting.visible = (quantity < resting.peak) ? quantity : resting.peak;
+  resting.hidden = quantity - resting.visible;
+  book.levels.AddQuantity(resting.side, resting.price, quantity);
+  Append(book, index);
+}
+
+void BondMatchingEngine::Submit(const ExecutionOrder<Bond> &order)
+{
+  const Bond &product = order.GetProduct();
+  ProductHandle handle = registry.HandleOf(product);
+  PricingSide side = order.GetSide();
+  long quantity = order.GetVisibleQuantity() + order.GetHiddenQuantity();
+  const string &orderId = order.GetOrderId();
+  if (handle == ProductRegistry::NOT_FOUND || quantity <= 0) {
+    Report(product, orderId, side, ORDER_REJECTED, TickPrice(), quantity, 0);
+    Dispatch();
+    return;
+  }
+  ProductBook &book = books[handle];
+  TickPrice price = order.GetPrice();
+  switch (order.GetOrderType()) {
+  case MARKET:
+  case IOC: {
+    long left = Match(handle, product, orderId, side, order.GetOrderType() == IOC, price, quantity);
+    if (left > 0)
+      Report(product, orderId, side, ORDER_CANCELLED, TickPrice(), left, 0);
+    break;
+  }
+  case FOK: {
+    PricingSide contra = (side == BID) ? OFFER : BID;
+    if (book.levels.GetDepthThrough(contra, price, quantity) < quantity)
+      Report(product, orderId, side, ORDER_CANCELLED, TickPrice(), quantity, 0);
+    else
+      Match(handle, product, orderId, side, true, price, quantity);
+    break;
+  }
+  case LIMIT: {
+    if (!InBand(book, price)) {
+      Report(product, orderId, side, ORDER_REJECTED, price, quantity, 0);
+      break;
+    }
+    long left = Match(handle, product, orderId, side, true, price, quantity);
+    if (left == 0)
+      break;
+    if (left == quantity)
+      Report(product, orderId, side, ORDER_NEW, price, 0, left);
+    Rest(handle, order, left);
+    break;
+  }
+  case STOP: {
+    Report(product, orderId, side, ORDER_NEW, price, 0, quantity);
+    stops.push_back(PendingStop{handle, order});
+    break;
+  }
+  }
+  TriggerStops(handle);
+  Dispatch();
+}
+
+// A buy stop is reached by a trade or a bid at or above its price, a sell stop by one at or below it
+bool BondMatchingEngine::Reached(const ProductBook &book, const ExecutionOrder<Bond> &stop) const
+{
+  PricingSide side = stop.GetSide();
+  TickPrice price = stop.GetPrice();
+  auto through = [side, price](TickPrice level) { return side == BID ? level >= price : level <= price; };
+  return (book.traded && through(book.lastTrade)) || (book.levels.HasLevels(side) && through(book.levels.GetBest(side)));
+}
+
+// Fire every stop the product's last trade or quotes have reached, until none is left to fire.
+// Stops are kept in the order they arrived and the earliest reached fires first.
+void BondMatchingEngine::TriggerStops(ProductHandle handle)
+{
+  const ProductBook &book = books[handle];
+  size_t i = 0;
+  while (i < stops.size()) {
+    if (stops[i].handle != handle || !Reached(book, stops[i].order)) {
+      ++i;
+      continue;
+    }
+    ExecutionOrder<Bond> fired = stops[i].order;
+    stops.erase(stops.begin() + i);
+    long quantity = fired.GetVisibleQuantity() + fired.GetHiddenQuantity();
+    long left = Match(handle, fired.GetProduct(), fired.GetOrderId(), fired.GetSide(), false, TickPrice(), quantity);
+    if (left > 0)
+      Report(fired.GetProduct(), fired.GetOrderId(), fired.GetSide(), ORDER_CANCELLED, TickPrice(), left, 0);
+    i = 0;
+  }
+}
+
+void BondMatchingEngine::SetQuote(const Bond &product, PricingSide side, TickPrice price, long quantity)
+{
+  ProductHandle handle = registry.HandleOf(product);
+  if (handle == ProductRegistry::NOT_FOUND)
+    return;
+  ProductBook &book = books[handle];
+  int64_t slot = price.GetTicks() & MASK;
+  int32_t index = book.quote[side][slot];
+  if (index == NONE) {
+    if (quantity <= 0 || !InBand(book, price))
+      return;
+    index = Allocate();
+    RestingOrder &resting = orders[index];
+    resting.price = price;
+    resting.side = side;
+    resting.quote = true;
+    resting.visible = quantity;
+    resting.hidden = 0;
+    resting.peak = quantity;
+    book.levels.AddQuantity(side, price, quantity);
+    Append(book, index);
+    book.quote[side][slot] = index;
+  } else {
+    RestingOrder &resting = orders[index];
+    long target = (quantity > 0) ? quantity : 0;
+    book.levels.AddQuantity(side, price, target - resting.visible);
+    if (target > 0) {
+      resting.visible = target;
+    } else {
+      Unlink(book, index);
+      freeOrders.push_back(index);
+      book.quote[side][slot] = NONE;
+    }
+  }
+  if (!stops.empty()) {
+    TriggerStops(handle);
+    Dispatch();
+  }
+}
+
+long BondMatchingEngine::GetRestingQuantity(const Bond &product, PricingSide side, TickPrice price) const
+{
+  return books.at(registry.HandleOf(product)).levels.GetQuantity(side, price);
+}
+
+const FlatOrderBook& BondMatchingEngine::GetBook(const Bond &product) const
+{
+  return books.at(registry.HandleOf(product)).levels;
+}
+
+Market BondMatchingEngine::GetVenue() const
+{
+  return venue;
+}
+
+long BondMatchingEngine::GetFillCount() const
+{
+  return fillCount;
+}
+
+void BondMatchingEngine::AddListener(ServiceListener<ExecutionReport<Bond> > *listener)
+{
+  reportListeners.push_back(listener);
+}
+
+BondExchangeSimulator::BondExchangeSimulator(const ProductRegistry &registry)
+{
+  engines.reserve(MARKET_COUNT);
+  for (int v = 0; v < MARKET_COUNT; ++v)
+    engines.emplace_back(Market(v), registry);
+}
+
+BondMatchingEngine& BondExchangeSimulator::GetEngine(Market venue)
+{
+  return engines[venue];
+}
+
+void BondExchangeSimulator::AddListener(ServiceListener<ExecutionReport<Bond> > *listener)
+{
+  for (BondMatchingEngine &engine : engines)
+    engine.AddListener(listener);
+}
+
+void BondExchangeSimulator::ProcessAdd(pair<Market, ExecutionOrder<Bond> > &data)
+{
+  engines[data.first].Submit(data.second);
+}
+
+void BondVenueDepthListener::ProcessAdd(BookDelta<Bond> &data)
+{
+  simulator.GetEngine(data.GetVenue()).SetQuote(data.GetProduct(), data.GetSide(), data.GetPrice(), data.GetQuantity());
+}
+
+void BondVenueDepthListener::ProcessRemove(BookDelta<Bond> &data)
+{
+  simulator.GetEngine(data.GetVenue()).SetQuote(data.GetProduct(), data.GetSide(), data.GetPrice(), 0);
+}
+
+void BondVenueDepthListener::ProcessUpdate(BookDelta<Bond> &data)
+{
+  simulator.GetEngine(data.GetVenue()).SetQuote(data.GetProduct(), data.GetSide(), data.GetPrice(), data.GetQuantity());
+}
+
+#endif
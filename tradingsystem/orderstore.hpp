@@ -0,0 +1,337 @@
+/**
+ * orderstore.hpp
+ * Defines a pooled store of orders keyed on 64-bit order IDs.
+ *
+ * Orders live in slots of one growing array and a slot is reused once the
+ * order in it has been retired, so in steady state no order allocates. An
+ * order ID is the slot number plus one in its low 32 bits and the slot's
+ * generation in its high 32 bits: finding an order is an index and a
+ * generation check, and the ID of a retired order never finds its slot's new
+ * occupant. Each order tracks its filled and cancelled quantities through the
+ * NEW, PARTIALLY_FILLED, FILLED and CANCELLED states. Live orders are linked
+ * per product in creation order; finished orders are linked oldest first and
+ * the oldest is retired once more than the retention count are kept.
+ */
+#ifndef ORDER_STORE_HPP
+#define ORDER_STORE_HPP
+
+#include <vector>
+#include <optional>
+#include <string_view>
+#include <charconv>
+#include <cstdint>
+#include <cstddef>
+#include <climits>
+#include "productregistry.hpp"
+
+using namespace std;
+
+// 64-bit order identifier; 0 is never issued
+using OrderId = uint64_t;
+
+// Lifecycle state of a stored order
+enum OrderState { STATE_NEW, STATE_PARTIALLY_FILLED, STATE_FILLED, STATE_CANCELLED };
+
+/**
+ * Store of orders of type T.
+ */
+template<typename T>
+class OrderStore
+{
+
+public:
+
+  // ID that finds no order
+  static constexpr OrderId NO_ORDER = 0;
+
+  // ctor for a store over a number of products that keeps up to retention finished orders
+  explicit OrderStore(size_t products, size_t _retention = 65536);
+
+  // Store the order make(id) builds for a product, for quantity in total; returns its ID
+  template<typename F>
+  OrderId Create(ProductHandle product, long quantity, F make);
+
+  // Get an order, or nullptr once it has been retired
+  T* Find(OrderId id);
+  const T* Find(OrderId id) const;
+
+  // Get the state of a stored order, or nothing once it has been retired
+  optional<OrderState> GetState(OrderId id) const;
+
+  // Get the quantity filled so far; 0 once the order has been retired
+  long GetFilledQuantity(OrderId id) const;
+
+  // Get the quantity neither filled nor cancelled; 0 once the order has been retired
+  long GetLeavesQuantity(OrderId id) const;
+
+  // Record a fill; false for an unknown or finished order. A fill beyond the leaves quantity is capped.
+  bool Fill(OrderId id, long quantity);
+
+  // Record a cancel of up to quantity, by default everything left; false for an unknown or finished order
+  bool Cancel(OrderId id, long quantity = LONG_MAX);
+
+  // Get the number of live orders of a product
+  size_t GetLiveCount(ProductHandle product) const;
+
+  // Get the most recent order of a product, live or finished, or NO_ORDER
+  OrderId GetLast(ProductHandle product) const;
+
+  // Get the number of slots the store has grown to
+  size_t GetSlotCount() const;
+
+  // Call f(id, order) for every live order of a product, oldest first
+  template<typename F>
+  void ForEachLive(ProductHandle product, F f) const;
+
+  // Read the order ID after prefix at the start of text, as in "A42" or a child's "A42-1" for prefix "A".
+  // Text without the prefix is not an ID, so orders named elsewhere are never read as ours.
+  static bool ParseId(string_view text, string_view prefix, OrderId &id);
+
+private:
+  static constexpr int32_t NONE = -1;
+
+  struct Slot
+  {
+    optional<T> order;
+    long quantity;
+    long filled;
+    long cancelled;
+    OrderState state;
+    uint32_t generation;
+    bool inUse;
+    ProductHandle product;
+    int32_t prev;
+    int32_t next;
+  };
+
+  struct List
+  {
+    int32_t head = NONE;
+    int32_t tail = NONE;
+    size_t count = 0;
+  };
+
+  OrderId IdOf(int32_t slot) const;
+  int32_t SlotOf(OrderId id) const;
+  void Append(List &list, int32_t slot);
+  void Remove(List &list, int32_t slot);
+  void Finish(int32_t slot);
+
+  vector<Slot> slots;
+  vector<int32_t> freeSlots;
+  vector<List> live; // indexed by product handle
+  vector<OrderId> last; // indexed by product handle
+  List finished;
+  size_t retention;
+
+};
+
+template<typename T>
+OrderStore<T>::OrderStore(size_t products, size_t _retention) :
+  live(products), last(products, NO_ORDER), retention(_retention)
+{
+}
+
+template<typename T>
+OrderId OrderStore<T>::IdOf(int32_t slot) const
+{
+  return (OrderId(slots[slot].generation) << 32) | OrderId(uint32_t(slot) + 1);
+}
+
+template<typename T>
+int32_t OrderStore<T>::SlotOf(OrderId id) const
+{
+  uint64_t index = (id & 0xFFFFFFFFULL);
+  if (index == 0 || index > slots.size())
+    return NONE;
+  const Slot &slot = slots[index - 1];
+  if (!slot.inUse || slot.generation != uint32_t(id >> 32))
+    return NONE;
+  return int32_t(index - 1);
+}
+
+template<typename T>
+void OrderStore<T>::Append(List &list, int32_t slot)
+{
+  Slot &s = slots[slot];
+  s.prev = list.tail;
+  s.next = NONE;
+  if (list.tail == NONE)
+    list.head = slot;
+  else
+    slots[list.tail].next = slot;
+  list.tail = slot;
+  ++list.count;
+}
+
+template<typename T>
+void OrderStore<T>::Remove(List &list, int32_t slot)
+{
+  Slot &s = slots[slot];
+  if (s.prev == NONE)
+    list.head = s.next;
+  else
+    slots[s.prev].next = s.next;
+  if (s.next == NONE)
+    list.tail = s.prev;
+  else
+    slots[s.next].prev = s.prev;
+  --list.count;
+}
+
+// Move a finished order off its product's live list, retiring the oldest finished order if too many are kept
+template<typename T>
+void OrderStore<T>::Finish(int32_t slot)
+{
+  Slot &s = slots[slot];
+  s.state = (s.filled == s.quantity) ? STATE_FILLED : STATE_CANCELLED;
+  Remove(live[s.product], slot);
+  Append(finished, slot);
+  if (finished.count <= retention)
+    return;
+  int32_t oldest = finished.head;
+  Remove(finished, oldest);
+  slots[oldest].inUse = false;
+  ++slots[oldest].generation;
+  freeSlots.push_back(oldest);
+}
+
+template<typename T>
+template<typename F>
+OrderId OrderStore<T>::Create(ProductHandle product, long quantity, F make)
+{
+  int32_t slot;
+  if (!freeSlots.empty()) {
+    slot = freeSlots.back();
+    freeSlots.pop_back();
+  } else {
+    slot = int32_t(slots.size());
+    slots.emplace_back();
+    slots[slot].generation = 0;
+  }
+  OrderId id = IdOf(slot);
+  Slot &s = slots[slot];
+  s.order.emplace(make(id));
+  s.quantity = quantity;
+  s.filled = 0;
+  s.cancelled = 0;
+  s.state = STATE_NEW;
+  s.inUse = true;
+  s.product = product;
+  Append(live[product], slot);
+  last[product] = id;
+  if (quantity <= 0)
+    Finish(slot);
+  return id;
+}
+
+template<typename T>
+T* OrderStore<T>::Find(OrderId id)
+{
+  int32_t slot = SlotOf(id);
+  return (slot == NONE) ? nullptr : &*slots[slot].order;
+}
+
+template<typename T>
+const T* OrderStore<T>::Find(OrderId id) const
+{
+  int32_t slot = SlotOf(id);
+  return (slot == NONE) ? nullptr : &*slots[slot].order;
+}
+
+template<typename T>
+optional<OrderState> OrderStore<T>::GetState(OrderId id) const
+{
+  int32_t slot = SlotOf(id);
+  if (slot == NONE)
+    return nullopt;
+  return slots[slot].state;
+}
+
+template<typename T>
+long OrderStore<T>::GetFilledQuantity(OrderId id) const
+{
+  int32_t slot = SlotOf(id);
+  return (slot == NONE) ? 0 : slots[slot].filled;
+}
+
+template<typename T>
+long OrderStore<T>::GetLeavesQuantity(OrderId id) const
+{
+  int32_t slot = SlotOf(id);
+  if (slot == NONE)
+    return 0;
+  const Slot &s = slots[slot];
+  return s.quantity - s.filled - s.cancelled;
+}
+
+template<typename T>
+bool OrderStore<T>::Fill(OrderId id, long quantity)
+{
+  int32_t slot = SlotOf(id);
+  if (slot == NONE || quantity <= 0)
+    return false;
+  Slot &s = slots[slot];
+  if (s.state == STATE_FILLED || s.state == STATE_CANCELLED)
+    return false;
+  long leaves = s.quantity - s.filled - s.cancelled;
+  s.filled += (quantity < leaves) ? quantity : leaves;
+  s.state = STATE_PARTIALLY_FILLED;
+  if (s.filled + s.cancelled == s.quantity)
+    Finish(slot);
+  return true;
+}
+
+template<typename T>
+bool OrderStore<T>::Cancel(OrderId id, long quantity)
+{
+  int32_t slot = SlotOf(id);
+  if (slot == NONE || quantity <= 0)
+    return false;
+  Slot &s = slots[slot];
+  if (s.state == STATE_FILLED || s.state == STATE_CANCELLED)
+    return false;
+  long leaves = s.quantity - s.filled - s.cancelled;
+  s.cancelled += (quantity < leaves) ? quantity : leaves;
+  if (s.filled + s.cancelled == s.quantity)
+    Finish(slot);
+  return true;
+}
+
+template<typename T>
+size_t OrderStore<T>::GetLiveCount(ProductHandle product) const
+{
+  return live[product].count;
+}
+
+template<typename T>
+OrderId OrderStore<T>::GetLast(ProductHandle product) const
+{
+  return last[product];
+}
+
+template<typename T>
+size_t OrderStore<T>::GetSlotCount() const
+{
+  return slots.size();
+}
+
+template<typename T>
+template<typename F>
+void OrderStore<T>::ForEachLive(ProductHandle product, F f) const
+{
+  for (int32_t slot = live[product].head; slot != NONE; slot = slots[slot].next)
+    f(IdOf(slot), *slots[slot].order);
+}
+
+template<typename T>
+bool OrderStore<T>::ParseId(string_view text, string_view prefix, OrderId &id)
+{
+  if (!text.starts_with(prefix))
+    return false;
+  text.remove_prefix(prefix.size());
+  auto result = from_chars(text.data(), text.data() + text.size(), id);
+  return result.ec == errc() && (result.ptr == text.data() + text.size() || *result.ptr == '-');
+}
+
+#endif
@@ -0,0 +1,194 @@
+/**
+ * orderthrottle.hpp
+ * Defines the per venue and product order throttle in front of BondExecutionService.
+ *
+ * Every (venue, product) pair has a token bucket in a RateLimiter, so the
+ * accounting for an order is one compare-and-swap whichever thread sends it.
+ * An order over the limit is either rejected or, when a token will be free
+ * within the allowed delay, held with that token reserved and released to the
+ * venue once its time comes, past any checks added after the throttle; so it
+ * is added last. The global KillSwitch stops the throttle along with the
+ * execution service: orders are rejected and held ones are dropped.
+ */
+#ifndef ORDER_THROTTLE_HPP
+#define ORDER_THROTTLE_HPP
+
+#include <vector>
+#include <queue>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include "soa.hpp"
+#include "productregistry.hpp"
+#include "executionservice.hpp"
+#include "ratelimiter.hpp"
+
+using namespace std;
+
+// What the throttle does with an order over its limit
+enum ThrottlePolicy { THROTTLE_REJECT, THROTTLE_QUEUE };
+
+class BondOrderThrottle : public PreTradeCheck<Bond>
+{
+
+public:
+
+  // ctor for a throttle allowing each venue and product ratePerSecond orders in bursts of up to burst.
+  // Under THROTTLE_QUEUE an order is held for up to maxDelay nanoseconds before it is rejected instead.
+  BondOrderThrottle(const ProductRegistry &_registry, BondExecutionService &_executionService, double ratePerSecond, long burst,
+    ThrottlePolicy _policy, double maxDelay = 1e6, KillSwitch &_killSwitch = KillSwitch::Global());
+
+  // Give every product on a venue its own limit; set before orders flow
+  void SetVenueLimit(Market venue, double ratePerSecond, long burst);
+
+  // Let an order through if its bucket has a token, otherwise hold or reject it.
+  // Held orders that have come due are released first.
+  bool Admit(const ExecutionOrder<Bond> &order, Market market) override;
+
+  // Send every held order due by tick now; while halted, reject them all. Returns the number handled.
+  size_t Release(uint64_t now);
+
+  // Listen to the orders the throttle refuses, as ORDER_REJECTED reports
+  void AddListener(ServiceListener<ExecutionReport<Bond> > *listener);
+
+  // Get the number of orders held now
+  size_t GetHeldCount() const;
+
+  // Get the number of orders that were held at some point
+  uint64_t GetQueuedCount() const;
+
+  // Get the number of orders rejected
+  uint64_t GetRejectedCount() const;
+
+private:
+  struct HeldOrder
+  {
+    uint64_t due;
+    uint64_t sequence;
+    ExecutionOrder<Bond> order;
+    Market market;
+  };
+
+  // Earliest due first, then in the order they were held
+  struct Later
+  {
+    bool operator()(const HeldOrder &a, const HeldOrder &b) const
+    {
+      return a.due != b.due ? a.due > b.due : a.sequence > b.sequence;
+    }
+  };
+
+  void Reject(const ExecutionOrder<Bond> &order, Market market);
+
+  const ProductRegistry& registry;
+  BondExecutionService& executionService;
+  ThrottlePolicy policy;
+  uint64_t maxWait; // ticks
+  KillSwitch& killSwitch;
+  RateLimiter limiter; // keyed on venue times product count plus product handle
+  mutable mutex heldLock; // guards held and sequence
+  priority_queue<HeldOrder, vector<HeldOrder>, Later> held;
+  uint64_t sequence;
+  atomic<uint64_t> nextDue; // due tick of the first held order, or none
+  atomic<uint64_t> queuedCount;
+  atomic<uint64_t> rejectedCount;
+  vector< ServiceListener<ExecutionReport<Bond> >* > rejectListeners;
+
+};
+
+BondOrderThrottle::BondOrderThrottle(const ProductRegistry &_registry, BondExecutionService &_executionService, double ratePerSecond, long burst,
+  ThrottlePolicy _policy, double maxDelay, KillSwitch &_killSwitch) :
+  registry(_registry), executionService(_executionService), policy(_policy), maxWait(CycleClock::FromNanos(maxDelay)), killSwitch(_killSwitch),
+  limiter(MARKET_COUNT * _registry.Size(), ratePerSecond, burst), sequence(0), nextDue(UINT64_MAX), queuedCount(0), rejectedCount(0)
+{
+}
+
+void BondOrderThrottle::SetVenueLimit(Market venue, double ratePerSecond, long burst)
+{
+  for (size_t h = 0; h < registry.Size(); ++h)
+    limiter.SetLimit(venue * registry.Size() + h, ratePerSecond, burst);
+}
+
+bool BondOrderThrottle::Admit(const ExecutionOrder<Bond> &order, Market market)
+{
+  if (killSwitch.IsHalted()) {
+    Release(0);
+    Reject(order, market);
+    return false;
+  }
+  uint64_t now = CycleClock::Now();
+  if (now >= nextDue.load(memory_order_relaxed))
+    Release(now);
+  ProductHandle handle = registry.HandleOf(order.GetProduct());
+  if (handle == ProductRegistry::NOT_FOUND) {
+    Reject(order, market);
+    return false;
+  }
+  size_t key = market * registry.Size() + handle;
+  uint64_t due;
+  if (!limiter.TryAcquire(key, now, policy == THROTTLE_QUEUE ? maxWait : 0, due)) {
+    Reject(order, market);
+    return false;
+  }
+  if (due <= now)
+    return true;
+  lock_guard<mutex> guard(heldLock);
+  held.push(HeldOrder{due, sequence++, order, market});
+  nextDue.store(held.top().due, memory_order_relaxed);
+  queuedCount.fetch_add(1, memory_order_relaxed);
+  return false;
+}
+
+// Orders are taken off the queue under the lock and sent after it is dropped, as sending one may bring another order back in
+size_t BondOrderThrottle::Release(uint64_t now)
+{
+  vector<HeldOrder> ready;
+  bool halted = killSwitch.IsHalted();
+  {
+    lock_guard<mutex> guard(heldLock);
+    while (!held.empty() && (halted || held.top().due <= now)) {
+      ready.push_back(held.top());
+      held.pop();
+    }
+    nextDue.store(held.empty() ? UINT64_MAX : held.top().due, memory_order_relaxed);
+  }
+  for (const HeldOrder &h : ready) {
+    if (halted)
+      Reject(h.order, h.market);
+    else
+      executionService.Release(h.order, h.market);
+  }
+  return ready.size();
+}
+
+void BondOrderThrottle::Reject(const ExecutionOrder<Bond> &order, Market market)
+{
+  rejectedCount.fetch_add(1, memory_order_relaxed);
+  ExecutionReport<Bond> report(order.GetProduct(), order.GetOrderId(), market, order.GetSide(), ORDER_REJECTED, order.GetPrice(),
+    order.GetVisibleQuantity() + order.GetHiddenQuantity(), 0);
+  for (auto &listener : rejectListeners)
+    listener->ProcessAdd(report);
+}
+
+void BondOrderThrottle::AddListener(ServiceListener<ExecutionReport<Bond> > *listener)
+{
+  rejectListeners.push_back(listener);
+}
+
+size_t BondOrderThrottle::GetHeldCount() const
+{
+  lock_guard<mutex> guard(heldLock);
+  return held.size();
+}
+
+uint64_t BondOrderThrottle::GetQueuedCount() const
+{
+  return queuedCount.load(memory_order_relaxed);
+}
+
+uint64_t BondOrderThrottle::GetRejectedCount() const
+{
+  return rejectedCount.load(memory_order_relaxed);
+}
+
+#endif
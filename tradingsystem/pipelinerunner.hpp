@@ -0,0 +1,110 @@
+/**
+ * pipelinerunner.hpp
+ * Defines the runner that drives independent feeds on threads of their own.
+ *
+ * Each feed is a function that pushes one input through its service graph
+ * until the input runs out and returns the number of events it read. Run
+ * starts a thread per feed, pinned to its own core where the machine has
+ * enough of them, releases them together from a barrier and joins them all,
+ * timing each feed and the run as a whole. Graphs that share no mutable state
+ * need nothing more; a graph that feeds another does it through a LinkQueue
+ * that a thread of the downstream graph pumps.
+ */
+#ifndef PIPELINE_RUNNER_HPP
+#define PIPELINE_RUNNER_HPP
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <barrier>
+#include <chrono>
+#include <ostream>
+#include <pthread.h>
+#include <sched.h>
+
+using namespace std;
+
+class PipelineRunner
+{
+
+public:
+
+  // Add a feed under a name; feeds run in the order they were added
+  void Add(const string &name, function<long()> feed);
+
+  // Run every feed on its own thread and wait for all of them to finish
+  void Run();
+
+  // Write a line per feed and one for the run: events, seconds and events a second
+  void Report(ostream &output) const;
+
+private:
+  struct Feed
+  {
+    string name;
+    function<long()> run;
+    long events;
+    double seconds;
+  };
+
+  static void Pin(thread &worker, unsigned core);
+
+  vector<Feed> feeds;
+  double seconds = 0;
+
+};
+
+void PipelineRunner::Add(const string &name, function<long()> feed)
+{
+  feeds.push_back(Feed{name, std::move(feed), 0, 0});
+}
+
+// Pinning is a hint: a thread that cannot be pinned runs wherever the scheduler puts it
+void PipelineRunner::Pin(thread &worker, unsigned core)
+{
+#if defined(__linux__)
+  cpu_set_t cores;
+  CPU_ZERO(&cores);
+  CPU_SET(core, &cores);
+  pthread_setaffinity_np(worker.native_handle(), sizeof(cores), &cores);
+#endif
+}
+
+void PipelineRunner::Run()
+{
+  // with fewer cores than feeds some would share a core, so none is pinned and the scheduler spreads them
+  unsigned cores = thread::hardware_concurrency();
+  bool pin = cores > 1 && feeds.size() <= cores;
+  barrier<> start(ptrdiff_t(feeds.size() + 1));
+  vector<thread> workers;
+  workers.reserve(feeds.size());
+  for (Feed &feed : feeds) {
+    workers.emplace_back([&feed, &start] {
+      start.arrive_and_wait();
+      auto begin = chrono::steady_clock::now();
+      feed.events = feed.run();
+      feed.seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    });
+    if (pin)
+      Pin(workers.back(), unsigned(workers.size() - 1));
+  }
+  auto begin = chrono::steady_clock::now();
+  start.arrive_and_wait();
+  for (thread &worker : workers)
+    worker.join();
+  seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+}
+
+void PipelineRunner::Report(ostream &output) const
+{
+  long total = 0;
+  for (const Feed &feed : feeds) {
+    total += feed.events;
+    output << feed.name << ": " << feed.events << " events in " << feed.seconds << "s, "
+           << (feed.seconds > 0 ? double(feed.events) / feed.seconds : 0.) << " events/s\n";
+  }
+  output << "all feeds: " << total << " events in " << seconds << "s, " << (seconds > 0 ? double(total) / seconds : 0.) << " events/s\n";
+}
+
+#endif
@@ -9,14 +9,18 @@
 
 #include <string>
 #include <map>
+#include <vector>
+#include <span>
+#include <optional>
 #include "soa.hpp"
 #include "tradebookingservice.hpp"
+#include "matchingengine.hpp"
 
 using namespace std;
 
 /**
  * Position class in a particular book.
- * Type T is the product type.
+ * Type T is the product type; the product is referenced, not copied, and must outlive the position.
  */
 template<typename T>
 class Position
@@ -39,7 +43,7 @@ public:
   void ChangePosition(long quantity, string& book);
 
 private:
-  T product;
+  const T* product;
   map<string,long> positions;
 
 };
@@ -62,14 +66,14 @@ public:
 
 template<typename T>
 Position<T>::Position(const T &_product) :
-  product(_product)
+  product(&_product)
 {
 }
 
 template<typename T>
 const T& Position<T>::GetProduct() const
 {
-  return product;
+  return *product;
 }
 
 template<typename T>
@@ -94,11 +98,67 @@ void Position<T>::ChangePosition(long quantity, string &book) {
 
 class BondPositionService: public PositionService<Bond> {
 private:
-    map<string, Position<Bond> > bondPositions; // key: BookID, value: Position
+    const ProductRegistry& registry;
+    vector<optional<Position<Bond> > > bondPositions; // indexed by product handle
     vector<ServiceListener<Position<Bond> >* > bondPositionListeners;
+    int batchDepth;
+    vector<ProductHandle> changedHandles; // products changed in the open batch, in first-change order
+    vector<char> changed; // 0 unchanged, 1 opened in the batch, 2 updated in the batch; indexed by product handle
+    vector<Position<Bond> > notified; // copies of a run of changed positions, reused from batch to batch
+
+    // Tell the listeners about a position once its changes are in
+    void Notify(Position<Bond>& position, bool opened) {
+        for(auto & bondPositionListener : bondPositionListeners) {
+            if (opened)
+                bondPositionListener->ProcessAdd(position);
+            else
+                bondPositionListener->ProcessUpdate(position);
+        }
+    }
 public:
+    explicit BondPositionService(const ProductRegistry& _registry): registry(_registry), bondPositions(_registry.Size()), batchDepth(0), changed(_registry.Size(), 0) {}
+
+    // Hold back position notifications until the matching EndBatch; batches nest
+    void BeginBatch() {
+        ++batchDepth;
+    }
+
+    // Close a batch; the outermost one notifies each changed position once, with its net change.
+    // Positions opened or updated one after another go to each listener as one batch.
+    void EndBatch() {
+        if (--batchDepth > 0)
+            return;
+        size_t i = 0;
+        while (i < changedHandles.size()) {
+            bool opened = changed[changedHandles[i]] == 1;
+            size_t count = 0;
+            for (; i < changedHandles.size() && (changed[changedHandles[i]] == 1) == opened; ++i, ++count) {
+                ProductHandle handle = changedHandles[i];
+                changed[handle] = 0;
+                if (count < notified.size())
+                    notified[count] = *bondPositions[handle];
+                else
+                    notified.push_back(*bondPositions[handle]);
+            }
+            span<Position<Bond> > run(notified.data(), count);
+            for(auto & bondPositionListener : bondPositionListeners) {
+                if (opened)
+                    bondPositionListener->ProcessAddBatch(run);
+                else
+                    bondPositionListener->ProcessUpdateBatch(run);
+            }
+        }
+        changedHandles.clear();
+    }
+
     Position<Bond>& GetData(string key) override {
-        return bondPositions.find(key)->second;
+        return bondPositions.at(registry.Find(key)).value();
+    }
+
+    // Get the aggregate position of a product, 0 if it has none
+    long GetAggregatePosition(ProductHandle handle) {
+        optional<Position<Bond> >& slot = bondPositions.at(handle);
+        return slot ? slot->GetAggregatePosition() : 0;
     }
 
     void OnMessage(Position<Bond> &data) override {}
@@ -112,23 +172,26 @@ public:
     }
 
     void AddTrade(const Trade<Bond> &trade) override {
-        string bondID = trade.GetProduct().GetProductId();
         string bookID = trade.GetBook();
         long quantity = trade.GetQuantity();
         Side side = trade.GetSide();
         if(side==SELL)
             quantity = -quantity;
-        auto tmp = bondPositions.find(bondID);
-        if (tmp == bondPositions.end()) {
-            Position<Bond> pos(trade.GetProduct());
-            pos.ChangePosition(quantity, bookID);
-            bondPositions.insert(make_pair(bondID, pos));
-            for(auto & bondPositionListener : bondPositionListeners)
-                bondPositionListener->ProcessAdd(pos);
-        } else {
-            tmp->second.ChangePosition(quantity, bookID);
-            for(auto & bondPositionListener : bondPositionListeners)
-                bondPositionListener->ProcessUpdate(tmp->second);
+        ProductHandle handle = registry.HandleOf(trade.GetProduct());
+        if (handle == ProductRegistry::NOT_FOUND)
+            return;
+        optional<Position<Bond> >& slot = bondPositions[handle];
+        bool opened = !slot;
+        if (opened)
+            slot.emplace(trade.GetProduct());
+        slot->ChangePosition(quantity, bookID);
+        if (batchDepth == 0) {
+            Notify(*slot, opened);
+            return;
+        }
+        if (changed[handle] == 0) {
+            changedHandles.push_back(handle);
+            changed[handle] = opened ? 1 : 2;
         }
     }
 };
@@ -160,4 +223,82 @@ public:
     }
 };
 
+/**
+ * Books a batch of trades inside one position batch, so each position they move is notified once.
+ */
+class BondTradeBatchBooker: public ServiceListener<vector<Trade<Bond> > > {
+private:
+    BondTradeBookService& bondTradeBookService;
+    BondPositionService& bondPositionService;
+public:
+    BondTradeBatchBooker(BondTradeBookService& tradeService, BondPositionService& positionService):
+        bondTradeBookService(tradeService), bondPositionService(positionService) {}
+
+    virtual ~BondTradeBatchBooker() = default;
+
+    void ProcessAdd(vector<Trade<Bond> > &data) override {
+        bondPositionService.BeginBatch();
+        for (auto & trade : data)
+            bondTradeBookService.BookTrade(trade);
+        bondPositionService.EndBatch();
+    }
+
+    void ProcessRemove(vector<Trade<Bond> > &data) override {}
+
+    void ProcessUpdate(vector<Trade<Bond> > &data) override {}
+};
+
+/**
+ * Turns the fills that venues report into trades to book.
+ * Fills are held until the order that caused them has gone through every venue
+ * listener, then sent on as one batch, so a sweep through several levels moves
+ * each position once. Register it on BondExecutionService after the simulated
+ * venues so it hears the order once matching is done. The batches go to a
+ * BondTradeBatchBooker, or to a LinkQueue in front of one when positions are
+ * kept on another thread.
+ */
+class BondFillBookingListener: public ServiceListener<ExecutionReport<Bond> >, public ServiceListener<pair<Market, ExecutionOrder<Bond> > > {
+private:
+    ServiceListener<vector<Trade<Bond> > >& sink;
+    string book;
+    long fillNum;
+    vector<ExecutionReport<Bond> > fills;
+public:
+    explicit BondFillBookingListener(ServiceListener<vector<Trade<Bond> > >& _sink, string _book = "TRSY1"):
+        sink(_sink), book(_book), fillNum(0) {}
+
+    virtual ~BondFillBookingListener() = default;
+
+    // Send every fill held so far on to be booked; called at the end of each order's cycle
+    void Flush() {
+        if (fills.empty())
+            return;
+        vector<Trade<Bond> > trades;
+        trades.reserve(fills.size());
+        for (auto & fill : fills) {
+            string tradeID = "EX" + fill.GetOrderId() + "-" + to_string(++fillNum);
+            Side side = (fill.GetSide() == BID) ? BUY : SELL;
+            trades.emplace_back(fill.GetProduct(), tradeID, fill.GetPrice(), book, fill.GetQuantity(), side);
+        }
+        sink.ProcessAdd(trades);
+        fills.clear();
+    }
+
+    void ProcessAdd(ExecutionReport<Bond> &data) override {
+        ExecutionStatus status = data.GetStatus();
+        if ((status == ORDER_FILLED || status == ORDER_PARTIALLY_FILLED) && data.GetQuantity() > 0)
+            fills.push_back(data);
+    }
+
+    void ProcessRemove(ExecutionReport<Bond> &data) override {}
+
+    void ProcessUpdate(ExecutionReport<Bond> &data) override {}
+
+    void ProcessAdd(pair<Market, ExecutionOrder<Bond> > &data) override {Flush();}
+
+    void ProcessRemove(pair<Market, ExecutionOrder<Bond> > &data) override {}
+
+    void ProcessUpdate(pair<Market, ExecutionOrder<Bond> > &data) override {}
+};
+
 #endif
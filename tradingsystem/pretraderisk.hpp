@@ -0,0 +1,279 @@
+/**
+ * pretraderisk.hpp
+ * Defines the pre-trade risk gate BondExecutionService passes every order through.
+ *
+ * The gate refuses an order that is too large, that could take a position or
+ * a bucket's PV01 past its limit if it filled, or that would send more than
+ * the allowed number of orders to a venue in one rate window. Positions are
+ * mirrored from BondPositionService as fills are booked and PV01 per unit is
+ * mirrored from BondRiskService as it changes, re-basing the bucket it is in,
+ * so a check reads a few arrays indexed by product handle, bucket and venue
+ * and never allocates or looks up a string. How long each check takes is
+ * counted in a LatencyHistogram. Positions and PV01s may be mirrored on
+ * another thread than the one checking orders: the mirrored positions, PV01s
+ * and bucket PV01s are atomics, written only by the mirroring side.
+ */
+#ifndef PRE_TRADE_RISK_HPP
+#define PRE_TRADE_RISK_HPP
+
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include "soa.hpp"
+#include "productregistry.hpp"
+#include "executionservice.hpp"
+#include "positionservice.hpp"
+#include "riskservice.hpp"
+#include "latencyhistogram.hpp"
+
+using namespace std;
+
+// Outcome of a pre-trade check
+enum RiskCheckResult { RISK_PASSED, RISK_ORDER_SIZE, RISK_POSITION, RISK_BUCKET_PV01, RISK_MESSAGE_RATE };
+
+const int RISK_RESULT_COUNT = 5;
+
+// Limits the gate enforces
+struct RiskLimits
+{
+  long maxOrderSize; // visible plus hidden quantity of one order
+  long maxPosition; // absolute aggregate position of a product
+  long maxMessages; // orders sent to one venue in one rate window
+  uint64_t rateWindow; // length of a rate window in nanoseconds
+};
+
+class BondPreTradeRiskGate : public PreTradeCheck<Bond>, public ServiceListener<Position<Bond> >, public ServiceListener<PV01<Bond> >
+{
+
+public:
+
+  // ctor for a gate over the positions booked so far and every product's PV01 per unit
+  BondPreTradeRiskGate(const ProductRegistry &_registry, BondPositionService &positionService, BondRiskService &riskService, const RiskLimits &_limits);
+
+  // Limit the PV01 of a bucket, the sum over its products of absolute position times PV01 per unit.
+  // A product is in at most one bucket; adding it to another moves it.
+  void AddBucket(const BucketedSector<Bond> &sector, double maxPV01);
+
+  // Check an order, count how long the check took and report a refused order as rejected
+  bool Admit(const ExecutionOrder<Bond> &order, Market market) override;
+
+  // Check an order at time now, in nanoseconds; an order that passes is counted against its venue's rate.
+  // An order that reduces a position or a bucket's PV01 passes those limits even while they are exceeded.
+  // An order for a bond outside the registry has no position to check against and fails RISK_POSITION.
+  RiskCheckResult Check(const ExecutionOrder<Bond> &order, Market market, uint64_t now);
+
+  // Mirror a position as it is opened or changed
+  void ProcessAdd(Position<Bond> &data) override;
+
+  void ProcessRemove(Position<Bond> &data) override;
+
+  void ProcessUpdate(Position<Bond> &data) override;
+
+  // Mirror a product's PV01 per unit as it changes
+  void ProcessAdd(PV01<Bond> &data) override;
+
+  void ProcessRemove(PV01<Bond> &data) override;
+
+  void ProcessUpdate(PV01<Bond> &data) override;
+
+  // Listen to the orders the gate refuses, as ORDER_REJECTED reports
+  void AddListener(ServiceListener<ExecutionReport<Bond> > *listener);
+
+  // Get the time each check took, in nanoseconds
+  const LatencyHistogram& GetLatency() const;
+
+  // Get the number of checks with a result
+  uint64_t GetCount(RiskCheckResult result) const;
+
+  // Get the position the gate holds for a product
+  long GetPosition(ProductHandle handle) const;
+
+  // Get a bucket's PV01, buckets numbered in the order they were added
+  double GetBucketPV01(int bucket) const;
+
+private:
+  static constexpr int NO_BUCKET = -1;
+
+  void Apply(ProductHandle handle, long position);
+
+  void Rebase(ProductHandle handle, double pv01);
+
+  const ProductRegistry& registry;
+  RiskLimits limits;
+  vector<atomic<long> > positions; // indexed by product handle
+  vector<atomic<double> > unitPV01; // indexed by product handle
+  vector<int> bucketOf; // indexed by product handle
+  deque<atomic<double> > bucketPV01;
+  vector<double> bucketLimit;
+  uint64_t windowStart[MARKET_COUNT];
+  long windowCount[MARKET_COUNT];
+  uint64_t results[RISK_RESULT_COUNT];
+  LatencyHistogram latency;
+  vector< ServiceListener<ExecutionReport<Bond> >* > rejectListeners;
+
+};
+
+BondPreTradeRiskGate::BondPreTradeRiskGate(const ProductRegistry &_registry, BondPositionService &positionService, BondRiskService &riskService, const RiskLimits &_limits) :
+  registry(_registry), limits(_limits), positions(_registry.Size()), unitPV01(_registry.Size()), bucketOf(_registry.Size(), NO_BUCKET)
+{
+  for (size_t h = 0; h < registry.Size(); ++h) {
+    positions[h].store(positionService.GetAggregatePosition(ProductHandle(h)), memory_order_relaxed);
+    unitPV01[h].store(riskService.GetData(registry.GetBond(ProductHandle(h)).GetProductId()).GetPV01(), memory_order_relaxed);
+  }
+  for (int v = 0; v < MARKET_COUNT; ++v) {
+    windowStart[v] = 0;
+    windowCount[v] = 0;
+  }
+  for (int r = 0; r < RISK_RESULT_COUNT; ++r)
+    results[r] = 0;
+}
+
+void BondPreTradeRiskGate::AddBucket(const BucketedSector<Bond> &sector, double maxPV01)
+{
+  int bucket = int(bucketLimit.size());
+  bucketLimit.push_back(maxPV01);
+  bucketPV01.emplace_back(0.);
+  for (const Bond &bond : sector.GetProducts()) {
+    ProductHandle handle = registry.HandleOf(bond);
+    if (handle == ProductRegistry::NOT_FOUND)
+      continue;
+    double exposure = double(labs(positions[handle].load(memory_order_relaxed))) * unitPV01[handle].load(memory_order_relaxed);
+    if (bucketOf[handle] != NO_BUCKET)
+      bucketPV01[bucketOf[handle]].fetch_sub(exposure, memory_order_relaxed);
+    bucketOf[handle] = bucket;
+    bucketPV01[bucket].fetch_add(exposure, memory_order_relaxed);
+  }
+}
+
+bool BondPreTradeRiskGate::Admit(const ExecutionOrder<Bond> &order, Market market)
+{
+  auto start = chrono::steady_clock::now();
+  uint64_t now = uint64_t(chrono::duration_cast<chrono::nanoseconds>(start.time_since_epoch()).count());
+  RiskCheckResult result = Check(order, market, now);
+  latency.Record(uint64_t(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count()));
+  if (result == RISK_PASSED)
+    return true;
+  ExecutionReport<Bond> report(order.GetProduct(), order.GetOrderId(), market, order.GetSide(), ORDER_REJECTED, order.GetPrice(),
+    order.GetVisibleQuantity() + order.GetHiddenQuantity(), 0);
+  for (auto &listener : rejectListeners)
+    listener->ProcessAdd(report);
+  return false;
+}
+
+RiskCheckResult BondPreTradeRiskGate::Check(const ExecutionOrder<Bond> &order, Market market, uint64_t now)
+{
+  RiskCheckResult result = RISK_PASSED;
+  ProductHandle handle = registry.HandleOf(order.GetProduct());
+  if (handle == ProductRegistry::NOT_FOUND) {
+    ++results[RISK_POSITION];
+    return RISK_POSITION;
+  }
+  long quantity = order.GetVisibleQuantity() + order.GetHiddenQuantity();
+  long position = positions[handle].load(memory_order_relaxed);
+  long current = labs(position);
+  long projected = labs(position + (order.GetSide() == BID ? quantity : -quantity));
+  int bucket = bucketOf[handle];
+  if (quantity > limits.maxOrderSize) {
+    result = RISK_ORDER_SIZE;
+  } else if (projected > limits.maxPosition && projected > current) {
+    result = RISK_POSITION;
+  } else if (bucket != NO_BUCKET && projected > current
+    && bucketPV01[bucket].load(memory_order_relaxed) + double(projected - current) * unitPV01[handle].load(memory_order_relaxed) > bucketLimit[bucket]) {
+    result = RISK_BUCKET_PV01;
+  } else {
+    if (now - windowStart[market] >= limits.rateWindow) {
+      windowStart[market] = now;
+      windowCount[market] = 0;
+    }
+    if (windowCount[market] >= limits.maxMessages)
+      result = RISK_MESSAGE_RATE;
+    else
+      ++windowCount[market];
+  }
+  ++results[result];
+  return result;
+}
+
+// Move the product's share of its bucket's PV01 along with its position
+void BondPreTradeRiskGate::Apply(ProductHandle handle, long position)
+{
+  if (handle == ProductRegistry::NOT_FOUND)
+    return;
+  int bucket = bucketOf[handle];
+  if (bucket != NO_BUCKET)
+    bucketPV01[bucket].fetch_add(double(labs(position) - labs(positions[handle].load(memory_order_relaxed))) * unitPV01[handle].load(memory_order_relaxed),
+      memory_order_relaxed);
+  positions[handle].store(position, memory_order_relaxed);
+}
+
+// Move the product's share of its bucket's PV01 along with its PV01 per unit
+void BondPreTradeRiskGate::Rebase(ProductHandle handle, double pv01)
+{
+  if (handle == ProductRegistry::NOT_FOUND)
+    return;
+  double old = unitPV01[handle].load(memory_order_relaxed);
+  if (pv01 == old)
+    return;
+  int bucket = bucketOf[handle];
+  if (bucket != NO_BUCKET)
+    bucketPV01[bucket].fetch_add(double(labs(positions[handle].load(memory_order_relaxed))) * (pv01 - old), memory_order_relaxed);
+  unitPV01[handle].store(pv01, memory_order_relaxed);
+}
+
+void BondPreTradeRiskGate::ProcessAdd(Position<Bond> &data)
+{
+  Apply(registry.HandleOf(data.GetProduct()), data.GetAggregatePosition());
+}
+
+void BondPreTradeRiskGate::ProcessRemove(Position<Bond> &data)
+{
+}
+
+void BondPreTradeRiskGate::ProcessUpdate(Position<Bond> &data)
+{
+  Apply(registry.HandleOf(data.GetProduct()), data.GetAggregatePosition());
+}
+
+void BondPreTradeRiskGate::ProcessAdd(PV01<Bond> &data)
+{
+  Rebase(registry.HandleOf(data.GetProduct()), data.GetPV01());
+}
+
+void BondPreTradeRiskGate::ProcessRemove(PV01<Bond> &data)
+{
+}
+
+void BondPreTradeRiskGate::ProcessUpdate(PV01<Bond> &data)
+{
+  Rebase(registry.HandleOf(data.GetProduct()), data.GetPV01());
+}
+
+void BondPreTradeRiskGate::AddListener(ServiceListener<ExecutionReport<Bond> > *listener)
+{
+  rejectListeners.push_back(listener);
+}
+
+const LatencyHistogram& BondPreTradeRiskGate::GetLatency() const
+{
+  return latency;
+}
+
+uint64_t BondPreTradeRiskGate::GetCount(RiskCheckResult result) const
+{
+  return results[result];
+}
+
+long BondPreTradeRiskGate::GetPosition(ProductHandle handle) const
+{
+  return positions[handle].load(memory_order_relaxed);
+}
+
+double BondPreTradeRiskGate::GetBucketPV01(int bucket) const
+{
+  return bucketPV01[bucket].load(memory_order_relaxed);
+}
+
+#endif
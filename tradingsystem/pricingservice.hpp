@@ -9,12 +9,18 @@
 
 #include <string>
 #include <fstream>
+#include <optional>
 #include "soa.hpp"
 #include "products.hpp"
+#include "productregistry.hpp"
+#include "streamreader.hpp"
+#include "fractionalprice.hpp"
 
 /**
  * A price object consisting of mid and bid/offer spread.
- * Type T is the product type.
+ * The bid and offer are what is kept, so both come back exactly even when
+ * the mid falls between two ticks; the mid is rounded down onto the grid.
+ * Type T is the product type; the product is referenced, not copied, and must outlive the price.
  */
 template<typename T>
 class Price
@@ -22,22 +28,29 @@ class Price
 
 public:
 
-  // ctor for a price
-  Price(const T &_product, double _mid, double _bidOfferSpread);
+  // ctor for a price around a mid on the grid; an odd spread puts the extra tick on the offer
+  Price(const T &_product, TickPrice _mid, TickPrice _bidOfferSpread);
+
+  // Make a price from its bid and offer
+  static Price FromBidOffer(const T &product, TickPrice bid, TickPrice offer);
 
   // Get the product
   const T& GetProduct() const;
 
-  // Get the mid price
-  double GetMid() const;
+  // Get the mid price, rounded down to the grid when bid and offer are an odd number of ticks apart
+  TickPrice GetMid() const;
 
   // Get the bid/offer spread around the mid
-  double GetBidOfferSpread() const;
+  TickPrice GetBidOfferSpread() const;
+
+  // Get the bid and the offer
+  TickPrice GetBid() const;
+  TickPrice GetOffer() const;
 
 private:
-  const T& product;
-  double mid;
-  double bidOfferSpread;
+  const T* product;
+  TickPrice bid;
+  TickPrice offer;
 
 };
 
@@ -52,48 +65,75 @@ class PricingService : public Service<string,Price <T> >
 };
 
 template<typename T>
-Price<T>::Price(const T &_product, double _mid, double _bidOfferSpread) :
-  product(_product)
+Price<T>::Price(const T &_product, TickPrice _mid, TickPrice _bidOfferSpread) :
+  product(&_product)
 {
-  mid = _mid;
-  bidOfferSpread = _bidOfferSpread;
+  bid = _mid - _bidOfferSpread.Half();
+  offer = bid + _bidOfferSpread;
+}
+
+template<typename T>
+Price<T> Price<T>::FromBidOffer(const T &product, TickPrice bid, TickPrice offer)
+{
+  Price<T> price(product, bid, TickPrice());
+  price.offer = offer;
+  return price;
 }
 
 template<typename T>
 const T& Price<T>::GetProduct() const
 {
-  return product;
+  return *product;
+}
+
+template<typename T>
+TickPrice Price<T>::GetMid() const
+{
+  return Midpoint(bid, offer);
 }
 
 template<typename T>
-double Price<T>::GetMid() const
+TickPrice Price<T>::GetBidOfferSpread() const
 {
-  return mid;
+  return offer - bid;
 }
 
 template<typename T>
-double Price<T>::GetBidOfferSpread() const
+TickPrice Price<T>::GetBid() const
 {
-  return bidOfferSpread;
+  return bid;
 }
 
+template<typename T>
+TickPrice Price<T>::GetOffer() const
+{
+  return offer;
+}
+
+static_assert(is_trivially_copyable_v<Price<Bond> >, "prices are passed by value on the hot path");
+
 class BondPriceService: public PricingService<Bond> {
 private:
-    map<string, Price<Bond> > bondPrices;
+    const ProductRegistry& registry;
+    vector<optional<Price<Bond> > > bondPrices; // indexed by product handle
     vector<ServiceListener<Price<Bond> >* > bondPriceListeners;
 
 public:
+    explicit BondPriceService(const ProductRegistry& _registry): registry(_registry), bondPrices(_registry.Size()) {}
+
     Price<Bond>& GetData(string key) override{
-        return bondPrices.find(key)->second;
+        return bondPrices.at(registry.Find(key)).value();
     }
 
+    // A price for a bond outside the registry is ignored
     void OnMessage(Price<Bond> &data) override {
-        string productId = data.GetProduct().GetProductId();
-        if(bondPrices.find(productId) != bondPrices.end())
-            bondPrices.erase(productId);
-        bondPrices.insert(make_pair(productId, data));
+        ProductHandle handle = registry.HandleOf(data.GetProduct());
+        if (handle == ProductRegistry::NOT_FOUND)
+            return;
+        optional<Price<Bond> >& slot = bondPrices[handle];
+        slot.emplace(data);
         for (auto & listener : bondPriceListeners)
-            listener->ProcessAdd(bondPrices.find(productId)->second);
+            listener->ProcessAdd(*slot);
     }
 
     void AddListener(ServiceListener<Price<Bond> > *listener) override {
@@ -107,59 +147,37 @@ public:
 
 class BondPriceConnector: public Connector<Price<Bond> > {
 private:
-    int counter;
+    StreamReader reader;
 public:
-    BondPriceConnector():counter(0){}
+    explicit BondPriceConnector(const string& path = "./Input/prices.txt"):reader(path){}
 
     virtual void Publish(Price<Bond> &data){}
 
-    virtual void Subscribe(BondPriceService& bprice_service, map<string, Bond> m_bond) {
-        ifstream iFile;
-        iFile.open("./Input/prices.txt");
-        string line;
-        try{
-            for (int i = 0; i < counter; ++i)
-                getline(iFile,line);
-        } catch(...){
-            iFile.close();
-            return;
-        }
-        if (getline(iFile, line)) {
-            ++counter;
-            stringstream sStream(line);
-            string tmp;
-            vector<string> data;
-            while (getline(sStream, tmp, ',')) {
-                data.push_back(tmp);
-            }
-            string bondId = data[0];
-            int index = 0;
-            for (; index < data[1].size(); ++index) {
-                if (data[1][index] == '-')
-                    break;
-            }
-            double bid1 = stod(data[1].substr(0, index));
-            string bid_string = data[1].substr(index + 1);
-            bid1 += (bid_string[2]=='+')?0.:(stoi(bid_string.substr(2)) / 256.);
-            bid1 += stod(bid_string.substr(0, 2)) / 32.;
-            index = 0;
-            for (; index < data[2].size(); ++index) {
-                if (data[2][index] == '-')
-                    break;
-            }
-            double offer1 = stod(data[2].substr(0, index));
-            string offer_string = data[2].substr(index + 1);
-            offer1 += (offer_string[2]=='+')?0.:(stoi(offer_string.substr(2)) / 256.);
-            offer1 += stod(offer_string.substr(0, 2)) / 32.;
-            double spread = stod(data[3]) / 256.;
-            double mid = (bid1 + offer1) / 2.;
-            Bond product = m_bond[bondId];
-            Price<Bond> bondPrice(product , mid, spread);
-            bprice_service.OnMessage(bondPrice);
-        }
-        iFile.close();
+    // Push the next price in the file to the service; returns false once the file is exhausted
+    virtual bool Subscribe(BondPriceService& bprice_service, const ProductRegistry& registry) {
+        string_view line;
+        if (!reader.NextLine(line))
+            return false;
+        string_view data[4];
+        if (SplitFields(line, data, 4) < 4)
+            return true;
+        ProductHandle handle = registry.Find(data[0]);
+        if (handle == ProductRegistry::NOT_FOUND)
+            return true;
+        TickPrice bid1 = ParseTickPrice(data[1]);
+        TickPrice offer1 = ParseTickPrice(data[2]);
+        Price<Bond> bondPrice = Price<Bond>::FromBidOffer(registry.GetBond(handle), bid1, offer1);
+        bprice_service.OnMessage(bondPrice);
+        return true;
     }
-};
 
+    // Push every remaining price in the file to the service in one pass
+    long SubscribeAll(BondPriceService& bprice_service, const ProductRegistry& registry) {
+        long count = 0;
+        while (Subscribe(bprice_service, registry))
+            ++count;
+        return count;
+    }
+};
 
 #endif
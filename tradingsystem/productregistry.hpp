@@ -0,0 +1,141 @@
+/**
+ * productregistry.hpp
+ * Defines the registry that interns every bond into a dense integer handle.
+ *
+ * The registry is built once at startup from Input/bonds.txt and is immutable
+ * afterwards, so every Bond has a stable address for the life of the registry.
+ * Messages refer to that single interned Bond instead of carrying a copy, and
+ * services keep their per-product state in flat vectors indexed by the handle;
+ * a product identifier is only hashed once at ingest, as a SecurityId.
+ */
+#ifndef PRODUCT_REGISTRY_HPP
+#define PRODUCT_REGISTRY_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <charconv>
+#include <iostream>
+#include "products.hpp"
+#include "securityid.hpp"
+#include "streamreader.hpp"
+
+using namespace std;
+
+// Dense product handle, from 0 to the number of registered products
+using ProductHandle = uint32_t;
+
+class ProductRegistry
+{
+
+public:
+
+  // Handle returned for an unknown product identifier
+  static const ProductHandle NOT_FOUND = UINT32_MAX;
+
+  // ctor for a registry loaded from a bonds file of id,coupon,ticker,maturity lines
+  explicit ProductRegistry(const string &path);
+
+  // ctor for a registry over the given bonds; a repeated id keeps its first bond.
+  // Bonds whose id fails its check digit are rejected at ingest.
+  explicit ProductRegistry(const vector<Bond> &_bonds);
+
+  ProductRegistry(const ProductRegistry&) = delete;
+  ProductRegistry& operator=(const ProductRegistry&) = delete;
+
+  // Get the handle of a product identifier, or NOT_FOUND
+  ProductHandle Find(string_view productId) const;
+  ProductHandle Find(const SecurityId &securityId) const;
+
+  // Get the handle of a bond; O(1) for a bond owned by this registry
+  ProductHandle HandleOf(const Bond &bond) const;
+
+  // Get the bond behind a handle
+  const Bond& GetBond(ProductHandle handle) const;
+
+  // Get the number of registered products
+  size_t Size() const;
+
+  // Get all registered bonds in handle order
+  const vector<Bond>& GetBonds() const;
+
+private:
+  void Add(const Bond &bond);
+
+  vector<Bond> bonds;
+  unordered_map<SecurityId, ProductHandle> handles;
+
+};
+
+ProductRegistry::ProductRegistry(const string &path)
+{
+  StreamReader reader(path);
+  string_view line;
+  while (reader.NextLine(line)) {
+    string_view data[4];
+    if (SplitFields(line, data, 4) < 4)
+      continue;
+    float coupon = 0;
+    from_chars(data[1].data(), data[1].data() + data[1].size(), coupon);
+    date maturity(from_simple_string(string(data[3])));
+    Add(Bond(string(data[0]), CUSIP, string(data[2]), coupon, maturity));
+  }
+  bonds.shrink_to_fit();
+}
+
+ProductRegistry::ProductRegistry(const vector<Bond> &_bonds)
+{
+  for (const Bond &bond : _bonds)
+    Add(bond);
+  bonds.shrink_to_fit();
+}
+
+void ProductRegistry::Add(const Bond &bond)
+{
+  if (!bond.HasValidId()) {
+    cerr << "ProductRegistry: rejecting " << bond.GetProductId() << ", bad check digit" << endl;
+    return;
+  }
+  if (handles.find(bond.GetSecurityId()) != handles.end())
+    return;
+  handles.emplace(bond.GetSecurityId(), ProductHandle(bonds.size()));
+  bonds.push_back(bond);
+}
+
+ProductHandle ProductRegistry::Find(string_view productId) const
+{
+  return Find(SecurityId(productId));
+}
+
+ProductHandle ProductRegistry::Find(const SecurityId &securityId) const
+{
+  auto it = handles.find(securityId);
+  return (it == handles.end()) ? NOT_FOUND : it->second;
+}
+
+ProductHandle ProductRegistry::HandleOf(const Bond &bond) const
+{
+  const Bond* first = bonds.data();
+  if (&bond >= first && &bond < first + bonds.size())
+    return ProductHandle(&bond - first);
+  return Find(bond.GetSecurityId());
+}
+
+const Bond& ProductRegistry::GetBond(ProductHandle handle) const
+{
+  return bonds[handle];
+}
+
+size_t ProductRegistry::Size() const
+{
+  return bonds.size();
+}
+
+const vector<Bond>& ProductRegistry::GetBonds() const
+{
+  return bonds;
+}
+
+#endif
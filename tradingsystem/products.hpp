@@ -11,6 +11,7 @@
 #include <string>
 
 #include "boost/date_time/gregorian/gregorian.hpp"
+#include "securityid.hpp"
 
 using namespace std;
 using namespace boost::gregorian;
@@ -66,11 +67,17 @@ public:
   // Get the bond identifier type
   BondIdType GetBondIdType() const;
 
+  // Get the bond identifier as a fixed-width key
+  const SecurityId& GetSecurityId() const;
+
+  // Check the identifier's check digit for its id type
+  bool HasValidId() const;
+
   // Print the bond
   friend ostream& operator<<(ostream &output, const Bond &bond);
 
 private:
-  string productId;
+  SecurityId securityId;
   BondIdType bondIdType;
   string ticker;
   float coupon;
@@ -175,7 +182,7 @@ ProductType Product::GetProductType() const
   return productType;
 }
 
-Bond::Bond(string _productId, BondIdType _bondIdType, string _ticker, float _coupon, date _maturityDate) : Product(_productId, BOND)
+Bond::Bond(string _productId, BondIdType _bondIdType, string _ticker, float _coupon, date _maturityDate) : Product(_productId, BOND), securityId(_productId)
 {
   bondIdType = _bondIdType;
   ticker = _ticker;
@@ -207,6 +214,16 @@ BondIdType Bond::GetBondIdType() const
   return bondIdType;
 }
 
+const SecurityId& Bond::GetSecurityId() const
+{
+  return securityId;
+}
+
+bool Bond::HasValidId() const
+{
+  return bondIdType == CUSIP ? securityId.IsValidCusip() : securityId.IsValidIsin();
+}
+
 ostream& operator<<(ostream &output, const Bond &bond)
 {
   output << bond.ticker << " " << bond.coupon << " " << bond.GetMaturityDate();
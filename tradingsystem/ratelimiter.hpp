@@ -0,0 +1,182 @@
+/**
+ * ratelimiter.hpp
+ * Defines a cheap clock, lock-free token bucket rate limits and a kill switch.
+ *
+ * A token bucket is kept in the form of the generic cell rate algorithm: the
+ * only state is the time at which the bucket will next be full, so taking a
+ * token is one compare-and-swap on one atomic and threads never block each
+ * other. Each key's state sits on its own cache line so threads limiting
+ * different keys do not contend. Times are CycleClock ticks: the time stamp
+ * counter on x86-64, the steady clock in nanoseconds elsewhere.
+ */
+#ifndef RATE_LIMITER_HPP
+#define RATE_LIMITER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+using namespace std;
+
+/**
+ * A monotonic tick counter that costs a few nanoseconds to read.
+ */
+class CycleClock
+{
+
+public:
+
+  // Get the current tick
+  static uint64_t Now();
+
+  // Get the number of ticks in a second, measured once against the steady clock
+  static double TicksPerSecond();
+
+  // Convert nanoseconds to ticks
+  static uint64_t FromNanos(double nanos);
+
+};
+
+uint64_t CycleClock::Now()
+{
+#if defined(__x86_64__)
+  return __rdtsc();
+#else
+  return uint64_t(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+double CycleClock::TicksPerSecond()
+{
+#if defined(__x86_64__)
+  static const double rate = [] {
+    auto start = chrono::steady_clock::now();
+    uint64_t first = Now();
+    while (chrono::steady_clock::now() - start < chrono::milliseconds(10)) {}
+    uint64_t last = Now();
+    return double(last - first) / chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  }();
+  return rate;
+#else
+  return 1e9;
+#endif
+}
+
+uint64_t CycleClock::FromNanos(double nanos)
+{
+  return uint64_t(nanos * TicksPerSecond() * 1e-9);
+}
+
+/**
+ * A token bucket per key, keys numbered densely from 0.
+ * Limits are set before the limiter is shared; taking tokens is safe from any thread.
+ */
+class RateLimiter
+{
+
+public:
+
+  // ctor for keys that each allow ratePerSecond tokens with bursts of up to burst
+  RateLimiter(size_t keys, double ratePerSecond, long burst);
+
+  // Change one key's limit; not safe while other threads take tokens
+  void SetLimit(size_t key, double ratePerSecond, long burst);
+
+  // Take a token for key at tick now if one is free by now + maxWait. On success due is the tick
+  // the token is free at, at once or up to maxWait later; on failure nothing is taken.
+  bool TryAcquire(size_t key, uint64_t now, uint64_t maxWait, uint64_t &due);
+
+private:
+  struct alignas(64) Bucket
+  {
+    atomic<uint64_t> full; // tick at which the bucket is full again
+    uint64_t interval; // ticks per token
+    uint64_t tolerance; // ticks the bucket may run ahead: interval times (burst - 1)
+  };
+
+  vector<Bucket> buckets;
+
+};
+
+RateLimiter::RateLimiter(size_t keys, double ratePerSecond, long burst) : buckets(keys)
+{
+  for (size_t key = 0; key < keys; ++key)
+    SetLimit(key, ratePerSecond, burst);
+}
+
+void RateLimiter::SetLimit(size_t key, double ratePerSecond, long burst)
+{
+  Bucket &bucket = buckets[key];
+  bucket.full.store(0, memory_order_relaxed);
+  bucket.interval = uint64_t(CycleClock::TicksPerSecond() / ratePerSecond);
+  bucket.tolerance = bucket.interval * uint64_t(burst > 1 ? burst - 1 : 0);
+}
+
+bool RateLimiter::TryAcquire(size_t key, uint64_t now, uint64_t maxWait, uint64_t &due)
+{
+  Bucket &bucket = buckets[key];
+  uint64_t full = bucket.full.load(memory_order_relaxed);
+  while (true) {
+    uint64_t free = (full > now + bucket.tolerance) ? full - bucket.tolerance : now;
+    if (free - now > maxWait)
+      return false;
+    uint64_t next = ((full > now) ? full : now) + bucket.interval;
+    if (bucket.full.compare_exchange_weak(full, next, memory_order_relaxed)) {
+      due = free;
+      return true;
+    }
+  }
+}
+
+/**
+ * A switch that stops every outbound order at once, from any thread.
+ */
+class KillSwitch
+{
+
+public:
+
+  // Stop every order from now on
+  void Halt();
+
+  // Let orders through again
+  void Resume();
+
+  // Whether orders are stopped
+  bool IsHalted() const;
+
+  // Get the switch the whole process shares
+  static KillSwitch& Global();
+
+private:
+  atomic<bool> halted{false};
+
+};
+
+void KillSwitch::Halt()
+{
+  halted.store(true, memory_order_release);
+}
+
+void KillSwitch::Resume()
+{
+  halted.store(false, memory_order_release);
+}
+
+bool KillSwitch::IsHalted() const
+{
+  return halted.load(memory_order_acquire);
+}
+
+KillSwitch& KillSwitch::Global()
+{
+  static KillSwitch global;
+  return global;
+}
+
+#endif
@@ -9,10 +9,11 @@
 
 #include "soa.hpp"
 #include "positionservice.hpp"
+#include "productregistry.hpp"
 
 /**
  * PV01 risk.
- * Type T is the product type.
+ * Type T is the product type; the product is referenced, not copied, and must outlive the value.
  */
 template<typename T>
 class PV01
@@ -24,7 +25,7 @@ public:
   PV01(const T &_product, double _pv01, long _quantity);
 
   // Get the product on this PV01 value
-  const T& GetProduct() const {return product;}
+  const T& GetProduct() const {return *product;}
 
   // Get the PV01 value
   double GetPV01() const {return pv01;}
@@ -34,8 +35,11 @@ public:
 
     void AddQuantity(long q){quantity+=q;}
 
+    // Set the PV01 value
+    void SetPV01(double _pv01){pv01=_pv01;}
+
 private:
-  T product;
+  const T* product;
   double pv01;
   long quantity;
 
@@ -88,7 +92,7 @@ public:
 
 template<typename T>
 PV01<T>::PV01(const T &_product, double _pv01, long _quantity) :
-  product(_product)
+  product(&_product)
 {
   pv01 = _pv01;
   quantity = _quantity;
@@ -117,23 +121,32 @@ using SectorsRisk=tuple<PV01<BucketedSector<Bond> >, PV01<BucketedSector<Bond> >
 
 class BondRiskService: public RiskService<Bond> {
 private:
-    map<string, PV01<Bond> > bondRiskCache;
+    const ProductRegistry& registry;
+    vector<PV01<Bond> > bondRiskCache; // indexed by product handle
     vector<ServiceListener<PV01<Bond> >* > bondRiskListeners;
     vector<ServiceListener<SectorsRisk>* > bondSectorRiskListeners;
-    map<string, double> bondPV01;
+    vector<ProductHandle> touchedHandles; // products a batch of positions moved, in first-move order
+    vector<char> touched; // indexed by product handle
 public:
-    BondRiskService(map<string,double>& bondPV01_, map<string,Bond> m_bond):bondPV01(bondPV01_){
-        for(auto & it : m_bond){
-            Bond bnd = it.second;//get second
-            string bondid = it.first;//get first
-            double pv = bondPV01.find(bondid)->second;//get pv
-            PV01<Bond> thepv01(bnd,pv,0);//construct one
-            bondRiskCache.insert(make_pair(bondid,thepv01));
+    BondRiskService(const map<string,double>& bondPV01, const ProductRegistry& _registry):registry(_registry), touched(_registry.Size(), 0){
+        bondRiskCache.reserve(registry.Size());
+        for(const Bond& bnd : registry.GetBonds()){
+            auto pv = bondPV01.find(bnd.GetProductId());//get pv
+            bondRiskCache.emplace_back(bnd, pv == bondPV01.end() ? 0. : pv->second, 0);
         }
     }
-    void UpdateBondPV01(string bondid, double newpv01) {}
+    // Change a bond's PV01 per unit; listeners hear the new value. A bond outside the registry is ignored.
+    void UpdateBondPV01(string bondid, double newpv01) {
+        ProductHandle handle = registry.Find(bondid);
+        if (handle == ProductRegistry::NOT_FOUND)
+            return;
+        PV01<Bond>& pv01 = bondRiskCache[handle];
+        pv01.SetPV01(newpv01);
+        for(auto & listener : bondRiskListeners)
+            listener->ProcessUpdate(pv01);
+    }
 
-    PV01<Bond>& GetData(string key) override{return bondRiskCache.find(key)->second;}
+    PV01<Bond>& GetData(string key) override{return bondRiskCache.at(registry.Find(key));}
 
     void OnMessage(PV01<Bond> &data) override {}//do nothing as no need for connector
 
@@ -143,19 +156,42 @@ public:
 
     const vector< ServiceListener<PV01<Bond> >* >& GetListeners() const override {return bondRiskListeners;}
 
-    void AddPosition(Position<Bond> &position) override {}
+    // Carry the position's aggregate quantity on the product's PV01
+    void AddPosition(Position<Bond> &position) override {
+        PV01<Bond>& pv01 = bondRiskCache.at(registry.HandleOf(position.GetProduct()));
+        pv01.AddQuantity(position.GetAggregatePosition() - pv01.GetQuantity());
+        for(auto & listener : bondRiskListeners)
+            listener->ProcessUpdate(pv01);
+    }
+
+    // Carry a batch of positions onto their PV01s; listeners hear once per product, with its last quantity
+    void AddPositions(span<Position<Bond> > positions) {
+        for (auto & position : positions) {
+            ProductHandle handle = registry.HandleOf(position.GetProduct());
+            PV01<Bond>& pv01 = bondRiskCache.at(handle);
+            pv01.AddQuantity(position.GetAggregatePosition() - pv01.GetQuantity());
+            if (!touched[handle]) {
+                touched[handle] = 1;
+                touchedHandles.push_back(handle);
+            }
+        }
+        for (ProductHandle handle : touchedHandles) {
+            touched[handle] = 0;
+            for(auto & listener : bondRiskListeners)
+                listener->ProcessUpdate(bondRiskCache[handle]);
+        }
+        touchedHandles.clear();
+    }
 
     // Get the bucketed risk for the bucket sector
     const PV01<BucketedSector<Bond> > GetBucketedRisk(const BucketedSector<Bond> &sector) const override {
-        vector<Bond> bonds=sector.GetProducts();
+        const vector<Bond>& bonds=sector.GetProducts();
         double risk_bucket=0;
         long sum_quantity=0;
-        for(int i=0;i<bonds.size();++i){
+        for(size_t i=0;i<bonds.size();++i){
             //iterate bonds
-            Bond bnd=bonds[i];//get bond
-            string bid=bnd.GetProductId();//get bond id
+            const PV01<Bond>& thepv01 = bondRiskCache.at(registry.HandleOf(bonds[i]));//get the pv01 of this bond
             long q;
-            PV01<Bond>  thepv01(bondRiskCache.find(bid)->second);//get the pv01 of this bond
             q=thepv01.GetQuantity();//get quantity of the associated pv01
             q=abs(q);//always set q to be positive in calculation of pv01
             risk_bucket+=double(q)*thepv01.GetPV01();//get accumulate risk of the bucket
@@ -189,7 +225,17 @@ public:
     virtual void ProcessRemove(Position<Bond> &data){}
 
     // Listener callback to process an update event to the Service
-    virtual void ProcessUpdate(Position<Bond> &data){}
+    virtual void ProcessUpdate(Position<Bond> &data){
+        bnd_risk_service.AddPosition(data);
+    }
+
+    void ProcessAddBatch(span<Position<Bond> > data) override {
+        bnd_risk_service.AddPositions(data);
+    }
+
+    void ProcessUpdateBatch(span<Position<Bond> > data) override {
+        bnd_risk_service.AddPositions(data);
+    }
 
 };
 
@@ -0,0 +1,184 @@
+/**
+ * securityid.hpp
+ * Defines a fixed-width security identifier stored inline in 16 bytes.
+ *
+ * A CUSIP (9 characters) or ISIN (12 characters) is packed into a 16-byte
+ * block: the characters, zero padding, and the length in the last byte. Two
+ * ids compare equal with a single 16-byte vector compare and hash from two
+ * 64-bit words, so ids can key caches without heap strings.
+ */
+#ifndef SECURITY_ID_HPP
+#define SECURITY_ID_HPP
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <type_traits>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+using namespace std;
+
+class SecurityId
+{
+
+public:
+
+  // Longest identifier that fits inline
+  static const size_t MAX_LENGTH = 15;
+
+  // ctor for an empty id
+  constexpr SecurityId() : bytes{} {}
+
+  // ctor from a string literal, evaluated at compile time when possible
+  template<size_t N>
+  constexpr SecurityId(const char (&text)[N]) : bytes{}
+  {
+    static_assert(N - 1 <= MAX_LENGTH, "security id literal is too long");
+    for (size_t i = 0; i + 1 < N; ++i)
+      bytes[i] = text[i];
+    bytes[MAX_LENGTH] = char(N - 1);
+  }
+
+  // ctor from text; anything past MAX_LENGTH characters is dropped
+  constexpr explicit SecurityId(string_view text) : bytes{}
+  {
+    size_t n = text.size() < MAX_LENGTH ? text.size() : MAX_LENGTH;
+    for (size_t i = 0; i < n; ++i)
+      bytes[i] = text[i];
+    bytes[MAX_LENGTH] = char(n);
+  }
+
+  // Get the identifier text
+  constexpr string_view View() const { return string_view(bytes, Length()); }
+
+  // Get the number of characters in the identifier
+  constexpr size_t Length() const { return size_t(bytes[MAX_LENGTH]); }
+
+  // Get a hash of the identifier
+  size_t Hash() const;
+
+  // Check the identifier's length and check digit as a CUSIP
+  constexpr bool IsValidCusip() const;
+
+  // Check the identifier's length and check digit as an ISIN
+  constexpr bool IsValidIsin() const;
+
+  // Compare two ids; one 16-byte vector compare at run time
+  friend bool operator==(const SecurityId &lhs, const SecurityId &rhs);
+
+private:
+  static constexpr int CharValue(char c);
+
+  alignas(16) char bytes[MAX_LENGTH + 1];
+
+};
+
+static_assert(sizeof(SecurityId) == 16 && is_trivially_copyable_v<SecurityId>, "SecurityId must stay a 16-byte value type");
+
+inline bool operator==(const SecurityId &lhs, const SecurityId &rhs)
+{
+#if defined(__SSE2__)
+  __m128i a = _mm_load_si128(reinterpret_cast<const __m128i*>(lhs.bytes));
+  __m128i b = _mm_load_si128(reinterpret_cast<const __m128i*>(rhs.bytes));
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) == 0xFFFF;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  uint8x16_t a = vld1q_u8(reinterpret_cast<const uint8_t*>(lhs.bytes));
+  uint8x16_t b = vld1q_u8(reinterpret_cast<const uint8_t*>(rhs.bytes));
+  return vminvq_u8(vceqq_u8(a, b)) == 0xFF;
+#else
+  uint64_t a[2], b[2];
+  memcpy(a, lhs.bytes, 16);
+  memcpy(b, rhs.bytes, 16);
+  return ((a[0] ^ b[0]) | (a[1] ^ b[1])) == 0;
+#endif
+}
+
+inline bool operator!=(const SecurityId &lhs, const SecurityId &rhs)
+{
+  return !(lhs == rhs);
+}
+
+size_t SecurityId::Hash() const
+{
+  uint64_t words[2];
+  memcpy(words, bytes, 16);
+  uint64_t h = words[0] * 0x9E3779B97F4A7C15ULL ^ (words[1] + 0xC2B2AE3D27D4EB4FULL) * 0x165667B19E3779F9ULL;
+  h ^= h >> 29;
+  h *= 0xBF58476D1CE4E5B9ULL;
+  return size_t(h ^ (h >> 32));
+}
+
+constexpr int SecurityId::CharValue(char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'A' && c <= 'Z')
+    return c - 'A' + 10;
+  switch (c) {
+  case '*': return 36;
+  case '@': return 37;
+  case '#': return 38;
+  default: return -1;
+  }
+}
+
+// CUSIP: weight every second of the first 8 characters by 2, sum the digits,
+// and the 9th character is the tens complement of that sum
+constexpr bool SecurityId::IsValidCusip() const
+{
+  if (Length() != 9)
+    return false;
+  int sum = 0;
+  for (int i = 0; i < 8; ++i) {
+    int v = CharValue(bytes[i]);
+    if (v < 0)
+      return false;
+    if (i % 2 == 1)
+      v *= 2;
+    sum += v / 10 + v % 10;
+  }
+  return bytes[8] == char('0' + (10 - sum % 10) % 10);
+}
+
+// ISIN: expand letters to two digits, then apply the Luhn check to the
+// resulting digit string with the 12th character as the check digit
+constexpr bool SecurityId::IsValidIsin() const
+{
+  if (Length() != 12 || bytes[0] < 'A' || bytes[0] > 'Z' || bytes[1] < 'A' || bytes[1] > 'Z')
+    return false;
+  int digits[22] = {};
+  int count = 0;
+  for (int i = 0; i < 11; ++i) {
+    int v = CharValue(bytes[i]);
+    if (v < 0 || v > 35)
+      return false;
+    if (v >= 10)
+      digits[count++] = v / 10;
+    digits[count++] = v % 10;
+  }
+  int sum = 0;
+  bool doubled = true;
+  for (int i = count - 1; i >= 0; --i) {
+    int v = doubled ? digits[i] * 2 : digits[i];
+    sum += v / 10 + v % 10;
+    doubled = !doubled;
+  }
+  return bytes[11] == char('0' + (10 - sum % 10) % 10);
+}
+
+template<>
+struct std::hash<SecurityId>
+{
+  size_t operator()(const SecurityId &id) const { return id.Hash(); }
+};
+
+static_assert(SecurityId("91282CFX4").IsValidCusip() && !SecurityId("91282CFX5").IsValidCusip(), "CUSIP check digit");
+static_assert(SecurityId("US0378331005").IsValidIsin() && !SecurityId("US0378331006").IsValidIsin(), "ISIN check digit");
+
+#endif
@@ -0,0 +1,724 @@
+/**
+ * servicebus.hpp
+ * Defines the asynchronous service bus: bounded SPSC queues in front of services.
+ *
+ * An AsyncListener stands in for the listener a service would call: the
+ * upstream service's ProcessAdd, ProcessUpdate or ProcessRemove copies the
+ * event into a bounded single-producer single-consumer ring and returns, and
+ * the listener's own thread takes events off the ring, in order, and calls
+ * the real listener with them. The downstream service then runs on that
+ * thread while the upstream one goes on to its next event. A full ring makes
+ * the producer wait and an empty one the consumer, by spinning, yielding or
+ * blocking. Each queue counts its deepest backlog and how long events wait
+ * in it; a ServiceBus names the queues, stops them and reports on them.
+ * Events that have piled up are taken off together: a run of adds or of
+ * updates goes to the listener as one ProcessAddBatch or ProcessUpdateBatch,
+ * so a listener with a fixed cost per call pays it once per burst. A
+ * LinkQueue is the same queue without the thread: whichever thread is to run
+ * the downstream graph pumps it, which is how two graphs running on their own
+ * threads hand events across. A ConflatingListener is for consumers that
+ * only want each product's latest state: it keeps one pending event per
+ * product, so a lagging consumer skips the updates it would only overwrite.
+ */
+#ifndef SERVICE_BUS_HPP
+#define SERVICE_BUS_HPP
+
+#include <string>
+#include <vector>
+#include <optional>
+#include <span>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <ostream>
+#include <cstdint>
+#include <cstddef>
+#include "soa.hpp"
+#include "productregistry.hpp"
+#include "latencyhistogram.hpp"
+#include "ratelimiter.hpp"
+
+using namespace std;
+
+// How a thread waits on a full or empty queue: spinning, yielding its core, or sleeping until woken
+enum WaitStrategy { WAIT_SPIN, WAIT_YIELD, WAIT_BLOCK };
+
+/**
+ * A bounded ring for one producer thread and one consumer thread.
+ * Capacity is rounded up to a power of two.
+ */
+template<typename T>
+class SpscRing
+{
+
+public:
+
+  // ctor for an empty ring
+  explicit SpscRing(size_t capacity);
+
+  // Add an item at the back; false if the ring is full. Producer only.
+  template<typename U>
+  bool TryPush(U &&item);
+
+  // Get the item at the front, or nullptr if the ring is empty. Consumer only.
+  T* Front();
+
+  // Drop the item at the front. Consumer only.
+  void Pop();
+
+  // Get the number of items in the ring
+  size_t Size() const;
+
+  // Get the number of items the ring holds when full
+  size_t Capacity() const;
+
+private:
+  vector<optional<T> > slots;
+  uint64_t mask;
+  alignas(64) atomic<uint64_t> head; // items popped
+  uint64_t cachedTail; // consumer's last view of tail
+  alignas(64) atomic<uint64_t> tail; // items pushed
+  uint64_t cachedHead; // producer's last view of head
+
+};
+
+template<typename T>
+SpscRing<T>::SpscRing(size_t capacity) : head(0), cachedTail(0), tail(0), cachedHead(0)
+{
+  size_t size = 1;
+  while (size < capacity)
+    size <<= 1;
+  slots.resize(size);
+  mask = size - 1;
+}
+
+template<typename T>
+template<typename U>
+bool SpscRing<T>::TryPush(U &&item)
+{
+  uint64_t t = tail.load(memory_order_relaxed);
+  if (t - cachedHead == slots.size()) {
+    cachedHead = head.load(memory_order_acquire);
+    if (t - cachedHead == slots.size())
+      return false;
+  }
+  slots[t & mask].emplace(std::forward<U>(item));
+  tail.store(t + 1, memory_order_release);
+  return true;
+}
+
+template<typename T>
+T* SpscRing<T>::Front()
+{
+  uint64_t h = head.load(memory_order_relaxed);
+  if (h == cachedTail) {
+    cachedTail = tail.load(memory_order_acquire);
+    if (h == cachedTail)
+      return nullptr;
+  }
+  return &*slots[h & mask];
+}
+
+template<typename T>
+void SpscRing<T>::Pop()
+{
+  uint64_t h = head.load(memory_order_relaxed);
+  slots[h & mask].reset();
+  head.store(h + 1, memory_order_release);
+}
+
+template<typename T>
+size_t SpscRing<T>::Size() const
+{
+  uint64_t h = head.load(memory_order_acquire);
+  return size_t(tail.load(memory_order_acquire) - h);
+}
+
+template<typename T>
+size_t SpscRing<T>::Capacity() const
+{
+  return slots.size();
+}
+
+/**
+ * What a ServiceBus knows of each of its queues.
+ */
+class AsyncStage
+{
+
+public:
+
+  virtual ~AsyncStage() = default;
+
+  // Take no more events; a stage with a thread of its own also waits for it to deliver the rest
+  virtual void Stop() = 0;
+
+  // Get the number of events waiting now
+  virtual size_t GetDepth() const = 0;
+
+  // Get the largest number of events that were ever waiting at once
+  virtual size_t GetMaxDepth() const = 0;
+
+  // Get the number of events delivered
+  virtual uint64_t GetDelivered() const = 0;
+
+  // Get how long events waited in the queue, in nanoseconds; read once the stage has stopped
+  virtual const LatencyHistogram& GetLatency() const = 0;
+
+};
+
+/**
+ * A listener that queues events for another thread, which delivers them to a target listener with Pump.
+ * One thread at a time may send it events and one may pump it.
+ * Type V is the event type; events are copied into the queue.
+ */
+template<typename V>
+class LinkQueue : public ServiceListener<V>, public AsyncStage
+{
+
+public:
+
+  // ctor for a queue of up to capacity events
+  explicit LinkQueue(size_t capacity = 4096, WaitStrategy _wait = WAIT_YIELD);
+
+  void ProcessAdd(V &data) override;
+
+  void ProcessRemove(V &data) override;
+
+  void ProcessUpdate(V &data) override;
+
+  // Send no more events; Pump returns once it has delivered the ones queued
+  void Close();
+
+  // Deliver events, in order, to target until the queue is closed and empty; returns the number delivered.
+  // Up to MAX_BATCH adds or updates waiting one after another are delivered as one batch.
+  uint64_t Pump(ServiceListener<V> &target);
+
+  // Close the queue
+  void Stop() override;
+
+  size_t GetDepth() const override;
+
+  size_t GetMaxDepth() const override;
+
+  uint64_t GetDelivered() const override;
+
+  const LatencyHistogram& GetLatency() const override;
+
+  static constexpr size_t MAX_BATCH = 256;
+
+private:
+  enum EventKind { EVENT_ADD, EVENT_REMOVE, EVENT_UPDATE };
+
+  struct Event
+  {
+    EventKind kind;
+    uint64_t enqueued; // CycleClock tick
+    V data;
+  };
+
+  void Push(EventKind kind, V &data);
+  void Wait(atomic<uint64_t> &signal, uint64_t seen);
+  void Wake(atomic<uint64_t> &signal);
+
+  WaitStrategy wait;
+  SpscRing<Event> ring;
+  atomic<bool> closed;
+  atomic<uint64_t> itemSignal; // bumped when an event is queued or the queue closes, under WAIT_BLOCK
+  atomic<uint64_t> spaceSignal; // bumped when an event is taken off, under WAIT_BLOCK
+  atomic<int> sleepers; // threads blocked on a signal
+  atomic<size_t> maxDepth;
+  atomic<uint64_t> delivered;
+  LatencyHistogram latency;
+  double nanosPerTick;
+
+};
+
+template<typename V>
+LinkQueue<V>::LinkQueue(size_t capacity, WaitStrategy _wait) :
+  wait(_wait), ring(capacity), closed(false), itemSignal(0), spaceSignal(0), sleepers(0), maxDepth(0), delivered(0), nanosPerTick(1e9 / CycleClock::TicksPerSecond())
+{
+}
+
+template<typename V>
+void LinkQueue<V>::ProcessAdd(V &data)
+{
+  Push(EVENT_ADD, data);
+}
+
+template<typename V>
+void LinkQueue<V>::ProcessRemove(V &data)
+{
+  Push(EVENT_REMOVE, data);
+}
+
+template<typename V>
+void LinkQueue<V>::ProcessUpdate(V &data)
+{
+  Push(EVENT_UPDATE, data);
+}
+
+// A thread reads the signal before it looks at the ring, so a bump it has not seen wakes it at once.
+// A thread that bumps a signal after the other one read it only has to notify if it is asleep.
+template<typename V>
+void LinkQueue<V>::Wait(atomic<uint64_t> &signal, uint64_t seen)
+{
+  switch (wait) {
+  case WAIT_SPIN:
+    break;
+  case WAIT_YIELD:
+    this_thread::yield();
+    break;
+  case WAIT_BLOCK:
+    sleepers.fetch_add(1);
+    signal.wait(seen);
+    sleepers.fetch_sub(1);
+    break;
+  }
+}
+
+template<typename V>
+void LinkQueue<V>::Wake(atomic<uint64_t> &signal)
+{
+  if (wait != WAIT_BLOCK)
+    return;
+  signal.fetch_add(1);
+  if (sleepers.load() > 0)
+    signal.notify_one();
+}
+
+template<typename V>
+void LinkQueue<V>::Push(EventKind kind, V &data)
+{
+  Event event{kind, CycleClock::Now(), data};
+  while (true) {
+    uint64_t seen = spaceSignal.load(memory_order_acquire);
+    if (ring.TryPush(std::move(event))) // only moved from once it is in
+      break;
+    Wait(spaceSignal, seen);
+  }
+  Wake(itemSignal);
+  size_t depth = ring.Size();
+  if (depth > maxDepth.load(memory_order_relaxed))
+    maxDepth.store(depth, memory_order_relaxed);
+}
+
+template<typename V>
+void LinkQueue<V>::Close()
+{
+  closed.store(true, memory_order_release);
+  itemSignal.fetch_add(1);
+  itemSignal.notify_all();
+}
+
+// A run is moved off the ring before it is delivered, so the producer can refill the ring meanwhile
+template<typename V>
+uint64_t LinkQueue<V>::Pump(ServiceListener<V> &target)
+{
+  uint64_t count = 0;
+  vector<V> batch;
+  batch.reserve(MAX_BATCH);
+  while (true) {
+    uint64_t seen = itemSignal.load(memory_order_acquire);
+    Event* event = ring.Front();
+    if (event == nullptr) {
+      if (closed.load(memory_order_acquire) && ring.Front() == nullptr)
+        return count;
+      Wait(itemSignal, seen);
+      continue;
+    }
+    EventKind kind = event->kind;
+    if (kind == EVENT_REMOVE) {
+      latency.Record(uint64_t(double(CycleClock::Now() - event->enqueued) * nanosPerTick));
+      target.ProcessRemove(event->data);
+      ring.Pop();
+      ++count;
+      delivered.fetch_add(1, memory_order_relaxed);
+      Wake(spaceSignal);
+      continue;
+    }
+    uint64_t now = CycleClock::Now();
+    do {
+      latency.Record(uint64_t(double(now - event->enqueued) * nanosPerTick));
+      batch.push_back(std::move(event->data));
+      ring.Pop();
+      event = (batch.size() < MAX_BATCH) ? ring.Front() : nullptr;
+    } while (event != nullptr && event->kind == kind);
+    Wake(spaceSignal);
+    if (kind == EVENT_ADD)
+      target.ProcessAddBatch(span<V>(batch));
+    else
+      target.ProcessUpdateBatch(span<V>(batch));
+    count += batch.size();
+    delivered.fetch_add(batch.size(), memory_order_relaxed);
+    batch.clear();
+  }
+}
+
+template<typename V>
+void LinkQueue<V>::Stop()
+{
+  Close();
+}
+
+template<typename V>
+size_t LinkQueue<V>::GetDepth() const
+{
+  return ring.Size();
+}
+
+template<typename V>
+size_t LinkQueue<V>::GetMaxDepth() const
+{
+  return maxDepth.load(memory_order_relaxed);
+}
+
+template<typename V>
+uint64_t LinkQueue<V>::GetDelivered() const
+{
+  return delivered.load(memory_order_relaxed);
+}
+
+template<typename V>
+const LatencyHistogram& LinkQueue<V>::GetLatency() const
+{
+  return latency;
+}
+
+/**
+ * A LinkQueue pumped into its target by a thread of its own.
+ */
+template<typename V>
+class AsyncListener : public LinkQueue<V>
+{
+
+public:
+
+  // ctor for a listener that queues up to capacity events for target and starts its thread
+  explicit AsyncListener(ServiceListener<V> &target, size_t capacity = 4096, WaitStrategy wait = WAIT_YIELD);
+
+  ~AsyncListener() override;
+
+  // Close the queue and wait for the thread to deliver the rest
+  void Stop() override;
+
+private:
+  thread worker;
+
+};
+
+template<typename V>
+AsyncListener<V>::AsyncListener(ServiceListener<V> &target, size_t capacity, WaitStrategy wait) :
+  LinkQueue<V>(capacity, wait), worker([this, &target] {this->Pump(target);})
+{
+}
+
+template<typename V>
+AsyncListener<V>::~AsyncListener()
+{
+  Stop();
+}
+
+template<typename V>
+void AsyncListener<V>::Stop()
+{
+  this->Close();
+  if (worker.joinable())
+    worker.join();
+}
+
+/**
+ * A listener for a consumer that only needs each product's latest state, delivered by a thread of its own.
+ * Each product handle has one slot holding its newest pending event, and a dirty list holds the products
+ * with a pending event in the order they became pending. An event for a product that is already pending
+ * replaces the pending one and counts as conflated, keeping the net effect on the consumer: a pending add
+ * stays an add, a remove cancels a pending add the consumer has not seen, and a pending remove is kept
+ * aside to be delivered before whatever brings the product back. So however far the consumer lags, at
+ * most a remove and one other event per product wait and the producer never blocks on the consumer.
+ * Type V is the event type and must have GetProduct(); an event for a product outside the registry throws out_of_range.
+ */
+template<typename V>
+class ConflatingListener : public ServiceListener<V>, public AsyncStage
+{
+
+public:
+
+  // ctor for a listener that hands the newest event per product to target and starts its thread
+  ConflatingListener(ServiceListener<V> &target, const ProductRegistry &_registry);
+
+  ~ConflatingListener() override;
+
+  void ProcessAdd(V &data) override;
+
+  void ProcessRemove(V &data) override;
+
+  void ProcessUpdate(V &data) override;
+
+  // Deliver what is pending and stop the thread
+  void Stop() override;
+
+  // Get the number of products with a pending event
+  size_t GetDepth() const override;
+
+  size_t GetMaxDepth() const override;
+
+  uint64_t GetDelivered() const override;
+
+  // Get how long each delivered event's product had been pending, in nanoseconds
+  const LatencyHistogram& GetLatency() const override;
+
+  // Get the number of events replaced by a newer one, or cancelled out, before they were delivered
+  uint64_t GetConflated() const;
+
+private:
+  enum EventKind { EVENT_ADD, EVENT_REMOVE, EVENT_UPDATE };
+
+  struct Slot
+  {
+    optional<V> removed; // a remove to deliver before value
+    optional<V> value;
+    EventKind kind;
+    bool queued = false; // on the dirty list, even if what was pending has cancelled out
+    uint64_t since; // CycleClock tick the product became pending
+  };
+
+  void Put(EventKind kind, V &data);
+  void Run(ServiceListener<V> &target);
+
+  const ProductRegistry& registry;
+  vector<Slot> slots; // indexed by product handle
+  vector<ProductHandle> dirty; // products with a pending event, oldest first
+  mutable mutex lock; // guards slots, dirty, stopping and the counts
+  condition_variable ready;
+  bool stopping;
+  size_t maxDepth;
+  uint64_t conflated;
+  atomic<uint64_t> delivered;
+  LatencyHistogram latency;
+  double nanosPerTick;
+  thread worker;
+
+};
+
+template<typename V>
+ConflatingListener<V>::ConflatingListener(ServiceListener<V> &target, const ProductRegistry &_registry) :
+  registry(_registry), slots(_registry.Size()), stopping(false), maxDepth(0), conflated(0), delivered(0),
+  nanosPerTick(1e9 / CycleClock::TicksPerSecond()), worker([this, &target] {Run(target);})
+{
+}
+
+template<typename V>
+ConflatingListener<V>::~ConflatingListener()
+{
+  Stop();
+}
+
+template<typename V>
+void ConflatingListener<V>::ProcessAdd(V &data)
+{
+  Put(EVENT_ADD, data);
+}
+
+template<typename V>
+void ConflatingListener<V>::ProcessRemove(V &data)
+{
+  Put(EVENT_REMOVE, data);
+}
+
+template<typename V>
+void ConflatingListener<V>::ProcessUpdate(V &data)
+{
+  Put(EVENT_UPDATE, data);
+}
+
+template<typename V>
+void ConflatingListener<V>::Put(EventKind kind, V &data)
+{
+  Slot &slot = slots.at(registry.HandleOf(data.GetProduct()));
+  bool wake;
+  {
+    lock_guard<mutex> guard(lock);
+    wake = !slot.queued;
+    if (wake) {
+      slot.queued = true;
+      slot.since = CycleClock::Now();
+      dirty.push_back(ProductHandle(&slot - slots.data()));
+      if (dirty.size() > maxDepth)
+        maxDepth = dirty.size();
+    }
+    if (!slot.value && kind == EVENT_REMOVE && slot.removed) {
+      // a remove replaces the one already waiting
+      *slot.removed = data;
+      ++conflated;
+    } else if (!slot.value) {
+      slot.value.emplace(data);
+      slot.kind = kind;
+    } else if (slot.kind == EVENT_REMOVE && kind != EVENT_REMOVE) {
+      // the consumer sees the product go before it comes back
+      slot.removed = std::move(slot.value);
+      slot.value.emplace(data);
+      slot.kind = kind;
+    } else if (slot.kind == EVENT_ADD && kind == EVENT_REMOVE) {
+      // the consumer never saw the add, so neither is delivered
+      slot.value.reset();
+      conflated += 2;
+    } else {
+      *slot.value = data;
+      if (slot.kind != EVENT_ADD)
+        slot.kind = kind;
+      if (kind == EVENT_REMOVE && slot.removed) {
+        slot.removed.reset();
+        ++conflated;
+      }
+      ++conflated;
+    }
+  }
+  if (wake)
+    ready.notify_one();
+}
+
+// Pending events are moved out under the lock and delivered after it is dropped, a run of adds or updates as one batch
+template<typename V>
+void ConflatingListener<V>::Run(ServiceListener<V> &target)
+{
+  vector<ProductHandle> taken;
+  vector<V> batch;
+  vector<EventKind> kinds;
+  while (true) {
+    {
+      unique_lock<mutex> guard(lock);
+      ready.wait(guard, [this] {return stopping || !dirty.empty();});
+      if (dirty.empty())
+        return;
+      taken.swap(dirty);
+      uint64_t now = CycleClock::Now();
+      for (ProductHandle handle : taken) {
+        Slot &slot = slots[handle];
+        slot.queued = false;
+        if (!slot.removed && !slot.value)
+          continue;
+        latency.Record(uint64_t(double(now - slot.since) * nanosPerTick));
+        if (slot.removed) {
+          batch.push_back(std::move(*slot.removed));
+          kinds.push_back(EVENT_REMOVE);
+          slot.removed.reset();
+        }
+        if (slot.value) {
+          batch.push_back(std::move(*slot.value));
+          kinds.push_back(slot.kind);
+          slot.value.reset();
+        }
+      }
+    }
+    size_t i = 0;
+    while (i < batch.size()) {
+      size_t end = i + 1;
+      while (end < batch.size() && kinds[end] == kinds[i])
+        ++end;
+      span<V> run(batch.data() + i, end - i);
+      if (kinds[i] == EVENT_ADD) {
+        target.ProcessAddBatch(run);
+      } else if (kinds[i] == EVENT_UPDATE) {
+        target.ProcessUpdateBatch(run);
+      } else {
+        for (V &item : run)
+          target.ProcessRemove(item);
+      }
+      i = end;
+    }
+    delivered.fetch_add(batch.size(), memory_order_relaxed);
+    taken.clear();
+    batch.clear();
+    kinds.clear();
+  }
+}
+
+template<typename V>
+void ConflatingListener<V>::Stop()
+{
+  {
+    lock_guard<mutex> guard(lock);
+    stopping = true;
+  }
+  ready.notify_one();
+  if (worker.joinable())
+    worker.join();
+}
+
+template<typename V>
+size_t ConflatingListener<V>::GetDepth() const
+{
+  lock_guard<mutex> guard(lock);
+  return dirty.size();
+}
+
+template<typename V>
+size_t ConflatingListener<V>::GetMaxDepth() const
+{
+  lock_guard<mutex> guard(lock);
+  return maxDepth;
+}
+
+template<typename V>
+uint64_t ConflatingListener<V>::GetDelivered() const
+{
+  return delivered.load(memory_order_relaxed);
+}
+
+template<typename V>
+const LatencyHistogram& ConflatingListener<V>::GetLatency() const
+{
+  return latency;
+}
+
+template<typename V>
+uint64_t ConflatingListener<V>::GetConflated() const
+{
+  lock_guard<mutex> guard(lock);
+  return conflated;
+}
+
+/**
+ * The named queues of an asynchronous service graph.
+ */
+class ServiceBus
+{
+
+public:
+
+  // Put a stage on the bus under a name
+  void Add(const string &name, AsyncStage &stage);
+
+  // Stop every stage, in the order they were added, so upstream queues drain into downstream ones
+  void StopAll();
+
+  // Write a line per stage: its name, events delivered, deepest backlog and wait percentiles
+  void Report(ostream &output) const;
+
+private:
+  vector<pair<string, AsyncStage*> > stages;
+
+};
+
+void ServiceBus::Add(const string &name, AsyncStage &stage)
+{
+  stages.emplace_back(name, &stage);
+}
+
+void ServiceBus::StopAll()
+{
+  for (auto &stage : stages)
+    stage.second->Stop();
+}
+
+void ServiceBus::Report(ostream &output) const
+{
+  for (const auto &stage : stages) {
+    const LatencyHistogram &latency = stage.second->GetLatency();
+    output << stage.first << ": " << stage.second->GetDelivered() << " events, max depth " << stage.second->GetMaxDepth()
+           << ", wait p50 " << latency.GetPercentile(0.5) << "ns p99 " << latency.GetPercentile(0.99) << "ns max " << latency.GetMax() << "ns\n";
+  }
+}
+
+#endif
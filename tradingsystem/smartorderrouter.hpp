@@ -0,0 +1,132 @@
+/**
+ * smartorderrouter.hpp
+ * Defines the router that splits an order across venues by displayed depth and venue latency.
+ *
+ * The router walks the consolidated ladder from the touch and, at each price,
+ * takes what every venue shows there, fastest venue first. Venue speed is a
+ * moving average of the latency samples recorded for each venue, so a venue
+ * that slows down loses its place in the queue but keeps its liquidity. A
+ * decision reads only the flat ladders of the market data service and writes
+ * at most one slice per venue into the caller's array, without allocation.
+ */
+#ifndef SMART_ORDER_ROUTER_HPP
+#define SMART_ORDER_ROUTER_HPP
+
+#include <cstddef>
+#include "marketdataservice.hpp"
+#include "flatorderbook.hpp"
+#include "tickprice.hpp"
+
+using namespace std;
+
+// One venue's share of a routed order
+struct RouteSlice
+{
+  Market venue;
+  long quantity;
+};
+
+class BondSmartOrderRouter
+{
+
+public:
+
+  // Weight of a new sample in a venue's latency average
+  static constexpr double LATENCY_WEIGHT = 0.125;
+
+  // ctor for a router over the market data's venue ladders; every venue starts at the same nominal latency
+  explicit BondSmartOrderRouter(BondMarketDataService &_marketData, double nominalLatency = 50000.);
+
+  // Split quantity across venues, best price first and, at a price, fastest venue first.
+  // A limited order takes no level through its limit. Quantity beyond the displayed
+  // depth goes to the venue already given the most, or to the fastest venue if none.
+  // Writes between 1 and MARKET_COUNT slices, fastest venue first, and returns the count.
+  size_t Route(const Bond &product, PricingSide side, bool limited, TickPrice limit, long quantity, RouteSlice *slices);
+
+  // Fold a latency sample, in nanoseconds, into the venue's average
+  void RecordLatency(Market venue, double nanos);
+
+  // Get the venue's average latency in nanoseconds
+  double GetLatency(Market venue) const;
+
+private:
+  void RankVenues();
+
+  BondMarketDataService& marketData;
+  double latency[MARKET_COUNT];
+  Market ranked[MARKET_COUNT]; // fastest first; ties keep venue order
+
+};
+
+BondSmartOrderRouter::BondSmartOrderRouter(BondMarketDataService &_marketData, double nominalLatency) :
+  marketData(_marketData)
+{
+  for (int v = 0; v < MARKET_COUNT; ++v) {
+    latency[v] = nominalLatency;
+    ranked[v] = Market(v);
+  }
+}
+
+size_t BondSmartOrderRouter::Route(const Bond &product, PricingSide side, bool limited, TickPrice limit, long quantity, RouteSlice *slices)
+{
+  PricingSide contra = (side == BID) ? OFFER : BID;
+  const FlatOrderBook* venues[MARKET_COUNT];
+  for (int v = 0; v < MARKET_COUNT; ++v)
+    venues[v] = &marketData.GetVenueBook(product, Market(v));
+  long allocated[MARKET_COUNT] = {};
+  long remaining = quantity;
+  const FlatOrderBook& book = marketData.GetConsolidatedBook(product);
+  book.ForEachLevel(contra, book.GetLevelCount(contra), [&](TickPrice price, long) {
+    if (remaining <= 0 || (limited && (side == BID ? price > limit : price < limit)))
+      return;
+    for (Market venue : ranked) {
+      long shown = venues[venue]->GetQuantity(contra, price);
+      long take = (remaining < shown) ? remaining : shown;
+      allocated[venue] += take;
+      remaining -= take;
+    }
+  });
+  if (remaining > 0) {
+    Market target = ranked[0];
+    for (Market venue : ranked) {
+      if (allocated[venue] > allocated[target])
+        target = venue;
+    }
+    allocated[target] += remaining;
+  }
+  size_t count = 0;
+  for (Market venue : ranked) {
+    if (allocated[venue] > 0)
+      slices[count++] = RouteSlice{venue, allocated[venue]};
+  }
+  if (count == 0)
+    slices[count++] = RouteSlice{ranked[0], quantity};
+  return count;
+}
+
+void BondSmartOrderRouter::RecordLatency(Market venue, double nanos)
+{
+  latency[venue] += LATENCY_WEIGHT * (nanos - latency[venue]);
+  RankVenues();
+}
+
+double BondSmartOrderRouter::GetLatency(Market venue) const
+{
+  return latency[venue];
+}
+
+// Insertion sort: three venues, and usually already in order
+void BondSmartOrderRouter::RankVenues()
+{
+  for (int i = 1; i < MARKET_COUNT; ++i) {
+    Market venue = ranked[i];
+    int j = i;
+    while (j > 0 && (latency[ranked[j - 1]] > latency[venue] || (latency[ranked[j - 1]] == latency[venue] && ranked[j - 1] > venue))) {
+      ranked[j] = ranked[j - 1];
+      --j;
+    }
+    ranked[j] = venue;
+  }
+}
+
+#endif
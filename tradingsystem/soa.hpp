@@ -9,6 +9,7 @@
 #define SOA_HPP
 
 #include <vector>
+#include <span>
 
 using namespace std;
 
@@ -32,8 +33,28 @@ public:
   // Listener callback to process an update event to the Service
   virtual void ProcessUpdate(V &data) = 0;
 
+  // Listener callback to process a run of add events, in order; by default one ProcessAdd each
+  virtual void ProcessAddBatch(span<V> data);
+
+  // Listener callback to process a run of update events, in order; by default one ProcessUpdate each
+  virtual void ProcessUpdateBatch(span<V> data);
+
 };
 
+template<typename V>
+void ServiceListener<V>::ProcessAddBatch(span<V> data)
+{
+  for (V &item : data)
+    ProcessAdd(item);
+}
+
+template<typename V>
+void ServiceListener<V>::ProcessUpdateBatch(span<V> data)
+{
+  for (V &item : data)
+    ProcessUpdate(item);
+}
+
 /**
  * Definition of a generic base class Service.
  * Uses key generic type K and value generic type V.
@@ -0,0 +1,101 @@
+/**
+ * staticpipeline.hpp
+ * Defines a service chain wired at compile time.
+ *
+ * A StaticPipeline holds its stages by value, as concrete types. Each stage
+ * has a Process(data, emit) member template that does its work and calls
+ * emit with what it hands on, any number of times; emit is a lambda that runs
+ * the next stage, and the last stage's emit does nothing. Every hop is then a
+ * direct call the compiler can inline, so a tick runs as one call chain with
+ * no vector of listeners and no virtual call between stages. A ListenerStage
+ * runs a concrete ServiceListener as a stage without its virtual dispatch,
+ * and a PipelineListener puts a pipeline behind the ServiceListener interface
+ * so the dynamically wired graph, or a queue, can feed it.
+ */
+#ifndef STATIC_PIPELINE_HPP
+#define STATIC_PIPELINE_HPP
+
+#include <tuple>
+#include <utility>
+#include <cstddef>
+#include "soa.hpp"
+
+using namespace std;
+
+template<typename... Stages>
+class StaticPipeline
+{
+
+public:
+
+  // ctor for a pipeline of the given stages, first to last
+  explicit StaticPipeline(Stages... _stages) : stages(std::move(_stages)...) {}
+
+  // Run an event through every stage
+  template<typename V>
+  void Push(V &data) { Run<0>(data); }
+
+  // Get stage I, to configure it
+  template<size_t I>
+  auto& Get() { return get<I>(stages); }
+
+private:
+  template<size_t I, typename V>
+  void Run(V &data)
+  {
+    if constexpr (I < sizeof...(Stages))
+      get<I>(stages).Process(data, [this](auto &out) { Run<I + 1>(out); });
+  }
+
+  tuple<Stages...> stages;
+
+};
+
+/**
+ * A stage that hands each event to a concrete listener's ProcessAdd, called non-virtually, and then on.
+ * Type L is the listener type; it must outlive the stage.
+ */
+template<typename L>
+class ListenerStage
+{
+
+public:
+
+  explicit ListenerStage(L &_listener) : listener(_listener) {}
+
+  template<typename V, typename Emit>
+  void Process(V &data, Emit &&emit)
+  {
+    listener.L::ProcessAdd(data);
+    emit(data);
+  }
+
+private:
+  L& listener;
+
+};
+
+/**
+ * A listener whose add events run through a pipeline; updates and removes are ignored.
+ * Type V is the event type and P the pipeline type; the pipeline must outlive the listener.
+ */
+template<typename V, typename P>
+class PipelineListener : public ServiceListener<V>
+{
+
+public:
+
+  explicit PipelineListener(P &_pipeline) : pipeline(_pipeline) {}
+
+  void ProcessAdd(V &data) override { pipeline.Push(data); }
+
+  void ProcessRemove(V &data) override {}
+
+  void ProcessUpdate(V &data) override {}
+
+private:
+  P& pipeline;
+
+};
+
+#endif
@@ -10,6 +10,9 @@
 #include "soa.hpp"
 #include "marketdataservice.hpp"
 #include "pricingservice.hpp"
+#include "asyncwriter.hpp"
+#include "productregistry.hpp"
+#include <optional>
 
 /**
  * A price stream order with price and quantity (visible and hidden)
@@ -20,13 +23,13 @@ class PriceStreamOrder
 public:
 
   // ctor for an order
-  PriceStreamOrder(double _price, long _visibleQuantity, long _hiddenQuantity, PricingSide _side);
+  PriceStreamOrder(TickPrice _price, long _visibleQuantity, long _hiddenQuantity, PricingSide _side);
 
   // The side on this order
   PricingSide GetSide() const {return side;}
 
   // Get the price on this order
-  double GetPrice() const;
+  TickPrice GetPrice() const;
 
   // Get the visible quantity on this order
   long GetVisibleQuantity() const;
@@ -35,7 +38,7 @@ public:
   long GetHiddenQuantity() const;
 
 private:
-  double price;
+  TickPrice price;
   long visibleQuantity;
   long hiddenQuantity;
   PricingSide side;
@@ -44,7 +47,7 @@ private:
 
 /**
  * Price Stream with a two-way market.
- * Type T is the product type.
+ * Type T is the product type; the product is referenced, not copied, and must outlive the stream.
  */
 template<typename T>
 class PriceStream
@@ -65,7 +68,7 @@ public:
   const PriceStreamOrder& GetOfferOrder() const;
 
 private:
-  T product;
+  const T* product;
   PriceStreamOrder bidOrder;
   PriceStreamOrder offerOrder;
 
@@ -87,7 +90,7 @@ public:
 
 };
 
-PriceStreamOrder::PriceStreamOrder(double _price, long _visibleQuantity, long _hiddenQuantity, PricingSide _side)
+PriceStreamOrder::PriceStreamOrder(TickPrice _price, long _visibleQuantity, long _hiddenQuantity, PricingSide _side)
 {
   price = _price;
   visibleQuantity = _visibleQuantity;
@@ -95,7 +98,7 @@ PriceStreamOrder::PriceStreamOrder(double _price, long _visibleQuantity, long _h
   side = _side;
 }
 
-double PriceStreamOrder::GetPrice() const
+TickPrice PriceStreamOrder::GetPrice() const
 {
   return price;
 }
@@ -112,14 +115,14 @@ long PriceStreamOrder::GetHiddenQuantity() const
 
 template<typename T>
 PriceStream<T>::PriceStream(const T &_product, const PriceStreamOrder &_bidOrder, const PriceStreamOrder &_offerOrder) :
-  product(_product), bidOrder(_bidOrder), offerOrder(_offerOrder)
+  product(&_product), bidOrder(_bidOrder), offerOrder(_offerOrder)
 {
 }
 
 template<typename T>
 const T& PriceStream<T>::GetProduct() const
 {
-  return product;
+  return *product;
 }
 
 template<typename T>
@@ -134,6 +137,8 @@ const PriceStreamOrder& PriceStream<T>::GetOfferOrder() const
   return offerOrder;
 }
 
+static_assert(is_trivially_copyable_v<PriceStream<Bond> >, "price streams are passed by value on the hot path");
+
 template<typename T>
 class AlgoStreamingService: public Service<string, PriceStream<T> > {
 public:
@@ -143,11 +148,14 @@ public:
 class BondAlgoStreamingService: public AlgoStreamingService<Bond>
 {
 private:
-    map<string, PriceStream<Bond> > bondAlgoStreamingServices;
+    const ProductRegistry& registry;
+    vector<optional<PriceStream<Bond> > > bondAlgoStreams; // indexed by product handle
     vector< ServiceListener<PriceStream<Bond> >* > algoStreamListeners;
 public:
+    explicit BondAlgoStreamingService(const ProductRegistry& _registry): registry(_registry), bondAlgoStreams(_registry.Size()) {}
+
     PriceStream<Bond>& GetData(string key) override {
-        return bondAlgoStreamingServices.find(key)->second;
+        return bondAlgoStreams.at(registry.Find(key)).value();
     }
 
     void OnMessage(PriceStream<Bond> &data) override {}
@@ -156,14 +164,17 @@ public:
 
     const vector< ServiceListener<PriceStream<Bond> >* >& GetListeners() const override {return algoStreamListeners;}
 
-    void ExecuteAlgoStream(PriceStream<Bond>& data) override {
-        string productId = data.GetProduct().GetProductId();
-        if (bondAlgoStreamingServices.find(productId) != bondAlgoStreamingServices.end())
-            bondAlgoStreamingServices.erase(productId);
-        bondAlgoStreamingServices.insert(make_pair(productId, data));
+    // Keep a stream as its product's latest and hand it to the listeners; returns the kept copy
+    PriceStream<Bond>& Execute(const PriceStream<Bond>& data) {
+        PriceStream<Bond>& stored = bondAlgoStreams.at(registry.HandleOf(data.GetProduct())).emplace(data);
         for(auto & algoStreamListener : algoStreamListeners){
-            algoStreamListener->ProcessAdd(data);//invoke listeners for new data addition
+            algoStreamListener->ProcessAdd(stored);//invoke listeners for new data addition
         }
+        return stored;
+    }
+
+    void ExecuteAlgoStream(PriceStream<Bond>& data) override {
+        Execute(data);
     }
 };
 
@@ -180,66 +191,56 @@ public:
     void ProcessRemove(Price<Bond> &data) override{}
 
     void ProcessAdd(Price<Bond> &data) override{
-        Bond product = data.GetProduct();
-        string productId = data.GetProduct().GetProductId();
-        double mid = data.GetMid();
-        double spread = data.GetBidOfferSpread();
-        double bidPrice = mid - 0.5 * spread;
-        double offerPrice = mid + 0.5 * spread;
+        PriceStream<Bond> priceStream = Quote(data);
+        bondAlgoStreamingService.ExecuteAlgoStream(priceStream);
+    }
+
+    // Quote a two-way stream at a price's bid and offer, with random visible and hidden sizes
+    static PriceStream<Bond> Quote(const Price<Bond> &data){
+        const Bond& product = data.GetProduct();
+        TickPrice bidPrice = data.GetBid();
+        TickPrice offerPrice = data.GetOffer();
         long visible=(rand()%10+1)*10000;
         long hidden=(rand()%20+1)*15000;
         PriceStreamOrder bid_order(bidPrice, visible, hidden, BID);
         visible=(rand()%10+1)*10000;
         hidden=(rand()%20+1)*15000;
         PriceStreamOrder offer_order(offerPrice, visible, hidden, OFFER);
-        PriceStream<Bond> priceStream(product, bid_order, offer_order);
-        bondAlgoStreamingService.ExecuteAlgoStream(priceStream);
+        return PriceStream<Bond>(product, bid_order, offer_order);
     }
 };
 
-string PriceProcess(double p){
-    int part1 = int(p);
-    double p2 = p-double(part1);
-    int part2 = int(p2*32);
-    double p3 = p2-double(part2)/32;
-    int part3 = round(p3*256);
-    string p_str;
-    if(part2 >= 10){
-        p_str = to_string(part1)+"-"+to_string(part2)+to_string(part3);
-    }
-    else{
-        p_str = to_string(part1)+"-"+"0"+to_string(part2)+to_string(part3);
-    }
-    return p_str;
-}
-
-class BondStreamingConnector: public Connector<PriceStream<Bond> > {
+class BondStreamingConnector final: public Connector<PriceStream<Bond> > {
+private:
+    AsyncLogWriter& writer;
+    int fileId;
 public:
+    explicit BondStreamingConnector(AsyncLogWriter& _writer = AsyncLogWriter::Default()):
+        writer(_writer), fileId(_writer.Open("./Output/PriceStreams.txt")) {}
+
     void Publish(PriceStream<Bond> &data) override {
-        ofstream oFile;
-        oFile.open("./Output/PriceStreams.txt", ios_base::app);
-        oFile << data.GetProduct().GetProductId() << ",";
-        PriceStreamOrder bid_order = data.GetBidOrder();
-        oFile << PriceProcess(data.GetBidOrder().GetPrice()) << ",";
-        oFile << to_string(bid_order.GetVisibleQuantity()) << ",";
-        oFile << to_string(bid_order.GetHiddenQuantity()) << ",";
-        PriceStreamOrder offer_order=data.GetOfferOrder();
-        oFile << PriceProcess(offer_order.GetPrice()) << ",";
-        oFile << to_string(offer_order.GetVisibleQuantity()) << ",";
-        oFile << to_string(offer_order.GetHiddenQuantity()) << "\n";
-        oFile.close();
+        LogLine line;
+        const PriceStreamOrder& bid_order = data.GetBidOrder();
+        const PriceStreamOrder& offer_order = data.GetOfferOrder();
+        line << data.GetProduct().GetProductId() << ',';
+        line.AppendPrice(bid_order.GetPrice()) << ',' << bid_order.GetVisibleQuantity() << ',' << bid_order.GetHiddenQuantity() << ',';
+        line.AppendPrice(offer_order.GetPrice()) << ',' << offer_order.GetVisibleQuantity() << ',' << offer_order.GetHiddenQuantity() << '\n';
+        writer.Append(fileId, line);
     }
 };
 
 class BondStreamingService: public StreamingService<Bond>
 {
 private:
-    map<string, PriceStream<Bond> > bondPriceStreams;
+    const ProductRegistry& registry;
+    vector<optional<PriceStream<Bond> > > bondPriceStreams; // indexed by product handle
     vector<ServiceListener<PriceStream<Bond> >* > priceStreamListeners;
     BondStreamingConnector bondStreamingConnector;
 public:
+    explicit BondStreamingService(const ProductRegistry& _registry): registry(_registry), bondPriceStreams(_registry.Size()) {}
+
     PriceStream<Bond>& GetData(string key) override{
-        return bondPriceStreams.find(key)->second;
+        return bondPriceStreams.at(registry.Find(key)).value();
     }
 
     void OnMessage(PriceStream<Bond> &data) override {}
@@ -248,21 +249,19 @@ public:
 
     const vector< ServiceListener<PriceStream<Bond> >* >& GetListeners() const override {return priceStreamListeners;}
 
-    void PublishPrice(const PriceStream<Bond>& priceStream) override{
-        Bond product = priceStream.GetProduct();
-        string productId = product.GetProductId();
-        PriceStream<Bond> copy = priceStream;
-        auto it = bondPriceStreams.find(productId);
-        if (it == bondPriceStreams.end()){
-            bondPriceStreams.insert(make_pair(productId, copy));
-        } else {
-            bondPriceStreams.erase(productId);
-            bondPriceStreams.insert(make_pair(productId, copy));
-        }
+    // Keep a stream as its product's latest, hand it to the listeners and send it out
+    // through the connector; returns the kept copy
+    PriceStream<Bond>& Publish(const PriceStream<Bond>& priceStream) {
+        PriceStream<Bond>& stored = bondPriceStreams.at(registry.HandleOf(priceStream.GetProduct())).emplace(priceStream);
         for(auto & priceStreamListener : priceStreamListeners){
-            priceStreamListener->ProcessAdd(copy);
+            priceStreamListener->ProcessAdd(stored);
         }
-        bondStreamingConnector.Publish(copy);
+        bondStreamingConnector.Publish(stored);
+        return stored;
+    }
+
+    void PublishPrice(const PriceStream<Bond>& priceStream) override{
+        Publish(priceStream);
     }
 };
 
@@ -284,4 +283,44 @@ public:
     }
 };
 
+/**
+ * Stages of the price to stream path for a StaticPipeline.
+ * Each runs the listener or service it stands for, registered listeners included, and passes the result on.
+ */
+// Quote a price as BondPriceListener does
+class BondQuoteStage {
+public:
+    template<typename Emit>
+    void Process(Price<Bond> &data, Emit &&emit) {
+        PriceStream<Bond> priceStream = BondPriceListener::Quote(data);
+        emit(priceStream);
+    }
+};
+
+// Run a stream through BondAlgoStreamingService and pass the kept copy on
+class BondAlgoStreamStage {
+private:
+    BondAlgoStreamingService& service;
+public:
+    explicit BondAlgoStreamStage(BondAlgoStreamingService& _service): service(_service) {}
+
+    template<typename Emit>
+    void Process(PriceStream<Bond> &data, Emit &&emit) {
+        emit(service.Execute(data));
+    }
+};
+
+// Publish a stream on BondStreamingService and pass the kept copy on
+class BondStreamStage {
+private:
+    BondStreamingService& service;
+public:
+    explicit BondStreamStage(BondStreamingService& _service): service(_service) {}
+
+    template<typename Emit>
+    void Process(PriceStream<Bond> &data, Emit &&emit) {
+        emit(service.Publish(data));
+    }
+};
+
 #endif
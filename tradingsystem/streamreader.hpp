@@ -0,0 +1,157 @@
+/**
+ * streamreader.hpp
+ * Defines a forward-only line reader shared by the file connectors.
+ *
+ * The file is memory-mapped once when the reader is opened and every call to
+ * NextLine() moves a cursor forward, so reading N records costs O(N) instead
+ * of reopening the file and skipping all previously consumed lines.
+ */
+#ifndef STREAM_READER_HPP
+#define STREAM_READER_HPP
+
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <charconv>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+class StreamReader
+{
+
+public:
+
+  // ctor for a reader over the file at _path; the file is opened lazily on first read
+  explicit StreamReader(string _path);
+
+  ~StreamReader();
+
+  StreamReader(const StreamReader&) = delete;
+  StreamReader& operator=(const StreamReader&) = delete;
+
+  // Get the next line (without its terminator); returns false at end of file
+  bool NextLine(string_view &line);
+
+  // Get the number of lines consumed so far
+  long GetLineCount() const;
+
+  // Rewind to the beginning of the file
+  void Rewind();
+
+  // Get the path of the underlying file
+  const string& GetPath() const;
+
+private:
+  void Open();
+  void Close();
+
+  string path;
+  const char* begin;
+  const char* end;
+  const char* cursor;
+  size_t mappedSize;
+  bool opened;
+  long lineCount;
+
+};
+
+StreamReader::StreamReader(string _path) :
+  path(std::move(_path)), begin(nullptr), end(nullptr), cursor(nullptr), mappedSize(0), opened(false), lineCount(0)
+{
+}
+
+StreamReader::~StreamReader()
+{
+  Close();
+}
+
+void StreamReader::Open()
+{
+  opened = true;
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return;
+  struct stat st{};
+  if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+    void* addr = ::mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr != MAP_FAILED) {
+      ::madvise(addr, size_t(st.st_size), MADV_SEQUENTIAL);
+      mappedSize = size_t(st.st_size);
+      begin = static_cast<const char*>(addr);
+      end = begin + mappedSize;
+      cursor = begin;
+    }
+  }
+  ::close(fd);
+}
+
+void StreamReader::Close()
+{
+  if (begin != nullptr)
+    ::munmap(const_cast<char*>(begin), mappedSize);
+  begin = end = cursor = nullptr;
+  mappedSize = 0;
+  opened = false;
+}
+
+bool StreamReader::NextLine(string_view &line)
+{
+  if (!opened)
+    Open();
+  if (cursor == end)
+    return false;
+  const char* eol = static_cast<const char*>(memchr(cursor, '\n', size_t(end - cursor)));
+  const char* next = (eol == nullptr) ? end : eol + 1;
+  if (eol == nullptr)
+    eol = end;
+  if (eol > cursor && eol[-1] == '\r')
+    --eol;
+  line = string_view(cursor, size_t(eol - cursor));
+  cursor = next;
+  ++lineCount;
+  return true;
+}
+
+long StreamReader::GetLineCount() const
+{
+  return lineCount;
+}
+
+void StreamReader::Rewind()
+{
+  cursor = begin;
+  lineCount = 0;
+}
+
+const string& StreamReader::GetPath() const
+{
+  return path;
+}
+
+// Split a line on sep into at most maxFields views; returns the number of fields found
+size_t SplitFields(string_view line, string_view* fields, size_t maxFields, char sep = ',')
+{
+  size_t count = 0;
+  while (count < maxFields) {
+    size_t pos = line.find(sep);
+    fields[count++] = line.substr(0, pos);
+    if (pos == string_view::npos)
+      break;
+    line.remove_prefix(pos + 1);
+  }
+  return count;
+}
+
+// Parse an integer field; returns 0 if the field is not a number
+long ParseLong(string_view field)
+{
+  long value = 0;
+  from_chars(field.data(), field.data() + field.size(), value);
+  return value;
+}
+
+#endif
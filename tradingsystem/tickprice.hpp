@@ -0,0 +1,73 @@
+/**
+ * tickprice.hpp
+ * Defines a fixed-point price counted in whole 1/256 ticks.
+ *
+ * Treasury prices are quoted on a 1/256 grid, so a price is held as an
+ * integer number of ticks. Addition, subtraction and comparison are exact
+ * integer operations and a TickPrice can key an ordered container without
+ * floating-point rounding. Conversion to double is only for display or for
+ * interfacing with code that still expects a decimal price.
+ */
+#ifndef TICK_PRICE_HPP
+#define TICK_PRICE_HPP
+
+#include <cstdint>
+#include <cmath>
+#include <compare>
+
+using namespace std;
+
+class TickPrice
+{
+
+public:
+
+  // Number of ticks in one point of price
+  static const int64_t TICKS_PER_POINT = 256;
+
+  // ctor for a zero price
+  constexpr TickPrice() : ticks(0) {}
+
+  // Make a price from a whole number of ticks
+  static constexpr TickPrice FromTicks(int64_t _ticks) { return TickPrice(_ticks); }
+
+  // Make a price from a whole number of points
+  static constexpr TickPrice FromPoints(int64_t points) { return TickPrice(points * TICKS_PER_POINT); }
+
+  // Make a price from a decimal price, rounded to the nearest tick
+  static TickPrice FromDouble(double price) { return TickPrice(llround(price * double(TICKS_PER_POINT))); }
+
+  // Get the number of ticks
+  constexpr int64_t GetTicks() const { return ticks; }
+
+  // Get the price as a decimal number
+  constexpr double ToDouble() const { return double(ticks) / double(TICKS_PER_POINT); }
+
+  constexpr TickPrice operator+(TickPrice rhs) const { return TickPrice(ticks + rhs.ticks); }
+  constexpr TickPrice operator-(TickPrice rhs) const { return TickPrice(ticks - rhs.ticks); }
+  constexpr TickPrice operator-() const { return TickPrice(-ticks); }
+  constexpr TickPrice operator*(int64_t n) const { return TickPrice(ticks * n); }
+  constexpr TickPrice& operator+=(TickPrice rhs) { ticks += rhs.ticks; return *this; }
+  constexpr TickPrice& operator-=(TickPrice rhs) { ticks -= rhs.ticks; return *this; }
+
+  // Halve the price; an odd tick count rounds down to the grid
+  constexpr TickPrice Half() const { return TickPrice(ticks >= 0 ? ticks / 2 : (ticks - 1) / 2); }
+
+  friend constexpr bool operator==(TickPrice lhs, TickPrice rhs) = default;
+  friend constexpr auto operator<=>(TickPrice lhs, TickPrice rhs) = default;
+
+private:
+  constexpr explicit TickPrice(int64_t _ticks) : ticks(_ticks) {}
+
+  int64_t ticks;
+
+};
+
+// Get the mid of two prices on the tick grid; an odd sum rounds down, so keep the two
+// prices rather than the mid wherever they have to come back exactly
+constexpr TickPrice Midpoint(TickPrice bid, TickPrice offer)
+{
+  return (bid + offer).Half();
+}
+
+#endif
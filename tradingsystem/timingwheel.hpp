@@ -0,0 +1,214 @@
+/**
+ * timingwheel.hpp
+ * Defines a hierarchical timing wheel keyed on an integer clock.
+ *
+ * Four wheels of 256 slots cover 2^32 ticks ahead of the current time: a timer
+ * goes into the lowest wheel whose span still separates it from now, and a
+ * higher wheel's slot is poured down into the wheels below once the clock
+ * reaches it. Timers live in one pooled array and each slot is an index-linked
+ * list, so scheduling, cancelling and expiring a timer are O(1) and allocate
+ * nothing once the pool has grown to the peak number of live timers.
+ */
+#ifndef TIMING_WHEEL_HPP
+#define TIMING_WHEEL_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+using namespace std;
+
+// Identifies a scheduled timer until it fires or is cancelled
+using TimerId = uint32_t;
+
+template<typename T>
+class TimingWheel
+{
+
+public:
+
+  // Number of wheels and slots per wheel
+  static const int LEVELS = 4;
+  static const int SLOT_BITS = 8;
+  static const int SLOTS = 1 << SLOT_BITS;
+
+  // ctor for an empty wheel whose clock starts at start
+  explicit TimingWheel(uint64_t start = 0);
+
+  // Schedule payload to fire at tick when; a tick that has already passed fires on the next tick.
+  // Ticks more than 2^32 ahead wait in the top wheel and are placed again as it turns.
+  TimerId Schedule(uint64_t when, const T &payload);
+
+  // Cancel a timer that has not fired yet
+  void Cancel(TimerId timer);
+
+  // Move the clock to now, calling f(payload) for every timer due on the way, in tick order.
+  // f may schedule or cancel timers.
+  template<typename F>
+  void Advance(uint64_t now, F f);
+
+  // Get the current tick
+  uint64_t Now() const;
+
+  // Get the number of timers waiting to fire
+  size_t Size() const;
+
+private:
+  static const int32_t NONE = -1;
+  static const uint64_t MASK = SLOTS - 1;
+
+  struct Timer
+  {
+    uint64_t when;
+    T payload;
+    int32_t prev;
+    int32_t next;
+    uint8_t level;
+    uint8_t slot;
+  };
+
+  void Place(TimerId timer);
+  void Unlink(TimerId timer);
+  int32_t Detach(int level, int slot);
+
+  int32_t heads[LEVELS][SLOTS];
+  size_t levelCount[LEVELS];
+  vector<Timer> timers;
+  vector<TimerId> freeTimers;
+  uint64_t current;
+  size_t live;
+
+};
+
+template<typename T>
+TimingWheel<T>::TimingWheel(uint64_t start) : current(start), live(0)
+{
+  for (int l = 0; l < LEVELS; ++l) {
+    levelCount[l] = 0;
+    for (int s = 0; s < SLOTS; ++s)
+      heads[l][s] = NONE;
+  }
+}
+
+// The wheel is chosen by the highest 8-bit group in which when and now differ
+template<typename T>
+void TimingWheel<T>::Place(TimerId timer)
+{
+  Timer &t = timers[timer];
+  int level = 0;
+  while (level < LEVELS - 1 && (t.when >> (SLOT_BITS * (level + 1))) != (current >> (SLOT_BITS * (level + 1))))
+    ++level;
+  uint64_t slot = (t.when >> (SLOT_BITS * level)) & MASK;
+  if ((t.when - current) >> (SLOT_BITS * LEVELS))
+    slot = ((current >> (SLOT_BITS * level)) - 1) & MASK; // too far out: wait a full turn of the top wheel
+  t.level = uint8_t(level);
+  t.slot = uint8_t(slot);
+  t.prev = NONE;
+  t.next = heads[level][slot];
+  if (t.next != NONE)
+    timers[t.next].prev = int32_t(timer);
+  heads[level][slot] = int32_t(timer);
+  ++levelCount[level];
+}
+
+template<typename T>
+void TimingWheel<T>::Unlink(TimerId timer)
+{
+  Timer &t = timers[timer];
+  if (t.prev == NONE)
+    heads[t.level][t.slot] = t.next;
+  else
+    timers[t.prev].next = t.next;
+  if (t.next != NONE)
+    timers[t.next].prev = t.prev;
+  --levelCount[t.level];
+}
+
+template<typename T>
+int32_t TimingWheel<T>::Detach(int level, int slot)
+{
+  int32_t head = heads[level][slot];
+  heads[level][slot] = NONE;
+  return head;
+}
+
+template<typename T>
+TimerId TimingWheel<T>::Schedule(uint64_t when, const T &payload)
+{
+  TimerId timer;
+  if (!freeTimers.empty()) {
+    timer = freeTimers.back();
+    freeTimers.pop_back();
+  } else {
+    timer = TimerId(timers.size());
+    timers.emplace_back();
+  }
+  timers[timer].when = (when > current) ? when : current + 1;
+  timers[timer].payload = payload;
+  Place(timer);
+  ++live;
+  return timer;
+}
+
+template<typename T>
+void TimingWheel<T>::Cancel(TimerId timer)
+{
+  Unlink(timer);
+  freeTimers.push_back(timer);
+  --live;
+}
+
+template<typename T>
+template<typename F>
+void TimingWheel<T>::Advance(uint64_t now, F f)
+{
+  while (current < now) {
+    // nothing fires or pours down before the next slot of the lowest wheel holding a timer
+    int lowest = 0;
+    while (lowest < LEVELS - 1 && levelCount[lowest] == 0)
+      ++lowest;
+    uint64_t idle = (live == 0) ? now : current | ((uint64_t(1) << (SLOT_BITS * lowest)) - 1);
+    if (idle >= now) {
+      current = now;
+      return;
+    }
+    current = idle + 1;
+    // pour down every wheel whose slot the clock has just reached, highest first
+    int top = 0;
+    while (top < LEVELS - 1 && ((current >> (SLOT_BITS * (top + 1))) << (SLOT_BITS * (top + 1))) == current)
+      ++top;
+    for (int level = top; level > 0; --level) {
+      int32_t index = Detach(level, int((current >> (SLOT_BITS * level)) & MASK));
+      while (index != NONE) {
+        int32_t next = timers[index].next;
+        --levelCount[level];
+        Place(TimerId(index));
+        index = next;
+      }
+    }
+    // fire from the head of the slot so a callback may cancel a timer still waiting in it
+    int slot = int(current & MASK);
+    while (heads[0][slot] != NONE) {
+      TimerId timer = TimerId(heads[0][slot]);
+      Unlink(timer);
+      T payload = timers[timer].payload;
+      freeTimers.push_back(timer);
+      --live;
+      f(payload);
+    }
+  }
+}
+
+template<typename T>
+uint64_t TimingWheel<T>::Now() const
+{
+  return current;
+}
+
+template<typename T>
+size_t TimingWheel<T>::Size() const
+{
+  return live;
+}
+
+#endif
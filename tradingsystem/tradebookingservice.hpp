@@ -13,13 +13,16 @@
 #include <sstream>
 #include "soa.hpp"
 #include "products.hpp"
+#include "streamreader.hpp"
+#include "productregistry.hpp"
+#include "tickprice.hpp"
 
 // Trade sides
 enum Side { BUY, SELL };
 
 /**
  * Trade object with a price, side, and quantity on a particular book.
- * Type T is the product type.
+ * Type T is the product type; the product is referenced, not copied, and must outlive the trade.
  */
 template<typename T>
 class Trade
@@ -28,7 +31,7 @@ class Trade
 public:
 
   // ctor for a trade
-  Trade(const T &_product, string _tradeId, double _price, string _book, long _quantity, Side _side);
+  Trade(const T &_product, string _tradeId, TickPrice _price, string _book, long _quantity, Side _side);
 
   // Get the product
   const T& GetProduct() const;
@@ -37,7 +40,7 @@ public:
   const string& GetTradeId() const;
 
   // Get the mid price
-  double GetPrice() const;
+  TickPrice GetPrice() const;
 
   // Get the book
   const string& GetBook() const;
@@ -49,9 +52,9 @@ public:
   Side GetSide() const;
 
 private:
-  T product;
+  const T* product;
   string tradeId;
-  double price;
+  TickPrice price;
   string book;
   long quantity;
   Side side;
@@ -116,47 +119,46 @@ public:
 
 class BondTradeBookingConnector: public Connector<Trade<Bond> > {
 private:
-    int counter;
+    StreamReader reader;
 public:
     virtual void Publish(Trade<Bond> &data) {}
 
-    BondTradeBookingConnector():counter(0) {}
-
-    virtual void Subscribe(BondTradeBookService& bt_book_service, map<string, Bond> m_bond) {
-        ifstream iFile;
-        iFile.open("./Input/trades.txt");
-        string line;
-        try{
-            for (int i = 0; i < counter; ++i)
-                getline(iFile,line);
-        } catch(...){
-            iFile.close();
-            return;
-        }
-        if (getline(iFile, line)) {
-            ++counter;
-            stringstream sStream(line);
-            string tmp;
-            vector<string> data;
-            while (getline(sStream, tmp, ',')) {
-                data.push_back(tmp);
-            }
-            string tradeID = data[0];
-            Bond product = m_bond[data[1]];
-            string bookID = data[2];
-            long quantity = stol(data[3]);
-            Side side = (data[4] == "BUY")?BUY:SELL;
-            double price = 100;
-            Trade<Bond> trade(product, tradeID, price, bookID, quantity, side);
-            bt_book_service.OnMessage(trade);
-        }
-        iFile.close();
+    explicit BondTradeBookingConnector(const string& path = "./Input/trades.txt"):reader(path) {}
+
+    // Push the next trade in the file to the service; returns false once the file is exhausted
+    virtual bool Subscribe(BondTradeBookService& bt_book_service, const ProductRegistry& registry) {
+        string_view line;
+        if (!reader.NextLine(line))
+            return false;
+        string_view data[5];
+        if (SplitFields(line, data, 5) < 5)
+            return true;
+        ProductHandle handle = registry.Find(data[1]);
+        if (handle == ProductRegistry::NOT_FOUND)
+            return true;
+        string tradeID(data[0]);
+        const Bond& product = registry.GetBond(handle);
+        string bookID(data[2]);
+        long quantity = ParseLong(data[3]);
+        Side side = (data[4] == "BUY")?BUY:SELL;
+        TickPrice price = TickPrice::FromPoints(100);
+        Trade<Bond> trade(product, tradeID, price, bookID, quantity, side);
+        bt_book_service.OnMessage(trade);
+        return true;
+    }
+
+    // Push every remaining trade in the file to the service in one pass
+    long SubscribeAll(BondTradeBookService& bt_book_service, const ProductRegistry& registry) {
+        long count = 0;
+        while (Subscribe(bt_book_service, registry))
+            ++count;
+        return count;
     }
 };
 
 template<typename T>
-Trade<T>::Trade(const T &_product, string _tradeId, double _price, string _book, long _quantity, Side _side) :
-  product(_product)
+Trade<T>::Trade(const T &_product, string _tradeId, TickPrice _price, string _book, long _quantity, Side _side) :
+  product(&_product)
 {
   tradeId = _tradeId;
   price = _price;
@@ -168,7 +170,7 @@ Trade<T>::Trade(const T &_product, string _tradeId, double _price, string _book,
 template<typename T>
 const T& Trade<T>::GetProduct() const
 {
-  return product;
+  return *product;
 }
 
 template<typename T>
@@ -178,7 +180,7 @@ const string& Trade<T>::GetTradeId() const
 }
 
 template<typename T>
-double Trade<T>::GetPrice() const
+TickPrice Trade<T>::GetPrice() const
 {
   return price;
 }